@@ -0,0 +1,121 @@
+// 异步块io
+//
+// linux下优先使用io_uring，一次提交多个读写请求，完成后按tag取回；
+// 内核不支持io_uring或其它平台时，退化为线程池执行同步读写。
+#ifndef __DB_AIO_H__
+#define __DB_AIO_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace db {
+
+class File;
+class AsyncIO
+{
+  public:
+    // 一个io请求
+    struct Request
+    {
+        File *file;                // 文件
+        unsigned long long offset; // 偏移量
+        char *buffer;              // 读写buffer
+        size_t length;             // 剩余长度
+        bool write;                // 读还是写
+        void *tag;                 // 用户标记，完成时原样返回
+        int result;                // 完成结果，S_OK或错误码
+    };
+
+  private:
+    // io_uring
+    int ring_;               // io_uring描述符，-1表示使用线程池
+    unsigned entries_;       // 提交队列长度
+    void *sqPtr_;            // 提交队列映射
+    size_t sqSize_;          // 提交队列映射长度
+    void *cqPtr_;            // 完成队列映射
+    size_t cqSize_;          // 完成队列映射长度
+    void *sqes_;             // 提交项数组
+    unsigned *sqHead_;       // 提交队列头，内核推进
+    unsigned *sqTail_;       // 提交队列尾，用户推进
+    unsigned *sqMask_;       // 提交队列掩码
+    unsigned *sqArray_;      // 提交队列索引数组
+    unsigned *cqHead_;       // 完成队列头，用户推进
+    unsigned *cqTail_;       // 完成队列尾，内核推进
+    unsigned *cqMask_;       // 完成队列掩码
+    void *cqes_;             // 完成项数组
+    unsigned pending_;       // 已入队尚未提交给内核的请求
+    std::vector<Request> slots_; // 在途请求，下标即user_data
+    std::vector<unsigned> free_; // 空闲槽位
+
+    // 线程池
+    std::vector<std::thread> workers_; // 工作线程
+    std::mutex mutex_;                 // 保护队列
+    std::condition_variable ready_;    // 有新请求
+    std::condition_variable done_;     // 有请求完成
+    std::deque<Request> queue_;        // 待执行请求
+    std::deque<Request> finished_;     // 已完成请求
+    bool stop_;                        // 线程池退出
+
+    size_t inflight_; // 已提交未取回的请求个数
+
+  public:
+    AsyncIO()
+        : ring_(-1)
+        , entries_(0)
+        , sqPtr_(NULL)
+        , sqSize_(0)
+        , cqPtr_(NULL)
+        , cqSize_(0)
+        , sqes_(NULL)
+        , sqHead_(NULL)
+        , sqTail_(NULL)
+        , sqMask_(NULL)
+        , sqArray_(NULL)
+        , cqHead_(NULL)
+        , cqTail_(NULL)
+        , cqMask_(NULL)
+        , cqes_(NULL)
+        , pending_(0)
+        , stop_(false)
+        , inflight_(0)
+    {}
+    ~AsyncIO() { shutdown(); }
+
+    // 初始化，depth为队列深度，threads为退化时的线程个数
+    int init(unsigned depth = 64, unsigned threads = 4);
+    // 关闭，放弃未取回的请求
+    void shutdown();
+    // 排队一个读写请求，flush之后才真正提交
+    int submit(
+        File *file,
+        unsigned long long offset,
+        char *buffer,
+        size_t length,
+        bool write,
+        void *tag);
+    // 将排队的请求提交给内核
+    int flush();
+    // 取回一个完成的请求，wait为真时阻塞到有请求完成
+    bool complete(void **tag, int *result, bool wait);
+
+    // 在途请求个数
+    inline size_t inflight() { return inflight_; }
+    // 是否使用io_uring
+    inline bool uring() { return ring_ != -1; }
+
+  private:
+    int initRing(unsigned depth);
+    int queueRing(unsigned slot);
+    bool reapRing(void **tag, int *result);
+    void work();
+};
+
+// 全局异步io
+extern AsyncIO kAio;
+
+} // namespace db
+
+#endif // __DB_AIO_H__
@@ -50,6 +50,7 @@
 #include "./record.h"
 #include "./schema.h"
 #include "./datatype.h"
+#include <memory>
 #include <stack>
 
 namespace db {
@@ -60,8 +61,14 @@ const unsigned short BLOCK_TYPE_DATA = 2;  // 数据
 const unsigned short BLOCK_TYPE_INDEX = 3; // 索引
 const unsigned short BLOCK_TYPE_META = 4;  // 元数据
 const unsigned short BLOCK_TYPE_LOG = 5;   // wal日志
+const unsigned short BLOCK_TYPE_MASK = 0x00ff; // 类型字段的低字节为类型，高字节为标志
+const unsigned short BLOCK_FLAG_COMPACT = 0x0100; // 紧凑格式的索引节点，见IndexHeader
+const unsigned short BLOCK_DIRECTORY_SHIFT = 12;  // 数据块键目录的项宽在类型字段的高4位，0为没有
 
 const unsigned int SUPER_SIZE = 1024 * 4;  // 超块大小为4KB
+// 文件格式版本，记在超块上，与之不符的表文件不能打开
+// 1: 整数键按有符号序排列，块类型字段带标志
+const unsigned int FORMAT_VERSION = 1;
 const unsigned int BLOCK_SIZE = 1024 * 16; // 一般块大小为16KB
 const unsigned short DATA_FREESIZE = 16344;  // DataBlock的初始freesize
 
@@ -106,7 +113,7 @@ struct SuperHeader : CommonHeader
     unsigned int idlecounts; // 空闲块个数
     unsigned int self;       // 本块id(4B)
     unsigned int maxid;      // 最大的blockid(4B)
-    unsigned int pad;        // 填充位(4B)
+    unsigned int version;    // 文件格式版本(4B)
     unsigned int root;       // 根节点blockid
 };
 
@@ -129,6 +136,16 @@ struct DataHeader : CommonHeader
 // 元数据块头部
 using MetaHeader = DataHeader;
 
+// 紧凑索引节点头部
+// 键为定长类型时内节点不用slots[]和Record，头部之后先放所有键的公共前缀，
+// 再紧排定长项[键的后缀][子节点]，子节点为大端；slots为项数
+// 类型字段带BLOCK_FLAG_COMPACT，格式以此为准，不看表的键类型
+struct IndexHeader : DataHeader
+{
+    unsigned short prefix; // 公共前缀长度(2B)
+};
+const unsigned short INDEX_KEY_MAX = 8; // 紧凑格式的键长上限，分裂出的一半不压缩也放得下
+
 ////
 // @brief
 // 公共block
@@ -176,9 +193,15 @@ class Block
     inline unsigned short getType()
     {
         SuperHeader *header = reinterpret_cast<SuperHeader *>(buffer_);
-        return be16toh(header->type);
+        return be16toh(header->type) & BLOCK_TYPE_MASK;
+    }
+    // 获取标志
+    inline unsigned short getFlags()
+    {
+        SuperHeader *header = reinterpret_cast<SuperHeader *>(buffer_);
+        return be16toh(header->type) & ~BLOCK_TYPE_MASK;
     }
-    // 设定类型
+    // 设定类型，可带标志，原有标志清除
     inline void setType(unsigned short type)
     {
         SuperHeader *header = reinterpret_cast<SuperHeader *>(buffer_);
@@ -244,12 +267,25 @@ class SuperBlock : public Block
         header->maxid = htobe32(maxid);
     }
 
+    // 获取文件格式版本
+    inline unsigned int getVersion()
+    {
+        SuperHeader *header = reinterpret_cast<SuperHeader *>(buffer_);
+        return be32toh(header->version);
+    }
+    // 设定文件格式版本
+    inline void setVersion(unsigned int version)
+    {
+        SuperHeader *header = reinterpret_cast<SuperHeader *>(buffer_);
+        header->version = htobe32(version);
+    }
+
     // 获取时戳
     inline TimeStamp getTimeStamp()
     {
         SuperHeader *header = reinterpret_cast<SuperHeader *>(buffer_);
         TimeStamp ts;
-        ::memcpy(&ts, &header->stamp, sizeof(TimeStamp));
+        ::memcpy((void *) &ts, &header->stamp, sizeof(TimeStamp));
         *((long long *) &ts) = be64toh(*((long long *) &ts));
         return ts;
     }
@@ -260,7 +296,7 @@ class SuperBlock : public Block
         TimeStamp ts;
         ts.now();
         *((long long *) &ts) = htobe64(*((long long *) &ts));
-        ::memcpy(&header->stamp, &ts, sizeof(TimeStamp));
+        ::memcpy(&header->stamp, (void *) &ts, sizeof(TimeStamp));
     }
 
     // 设置datacounts
@@ -362,6 +398,7 @@ class SuperBlock : public Block
 class MetaBlock : public Block
 {
   public:
+
     // 清数据块
     void clear(unsigned short spaceid, unsigned int self, unsigned short type);
 
@@ -457,12 +494,36 @@ class MetaBlock : public Block
         return !sum;
     }
 
-    // 获取trailer大小
+    // 键目录的项宽，只有数据块才有键目录，项宽记在类型字段上
+    // 键目录紧贴在slots[]之下，与slots[]一一对应，存主机字节序的定长键，
+    // 查找时不必经slot去解记录；没有表信息的读者照常从slots[]读记录
+    inline unsigned short getDirectoryWidth()
+    {
+        return getType() == BLOCK_TYPE_DATA
+                   ? getFlags() >> BLOCK_DIRECTORY_SHIFT
+                   : 0;
+    }
+    // 获取键目录指针
+    inline unsigned char *getDirectoryPointer()
+    {
+        return reinterpret_cast<unsigned char *>(getSlotsPointer()) -
+               getSlots() * getDirectoryWidth();
+    }
+    // 获取trailer大小，含键目录
     inline unsigned short getTrailerSize()
     {
         MetaHeader *header = reinterpret_cast<MetaHeader *>(buffer_);
         return ALIGN_TO_SIZE(
-            be16toh(header->slots) * sizeof(Slot) + sizeof(unsigned int));
+            be16toh(header->slots) * (sizeof(Slot) + getDirectoryWidth()) +
+            sizeof(unsigned int));
+    }
+    // 再分配一个槽位时trailer增加的大小
+    inline unsigned short getTrailerGrowth()
+    {
+        return ALIGN_TO_SIZE(
+                   (getSlots() + 1) * (sizeof(Slot) + getDirectoryWidth()) +
+                   sizeof(unsigned int)) -
+               getTrailerSize();
     }
     // 获取slots[]指针
     inline Slot *getSlotsPointer()
@@ -484,22 +545,27 @@ class MetaBlock : public Block
         MetaHeader *header = reinterpret_cast<MetaHeader *>(buffer_);
         // 判断是不是超过了Trailer的界限
         unsigned short upper = BLOCK_SIZE - getTrailerSize();
-        if (freespace >= upper) freespace = 0; //超过界限则设置为0
+        // 恰好填满时等于界限，仍是有效的偏移
+        if (freespace > upper) freespace = 0; //超过界限则设置为0
         header->freespace = htobe16(freespace);
     }
 
-    // 分配一个空间，直接返回指针，后续需要重新排列slots[]，second表示是否需要reorder
-    std::pair<unsigned char *, bool>
-    allocate(unsigned short space, unsigned short index);
+    // 分配一个空间，直接返回指针，槽位插在slots[index]处，空间不足返回nullptr
+    unsigned char *allocate(unsigned short space, unsigned short index);
     // 给定一条记录的槽位下标，回收一条记录，回收slots[]中分配的槽位
     void deallocate(unsigned short index);
-    // 回收删除记录的资源，回收了slots资源，后续需要重排slots[]
+    // 回收删除记录的资源，slots[]的顺序不变
     void shrink();
-    // 对slots[]重排
+    // 对slots[]全量重排，只在成批写入不按序的记录后使用
     inline void reorder(DataType *type, unsigned int key)
     {
         type->sort(buffer_, key);
+        if (getDirectoryWidth())
+            for (unsigned short i = 0; i < getSlots(); ++i)
+                setDirectory(i, key);
     }
+    // 以slots[index]处记录的第key个域填写键目录的第index项
+    void setDirectory(unsigned short index, unsigned int key);
 
     // 引用slots[]
     bool refslots(unsigned short index, Record &record)
@@ -519,6 +585,7 @@ class MetaBlock : public Block
 // DataBlock直接从MetaBlock派生
 //
 class Table;
+struct BufDesp;
 class DataBlock : public MetaBlock
 {
   public:
@@ -556,7 +623,7 @@ class DataBlock : public MetaBlock
     {}
 
     // 设定table
-    inline void setTable(Table *table) { table_ = table; }
+    void setTable(Table *table);
     // 获取table
     inline Table *getTable() { return table_; }
 
@@ -564,10 +631,14 @@ class DataBlock : public MetaBlock
     // 需要先将key转换为网络字节序
     // 给定一个关键字，从slots[]上搜索到该记录：
     // 1. 根据meta确定key的位置；
-    // 2. 采用二分查找在slots[]上寻找
+    // 2. 采用二分查找在slots[]上寻找，有键目录时在键目录上向量化查找
     // 返回值：
     // 返回lowerbound
+    // 组合键的key为编码后的键，见key.h
     unsigned short searchRecord(void *key, size_t size);
+    // 按表的键对slots[]全量重排，组合键逐条编码后比较
+    using MetaBlock::reorder;
+    void reorder();
     // 插入记录
     // 在block中插入记录，步骤如下：
     // 1. 先检查空间是否足够，如果够，则插入，然后重新排序；
@@ -579,6 +650,12 @@ class DataBlock : public MetaBlock
     // false - 表示block被分裂
     std::pair<bool, unsigned short>
     insertRecord(std::vector<struct iovec> &iov);
+    // 追加记录
+    // 键须大于block中已有的记录，直接分配在slots[]尾部，不查找也不排序；
+    // limit为已用空间的上限，用于批量装载时控制填充率，空block不受限制
+    // 返回值：
+    // false - 空间不够或超过limit
+    bool appendRecord(std::vector<struct iovec> &iov, unsigned short limit);
     // 修改记录
     // 修改一条存在的记录
     // 先标定原记录为tomestone，然后插入新记录
@@ -594,8 +671,31 @@ class DataBlock : public MetaBlock
         split(unsigned short insertPos, std::vector<struct iovec> &iov);
     inline bool isUnderflow() { return getFreeSize() > DATA_FREESIZE / 2; }
 
+    // 是否为紧凑格式的索引节点，见IndexHeader
+    // 以上查找、插入、删除、追加和分裂在紧凑节点上按定长项处理，
+    // freesize按不压缩的项长计，保证合并兄弟时放得下
+    inline bool isCompact()
+    {
+        return getType() == BLOCK_TYPE_INDEX &&
+               (getFlags() & BLOCK_FLAG_COMPACT);
+    }
+    // 设为新的索引节点，键为不超过INDEX_KEY_MAX的定长类型时用紧凑格式
+    void setIndexType();
+    // 设为新的空数据块，按directoryWidth带键目录
+    void setDataType();
+    // 将 slots[idx] 处的记录赋给 iov，紧凑节点还原出完整的键
+    // 内节点的键缓冲须有 getKeyBytes 大小
+    void fetchRecord(unsigned short idx, std::vector<struct iovec> &iov);
+    // 将 slots[idx] 处记录的键赋给 iov，叶节点取键所在的域，内节点取第0个域
+    // 键缓冲须有 getKeyBytes 大小
+    void fetchKey(unsigned short idx, struct iovec &iov);
+
     // 注意一定要与 releaseBuf 搭配
-    inline void attachBuffer(struct BufDesp **bd, unsigned int blockid);
+    // modify 为真时加排它闩，只读时不加，修改者已由表闩串行化
+    void attachBuffer(
+        struct BufDesp **bd,
+        unsigned int blockid,
+        bool modify = true);
     // 给定子节点对应的 slots 下标，尝试为其借键
     // 当 idx == -1 时对应最左指针
     // 当兄弟为叶节点时，需要 dataIov 来确定记录结构
@@ -604,14 +704,18 @@ class DataBlock : public MetaBlock
     // 传入需借键节点的 blockid 主要是减少重复代码
     // 使用 int 而非 unsigned short，
     // 因为这样更容易通过 -1 来处理最左指针
+    // force 为真时不管兄弟借出后是否下溢，用于合并放不下时重新分配
     bool borrow(
         int idx,
         unsigned int blockid,
-        std::vector<struct iovec> &dataIov);
+        std::vector<struct iovec> &dataIov,
+        bool force = false);
     // blockid 为需借键节点
     // 在父节点上调用该函数，且会删去子节点对应的键
     // 子节点合并后，本节点可能下溢，需在调用 merge 后判断
-    void merge(
+    // 返回值：ENOSPC内节点连同下拉的一项放不下，未作改动；
+    // EFAULT合并中途插入失败
+    int merge(
         int idx,
         unsigned int blockid,
         std::vector<struct iovec> &dataIov);
@@ -619,7 +723,8 @@ class DataBlock : public MetaBlock
     // blockIdx 为 block 在父节点中对应的下标
     // 会删去父节点中 block 对应的记录，
     // 但不会设置 block 的 next
-    void mergeBlock(
+    // 有记录插入失败时返回false
+    bool mergeBlock(
         unsigned int blockid,
         unsigned int parentId,
         int blockIdx,
@@ -630,7 +735,18 @@ class DataBlock : public MetaBlock
     // 需先将 keybuf 转换为网络字节序
     // iov 获取到的值是以网络字节序存储的
     int search(void *keybuf, unsigned int len, std::vector<struct iovec> &iov);
-    // iov[0] 应给出所要删除的键及其长度
+    // 批量查找，keys[i] 为网络字节序的第 i 个键
+    // 键排序后一起下降，每个内节点和叶节点只读一次，每层定出的子节点先预读
+    // 找到时 iovs[i] 存放记录、rets[i] 为 S_OK，否则 rets[i] 为 EFAULT
+    // 返回值：找到的记录数
+    size_t multiSearch(
+        std::vector<struct iovec> &keys,
+        std::vector<std::vector<struct iovec>> &iovs,
+        std::vector<int> &rets);
+    // 自根下降到 keybuf 所在的叶节点，按 intent 借出，intent 只能为
+    // BORROW_NONE 或 BORROW_READ；叶节点加闩后校验未变，否则从根重来
+    BufDesp *descend(void *keybuf, unsigned int len, int intent);
+    // iov[0] 应给出所要删除的键及其长度；表只读映射时返回EROFS
     int insert(std::vector<struct iovec> &iov); 
     int remove(std::vector<struct iovec> &iov);  
     int update(std::vector<struct iovec> &iov);
@@ -654,11 +770,90 @@ class DataBlock : public MetaBlock
 
     RecordIterator beginrecord();
     RecordIterator endrecord();
+
+  private:
+    // 在键目录上查找，返回lowerbound
+    unsigned short directorySearch(void *key, size_t len);
+    // 本内节点能否放下内节点from的所有项，以及from最左指针下拉的一项
+    bool canAbsorb(DataBlock &from);
+    // 组合键的叶节点查找，slots[]处记录的键现编码，返回lowerbound
+    unsigned short keySearch(void *key, size_t len);
+    // 紧凑节点的键长
+    unsigned short indexKeySize();
+    // 紧凑节点的公共前缀长度
+    unsigned short indexPrefix();
+    // 紧凑节点查找，返回lowerbound
+    unsigned short indexSearch(void *key, size_t len);
+    // 紧凑节点插入，键相等时返回(false, -1)，已用空间将超过limit时返回(false, 位置)
+    std::pair<bool, unsigned short>
+    indexInsert(std::vector<struct iovec> &iov, unsigned short limit);
+    // 紧凑节点删除iov[0]对应的项
+    bool indexRemove(std::vector<struct iovec> &iov);
+    // 紧凑节点分裂，语义同split
+    std::pair<unsigned int, bool> indexSplit(unsigned short insertPos);
+    // 解出紧凑节点的所有键和子节点，各自依次相接
+    void indexDecode(
+        std::vector<unsigned char> &keys,
+        std::vector<unsigned char> &children);
+    // 以count个键和子节点重写紧凑节点，公共前缀重新计算
+    void indexRebuild(
+        const unsigned char *keys,
+        const unsigned char *children,
+        unsigned short count);
+};
+
+////
+// 索引上层的缓存
+// 根节点及其下一层的内节点解码成键和子节点的数组，放在堆上，frame不钉住。
+// 乐观读者从这里开始下降，不再借超块和这几个节点，也不再解码记录。
+// 解码时记下frame的闩版本，只有节点真被修改（写者只对要改的节点加X闩）
+// 或frame被淘汰才改变版本，对应的缓存随之作废：根作废时重新解码根，
+// 下一层仍有效的节点按blockid留用，其余用到时逐个重建。
+struct IndexNode
+{
+    BufDesp *desp;                      // 节点所在的frame，不钉住
+    unsigned int version;               // 解码时的闩版本
+    unsigned int blockid;               // 节点的blockid
+    bool leaf;                          // 是否叶节点，叶节点只记位置
+    unsigned int first;                 // 最左指针
+    std::vector<unsigned char> keys;    // 分隔键依次相接
+    std::vector<unsigned int> offsets;  // 第i个键在keys中的起点，末尾多一项
+    std::vector<unsigned int> children; // 第i个键右侧的子节点
+
+    IndexNode()
+        : desp(NULL)
+        , version(0)
+        , blockid(0)
+        , leaf(false)
+        , first(0)
+    {}
+
+    // frame的内容是否仍与解码时一致
+    bool valid();
+    // 键所在子节点的位置，与childOf相同：等于分隔键时走右侧
+    // 0为最左指针，i+1为第i个键右侧的指针
+    size_t route(DataType *type, void *keybuf, unsigned int len);
+    // 位置pos上的子节点
+    inline unsigned int child(size_t pos)
+    {
+        return pos ? children[pos - 1] : first;
+    }
 };
+struct IndexCache
+{
+    std::shared_ptr<IndexNode> root;               // 根节点
+    std::vector<std::shared_ptr<IndexNode>> below; // 根的各子节点，按位置，空表示未缓存
+};
+
+// 表的数据块键目录的项宽，键为不超过INDEX_KEY_MAX的定长类型时才有，否则为0
+// 只在新建数据块时用，已有的块以类型字段上记的项宽为准
+unsigned short directoryWidth(RelationInfo *info);
 
-// 返回 DataType 对应类型的字节数
-// 不考虑 VARCHAR 作为主键类型
-inline size_t getKeyBytes(DataType *keyType) { return keyType->size; }
+// 返回 DataType 对应类型的字节数，变长类型取最大长度
+inline size_t getKeyBytes(DataType *keyType)
+{
+    return keyType->size < 0 ? -keyType->size : keyType->size;
+}
 
 // 将 slots[idx] 处的记录赋给 iov
 inline void getRecord(
@@ -1,39 +1,150 @@
 // 数据库buffer层
 //
 // 文件切分为 blocks，因此读时需同时指定文件和 blockid；
-// buffer 设计：十字链表组织 Hash Table 和 LRU 队列；
-// 淘汰 LRU 中的 page 时，若为脏页则需先刷到磁盘上，否则直接丢掉。
+// buffer 设计：Hash Table 查找 block，替换策略决定淘汰哪个 block；
+// 淘汰 page 时，若为脏页则需先刷到磁盘上，否则直接丢掉。
+// table+blockid 按hash分到多个分区，各分区有自己的锁、块表和替换策略；
+// 命中时不加锁，乐观查找块表后只做一次引用计数原子加。
+// 引用计数只保证block不被淘汰，读写block内容还需按借用意图加共享或排它闩。
 #ifndef __DB_BUFFER_H__
 #define __DB_BUFFER_H__
 
-#include <string>
-#include <map>
 #include <atomic>
+#include <vector>
+#include "./aio.h"
+#include "./replacer.h"
+#include "./latch.h"
 
 namespace db {
 // buffer描述符
 struct BufDesp
 {
-    BufDesp *next;                  // 下一个描述符
-    BufDesp *prev;                  // 前一个描述符
-    const char *name;               // 表名
-    unsigned char *buffer;          // 缓冲
-    unsigned int blockid;           // block的id
-    unsigned short size;            // 大小
-    unsigned char type;             // 类型
-    std::atomic<unsigned char> ref; // 引用计数
+    BufDesp *next;                   // 下一个描述符
+    BufDesp *prev;                   // 前一个描述符
+    const char *name;                // 表名
+    File *file;                      // 所在文件
+    unsigned char *buffer;           // 缓冲
+    unsigned int table;              // 表的id
+    unsigned int blockid;            // block的id
+    unsigned short size;             // 大小
+    std::atomic<unsigned char> type; // 类型
+    std::atomic<unsigned char> ref;  // 引用计数
+    std::atomic<bool> touched;       // 无锁命中过，替换策略持锁时消费
+    std::atomic<unsigned> writes;    // writeBuf次数，刷盘前后不同表示又被修改
+    void *link;                      // 替换策略私有，所在队列或时钟节点
+    Latch latch;                     // 读写闩，保护block内容
 
     BufDesp()
         : next(NULL)
         , prev(NULL)
         , name(NULL)
-        , blockid(0)
+        , file(NULL)
         , buffer(NULL)
+        , table(0)
+        , blockid(0)
         , size(0)
         , type(0)
+        , ref(0)
+        , touched(false)
+        , writes(0)
+        , link(NULL)
     {}
     inline void addref() { ++ref; }
     inline void relref() { --ref; }
+    // 记录一次无锁命中，已记录时不写，避免抢缓存行
+    inline void touch()
+    {
+        if (!touched.load(std::memory_order_relaxed))
+            touched.store(true, std::memory_order_relaxed);
+    }
+    // 取出并清除命中记录
+    inline bool untouch()
+    {
+        return touched.load(std::memory_order_relaxed) &&
+               touched.exchange(false, std::memory_order_relaxed);
+    }
+};
+
+// 借用意图，决定借用时加什么闩
+enum
+{
+    BORROW_NONE = 0, // 只钉住，不加闩
+    BORROW_READ,     // 共享闩
+    BORROW_WRITE,    // 排它闩
+};
+
+////
+// 块表，开放寻址的hash表，table id+blockid --> BufDesp
+// 线性探测，删除时后移填补空位，不需要墓碑
+// 修改需持锁；find可以不持锁乐观读，读到的结果需由调用者校验，
+// 扩容后旧数组不立即释放，保证乐观读不会访问已释放的内存
+class BlockMap
+{
+  private:
+    struct Entry
+    {
+        unsigned long long key; // table id + blockid
+        BufDesp *desp;          // NULL表示空位
+    };
+    struct Slots
+    {
+        Entry *entries; // 槽位数组
+        size_t mask;    // 槽位数-1，槽位数为2的幂
+        unsigned shift; // 64-log2(槽位数)
+    };
+    std::atomic<Slots *> slots_;  // 当前槽位
+    std::vector<Slots *> retired_; // 扩容前的槽位，析构时释放
+    size_t size_;                  // 已用槽位
+
+  public:
+    BlockMap()
+        : slots_(NULL)
+        , size_(0)
+    {}
+    ~BlockMap();
+
+    static inline unsigned long long key(unsigned int table, unsigned int blockid)
+    {
+        return (unsigned long long) table << 32 | blockid;
+    }
+
+    // 预留至少count个元素的空间
+    void reserve(size_t count);
+    // 查找，不存在返回NULL
+    inline BufDesp *find(unsigned int table, unsigned int blockid)
+    {
+        Slots *slots = slots_.load(std::memory_order_acquire);
+        if (slots == NULL) return NULL;
+        unsigned long long k = key(table, blockid);
+        // 乐观读时其它线程可能正在挪动元素，最多探测一圈
+        size_t i = hash(slots, k);
+        for (size_t n = 0; n <= slots->mask; ++n, i = (i + 1) & slots->mask) {
+            if (slots->entries[i].desp == NULL) return NULL;
+            if (slots->entries[i].key == k) return slots->entries[i].desp;
+        }
+        return NULL;
+    }
+    // 插入，已存在时覆盖
+    void insert(unsigned int table, unsigned int blockid, BufDesp *desp);
+    // 删除，返回是否存在
+    bool erase(unsigned int table, unsigned int blockid);
+    // 元素个数
+    inline size_t size() { return size_; }
+    // 遍历所有描述符，遍历时不能修改
+    template <typename Func>
+    void each(Func func)
+    {
+        Slots *slots = slots_.load(std::memory_order_relaxed);
+        for (size_t i = 0; slots && i <= slots->mask; ++i)
+            if (slots->entries[i].desp) func(slots->entries[i].desp);
+    }
+
+  private:
+    // fibonacci hash，取乘积高位
+    static inline size_t hash(Slots *slots, unsigned long long k)
+    {
+        return (size_t) ((k * 0x9E3779B97F4A7C15ULL) >> slots->shift);
+    }
 };
 
 ////
@@ -42,54 +153,238 @@ struct BufDesp
 // 2. 上层借用buffer后，用完后需要即可归还，不要长时间持有buffer；
 // 3. 上层调用write接口写，调用release释放buffer；
 // 4. 完整的实现，Buffer应该由一个协程控制，上层用户通过rpc请求block；
-// 5. Buffer应该自主刷盘，同时设置两个通道
+// 5. Buffer应该自主刷盘，同时设置两个通道，后台刷盘线程按脏块水位写回
+// 6. 多个线程可以同时借还，同一block的修改由上层互斥
 // TODO: 日志刷盘
 class FilePool;
+class File;
 class Buffer
 {
   public:
-    using BlockMap = std::map<std::pair<std::string, unsigned int>, BufDesp *>;
-
-    unsigned char BUFFER_LOCKED = 0x1; // 锁定buffer
-    unsigned char BUFFER_DIRTY = 0x2;  // 脏buffer
-    unsigned char BUFFER_READY = 0x4;  // 可回写buffer
+    unsigned char BUFFER_LOCKED = 0x1;    // 锁定buffer
+    unsigned char BUFFER_DIRTY = 0x2;     // 脏buffer
+    unsigned char BUFFER_READY = 0x4;     // 可回写buffer
+    unsigned char BUFFER_IO = 0x8;        // 异步读尚未完成
+    unsigned char BUFFER_MAPPED = 0x10;   // 指向文件映射区，只读
+    unsigned char BUFFER_FLUSHING = 0x20; // 正在刷盘，借用需等待
 
   private:
-    BufDesp *idle_;         // 空闲buffer
-    BufDesp lru_;           // 最近访问队列
-    BlockMap map_;          // 块表 table+blockid --> BufDesp
+    // 分区，frame和描述符一一对应，描述符淘汰后放回idle重用，不释放
+    struct Shard
+    {
+        std::mutex mutex;                // 保护本分区
+        std::condition_variable flushed; // 本分区一批刷盘完成
+        std::atomic<unsigned> version;   // 块表或借用状态修改时为奇数，改完加1
+        BlockMap map;                    // 块表 table+blockid --> BufDesp
+        Replacer *replacer;              // 替换策略
+        BufDesp *descs;                  // 本分区的描述符
+        BufDesp *idle;                   // 空闲描述符
+        std::vector<BufDesp *> mapped;   // 映射区的描述符，至多frames个
+        size_t mappedHand;               // 回收映射区描述符的时钟指针
+        size_t frames;                   // frame个数
+        size_t idleCount;                // 空闲块个数
+        size_t flushing;                 // 正在刷盘的块个数
+        std::atomic<size_t> hits;        // 命中次数
+        std::atomic<size_t> misses;      // 缺页次数
+
+        Shard()
+            : version(0)
+            , replacer(NULL)
+            , descs(NULL)
+            , idle(NULL)
+            , mappedHand(0)
+            , frames(0)
+            , idleCount(0)
+            , flushing(0)
+            , hits(0)
+            , misses(0)
+        {}
+        // 开始修改，之后乐观读的校验会失败
+        inline void beginWrite() { version.fetch_add(1); }
+        // 结束修改
+        inline void endWrite()
+        {
+            version.fetch_add(1, std::memory_order_release);
+        }
+    };
+
+    Shard *shards_;         // 所有分区
+    size_t shardCount_;     // 分区个数，2的幂
     unsigned char *buffer_; // 所有buffer
     FilePool *filepool_;    // 文件池
-    size_t idleCount_;      // 空闲块个数
+    size_t frames_;         // buffer个数
+    AsyncIO aio_;           // 异步io，与File::complete的请求分开
+    std::mutex aioMutex_;   // 保护aio_
+    bool async_;            // 缺页时是否走异步io
+
+    // 刷盘
+    std::mutex flushMutex_;          // 配合wakeup_
+    std::condition_variable wakeup_; // 唤醒刷盘线程
+    std::thread flusher_;            // 后台刷盘线程
+    bool stopping_;                  // 刷盘线程退出
+    std::atomic<size_t> dirty_;      // 脏块个数
+    double high_;                    // 脏块比例超过高水位时唤醒刷盘线程
+    double low_;                     // 刷到低水位为止
+    std::atomic<size_t> reserved_;   // 借作工作区的frame个数
 
   public:
     Buffer()
-        : idle_(NULL)
+        : shards_(NULL)
+        , shardCount_(0)
         , buffer_(NULL)
         , filepool_(NULL)
-        , idleCount_(0)
+        , frames_(0)
+        , async_(false)
+        , stopping_(false)
+        , dirty_(0)
+        , high_(0.25)
+        , low_(0.1)
+        , reserved_(0)
     {}
     ~Buffer();
 
-    // 初始化缺省大小为256MB
-    void init(FilePool *fp, size_t defaultSize = 256);
-    // 用户请求一个block
-    BufDesp *borrow(const char *table, unsigned int blockid);
+    // 初始化缺省大小为256MB，policy为替换策略，不支持时用LRU
+    // shards为分区个数，0表示按大小自动选择，每个分区至少1024个frame
+    void init(
+        FilePool *fp,
+        size_t defaultSize = 256,
+        const char *policy = "LRU",
+        size_t shards = 0);
+    // 切换替换策略，已缓存的block转入新策略，历史丢弃
+    int setPolicy(const char *policy);
+    // 当前替换策略的名字
+    inline const char *policy()
+    {
+        return shards_ ? shards_[0].replacer->name() : "LRU";
+    }
+    // 分区个数
+    inline size_t shards() { return shardCount_; }
+    // 用户请求一个block，intent为借用意图，闩在钉住之后再加
+    BufDesp *borrow(
+        const char *table,
+        unsigned int blockid,
+        int intent = BORROW_NONE);
+    // 按表的id请求一个block，避免按表名查找文件
+    BufDesp *borrow(
+        unsigned int table,
+        unsigned int blockid,
+        int intent = BORROW_NONE);
     // 写一个block
     void writeBuf(BufDesp *desp);
-    // 释放block
-    inline void releaseBuf(BufDesp *desp) { desp->relref(); }
+    // 释放block，intent须与借用时相同
+    inline void releaseBuf(BufDesp *desp, int intent = BORROW_NONE)
+    {
+        if (intent == BORROW_READ)
+            desp->latch.unlockShared();
+        else if (intent == BORROW_WRITE)
+            desp->latch.unlock();
+        desp->relref();
+    }
+
+    // 打开异步模式，缺页读经由io_uring或线程池批量提交
+    int enableAsync(unsigned depth = 64);
+    // 关闭异步模式，在途的预读全部回收后缺页改回同步读
+    void disableAsync();
+    // 是否处于异步模式
+    inline bool async() { return async_; }
+    // 预读一个block，不增加引用计数，异步模式下需flush后才真正提交
+    int prefetch(const char *table, unsigned int blockid);
+    // 按表的id预读，cold为真时以低优先级进入替换策略，用于顺序扫描的预读
+    int prefetch(unsigned int table, unsigned int blockid, bool cold = false);
+    // block是否正在异步读入
+    bool reading(unsigned int table, unsigned int blockid);
+    // 提交所有预读请求
+    int flush();
+    // 回收完成的预读，wait为真时至少等待一个完成，返回回收个数
+    size_t reap(bool wait);
+    // 批量借用blocks，缺页一次提交，out[i]对应ids[i]
+    int borrowBatch(
+        const char *table,
+        const unsigned int *ids,
+        size_t count,
+        BufDesp **out);
 
+    // 借出count个frame作工作区，如外排序的内存，借出期间不缓存block
+    // 至多借出总数的一半，frame追加到frames，返回实际借到的个数
+    size_t reserve(size_t count, std::vector<BufDesp *> &frames);
+    // 归还工作区，frames清空
+    void unreserve(std::vector<BufDesp *> &frames);
     // 空闲块个数
-    inline size_t idles() { return idleCount_; }
-    // 分配buffer
-    BufDesp *allocFromIdle();
-    // prepend到lru头部
-    void prependLru(BufDesp *ptr);
+    size_t idles();
+    // 映射区描述符个数
+    size_t mappings();
+
+    // 命中次数，预读不计
+    size_t hits();
+    // 缺页次数
+    size_t misses();
+    // 命中率
+    inline double hitRate()
+    {
+        size_t h = hits(), m = misses();
+        return h + m ? (double) h / (h + m) : 0.0;
+    }
+    // 计数清零
+    void resetStats();
+
+    // 启动后台刷盘线程，脏块比例超过high时写回未被借用的脏块，直到低于low
+    int startFlusher(double high = 0.25, double low = 0.1);
+    // 停止后台刷盘线程
+    void stopFlusher();
+    // 写回所有脏块，包括被借用的；写回期间又被修改的block保持dirty
+    int flushAll();
+    // 检查点，写回所有脏块并刷到磁盘
+    int checkpoint();
+    // 脏块个数
+    inline size_t dirties() { return dirty_.load(); }
+
+  private:
+    // block所在的分区
+    inline Shard &shardOf(unsigned int table, unsigned int blockid)
+    {
+        unsigned long long k = BlockMap::key(table, blockid);
+        return shards_
+            [(size_t) ((k * 0x9E3779B97F4A7C15ULL) >> 32) & (shardCount_ - 1)];
+    }
+    // 从分区的idle上分配描述符，调用时持锁
+    BufDesp *allocFromIdle(Shard &shard);
+    // 取一个映射区描述符，未满frames个时新分配，否则回收一个未被借用的
+    // 调用时持锁且处于修改中，都被借用时返回NULL
+    BufDesp *allocMapped(Shard &shard);
+    // 由替换策略选一个未被借用的block淘汰，描述符归还idle
+    // 调用时持锁且处于修改中；脏块标记刷盘后放锁写回，返回前重新持锁，
+    // 期间块表可能已变，调用者须重新查找
+    bool evict(Shard &shard, std::unique_lock<std::mutex> &lock);
+    // 分区没有空闲frame时淘汰一个，都被借用时先回收完成的预读再试
+    // 调用时持锁，可能放过锁，返回假表示所有block都被借用
+    bool reclaim(Shard &shard, std::unique_lock<std::mutex> &lock);
+    // 能否淘汰，供替换策略回调
+    static bool evictable(BufDesp *desp, void *arg);
+    // 将脏块写回文件
+    int writeBack(BufDesp *desp);
+    // 收集脏块，pinned为真时包括被借用的
+    void collectDirty(std::vector<BufDesp *> &blocks, bool pinned);
+    // 标记正在刷盘，已不满足条件的block从blocks中去掉
+    void markFlushing(std::vector<BufDesp *> &blocks, bool pinned);
+    // 写回已标记的脏块，按表和blockid排序，相邻block合并成一次写
+    int writeBlocks(std::vector<BufDesp *> &blocks);
+    // 刷盘线程
+    void flushLoop();
+    // 在块表中查找，未命中时读入，再按意图加闩
+    BufDesp *borrow(File *file, unsigned int blockid, int intent);
+    // 在块表中查找，未命中时读入
+    BufDesp *pin(File *file, unsigned int blockid);
+    // 预读，已在块表中时什么都不做
+    int prefetch(File *file, unsigned int blockid, bool cold);
+    // 缺页时分配buffer并读入block，调用时持锁且处于修改中
+    // 非映射的表须先由reclaim备好空闲frame，映射的表回收映射区描述符
+    // cold为真时以低优先级进入替换策略
+    BufDesp *
+    load(Shard &shard, File *file, unsigned int blockid, bool cold = false);
 };
 
 // 全局buffer管理器
 extern Buffer kBuffer;
 } // namespace db
 
-#endif // __DB_BUFFER_H__
\ No newline at end of file
+#endif // __DB_BUFFER_H__
@@ -17,7 +17,7 @@ inline unsigned short checksum(const unsigned char *buf, int len)
         len -= sizeof(unsigned short);
     }
     if (len) { sum += (*buf) << 8; }
-    return htons((unsigned short) (~sum) + 1);
+    return htobe16((unsigned short) (~sum) + 1);
 }
 inline unsigned int checksum32(const unsigned char *buf, int len)
 {
@@ -36,7 +36,7 @@ inline unsigned int checksum32(const unsigned char *buf, int len)
             if (len) { sum += (*buf++) << 8; --len; } } }
     // clang-format on
 
-    return htonl(static_cast<unsigned int>(~sum) + 1);
+    return htobe32(static_cast<unsigned int>(~sum) + 1);
 }
 
 } // namespace db
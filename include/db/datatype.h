@@ -28,17 +28,26 @@ struct DataType
         unsigned int xlen,
         unsigned char *y,
         unsigned int ylen);
+    // 分隔键长度：取y的最短前缀，仍大于x，x须小于y
+    // 定长类型不能截断，返回ylen
+    using Shorten = unsigned int (*)(
+        unsigned char *x,
+        unsigned int xlen,
+        unsigned char *y,
+        unsigned int ylen);
     // 大序与主机字节序之间的转换函数
     using Htobe = void (*)(void *);
     using Betoh = void (*)(void *);
 
-    const char *name; // 名字
-    ptrdiff_t size;   // >0表示固定，<0表示最大大小
-    Sort sort;        // slots[]排序函数
-    Search search;    // slots[]查找函数
-    Less less;        // 比较键
-    Htobe htobe;      // 转化为大序
-    Betoh betoh;      // 转化为主机字节序
+    const char *name;    // 名字
+    ptrdiff_t size;      // >0表示固定，<0表示最大大小
+    Sort sort;           // slots[]排序函数
+    Search search;       // slots[]查找函数
+    Less less;           // 比较键，按保序编码的顺序，见key.h
+    Shorten shorten;     // 截断分隔键
+    Htobe htobe;         // 转化为大序
+    Betoh betoh;         // 转化为主机字节序
+    bool byteComparable; // 按字节比较，键的任意前缀都可用作扫描前缀
 };
 
 // 根据数据类型名称数据类型，返回NULL表示失败
@@ -68,7 +68,7 @@
 
 #elif defined(__WINDOWS__)
 
-#    include "./config.h"
+#    include <db/config.h>
 #    include <winsock2.h>
 #    pragma comment(lib, "ws2_32.lib")
 
@@ -2,34 +2,100 @@
 #ifndef __DB_FILE_H__
 #define __DB_FILE_H__
 
-#include "./config.h"
+#include <db/config.h>
 #include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct iovec;
 
 namespace db {
 
 class File
 {
   public:
-    HANDLE handle_; // 文件描述符句柄
+    // 直接io要求偏移量、长度、buffer地址均按此对齐
+    static const size_t DIRECT_ALIGN = 4096;
+
+    // 映射区访问模式提示
+    enum
+    {
+        ADVICE_NORMAL = 0, // 缺省
+        ADVICE_SEQUENTIAL, // 顺序扫描
+        ADVICE_RANDOM,     // 随机访问
+    };
+
+  public:
+    HANDLE handle_;    // 文件描述符句柄，posix下为fd
+    unsigned int id_;  // 文件池中的编号
+    const char *name_; // 表名，由文件池持有
+    bool direct_;      // 是否绕过页缓存
+    char *map_;        // 只读映射区
+    size_t mapLength_; // 映射区长度
+    int advice_;       // 当前的访问模式提示
 
   public:
     File()
         : handle_(INVALID_HANDLE_VALUE)
+        , id_(0)
+        , name_(NULL)
+        , direct_(false)
+        , map_(NULL)
+        , mapLength_(0)
+        , advice_(ADVICE_NORMAL)
     {}
     ~File() { close(); }
 
-    // 打开文件
-    int open(const char *path);
+    // 打开文件，direct为真时绕过页缓存，文件系统不支持则退回普通模式
+    int open(const char *path, bool direct = false);
     // 关闭文件
     void close();
-    // 读文件
+    // 是否绕过页缓存
+    inline bool direct() { return direct_; }
+    // 读文件，读满length才返回，读到文件尾时剩余部分清零
+    // 直接io模式下未对齐的请求返回EINVAL
     int read(unsigned long long offset, char *buffer, size_t length);
-    // 写文件
+    // 写文件，写完length才返回
     int write(unsigned long long offset, const char *buffer, size_t length);
+    // 将count个buffer依次写到offset处，一次系统调用，写完才返回
+    int writev(unsigned long long offset, const struct iovec *iov, int count);
+    // 刷到磁盘
+    int sync();
     // 文件长度
     int length(unsigned long long &len);
     // 删除文件
     static int remove(const char *path);
+
+    // 异步读，完成后由complete取回tag
+    int submitRead(
+        unsigned long long offset,
+        char *buffer,
+        size_t length,
+        void *tag);
+    // 异步写，完成后由complete取回tag
+    int submitWrite(
+        unsigned long long offset,
+        const char *buffer,
+        size_t length,
+        void *tag);
+    // 取回一个完成的异步请求，wait为真时阻塞等待
+    static bool complete(void **tag, int *result, bool wait);
+
+    // 只读映射整个文件，映射后不能再修改文件
+    int map();
+    // 解除映射
+    void unmap();
+    // 是否已映射，映射后的表只读
+    inline bool mapped() { return map_ != NULL; }
+    // [offset, offset+length)在映射区内时返回其地址，否则返回NULL
+    inline const char *mapping(unsigned long long offset, size_t length)
+    {
+        if (map_ == NULL || offset + length > mapLength_) return NULL;
+        return map_ + offset;
+    }
+    // 设定映射区的访问模式，与当前模式相同时不做系统调用
+    void advise(int advice);
 };
 
 // 文件池
@@ -38,17 +104,27 @@ class FilePool
 {
   private:
     Schema *schema_;                   // 指向元数据
-    std::map<const char *, File> map_; // 表名 --> 描述符
+    std::map<std::string, File> map_;  // 表名 --> 描述符
+    std::vector<File *> files_;        // 编号 --> 描述符
+    bool direct_;                      // 新打开的表是否绕过页缓存
+    bool mapped_;                      // 新打开的表是否只读映射
+    std::mutex mutex_;                 // 保护map_和files_，open与get可并发
 
   public:
     FilePool()
         : schema_(NULL)
+        , direct_(false)
+        , mapped_(false)
     {}
 
-    // 初始化
-    void init(Schema *schema);
+    // 初始化，direct为真时表文件和_meta.db绕过页缓存
+    void init(Schema *schema, bool direct = false);
+    // 只读映射模式，之后打开的表(_meta.db除外)映射到内存，不能再修改
+    inline void setMapped(bool mapped) { mapped_ = mapped; }
     // 打开table
     File *open(const char *table);
+    // 按编号取已打开的表，files_扩容时旧指针失效，须持锁读
+    File *get(unsigned int id);
 };
 
 // 全局文件池
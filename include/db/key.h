@@ -0,0 +1,65 @@
+// 保序的键编码
+//
+// 键编码后按memcmp比较即为键的顺序，B+树的查找、排序和分隔键用同一种比较：
+// 1. 整数为大序并翻转符号位，有符号数按大小排列；
+// 2. 字符串按字节排列，前缀在前；不是最后一列时0x00转义为0x00 0xff，
+//    以0x00 0x00结尾，拼接后仍先按前一列排列；
+// 3. 多列的键按列依次相接。
+// 记录中的键仍按各类型的大序存放，单列键比较时就地按编码后的顺序比较，
+// 不必先编码；排序这类要反复比较同一批键的场合先编码一次，再直接memcmp。
+//
+// 组合键(RelationInfo::keys)的B+树以编码后的字节串为键：叶节点查找时现编码，
+// 内节点直接存编码后的分隔键；前导列编码后是完整键的前缀，前缀查找即是范围扫描。
+#ifndef __DB_KEY_H__
+#define __DB_KEY_H__
+
+#include <vector>
+#include "./record.h"
+
+namespace db {
+
+struct DataType;
+struct RelationInfo;
+
+// 比较两个编码后的键，返回值同memcmp，x是y的前缀时x小
+int compareKey(const void *x, size_t xlen, const void *y, size_t ylen);
+// 一列编码后的最大长度，len为列值的长度，last表示是否为键的最后一列
+size_t encodedSize(DataType *type, size_t len, bool last);
+// 编码一列，val为记录中的大序值，out须有encodedSize大小，返回写入的长度
+size_t encodeField(
+    DataType *type,
+    const void *val,
+    size_t len,
+    bool last,
+    unsigned char *out);
+// 由按表的字段排列的iov编码出记录的键，追加到key尾部
+void encodeKey(
+    RelationInfo *info,
+    std::vector<struct iovec> &iov,
+    std::vector<unsigned char> &key);
+// 编码组合键的前values.size()列，values[i]为第i个键列的值，追加到key尾部
+void encodePrefix(
+    RelationInfo *info,
+    std::vector<struct iovec> &values,
+    std::vector<unsigned char> &key);
+
+// 由keys设定组合键的类型，建表和加载元数据时调用
+void initKey(RelationInfo &info);
+// 表的键类型：单列键为该域的类型，组合键为按字节比较的编码
+DataType *keyType(RelationInfo *info);
+// 取按表的字段排列的记录的键：单列键即该域，组合键编码到buf
+struct iovec keyOf(
+    RelationInfo *info,
+    std::vector<struct iovec> &iov,
+    std::vector<unsigned char> &buf);
+// 引用记录中的键，同keyOf
+void refKey(
+    RelationInfo *info,
+    Record &record,
+    std::vector<unsigned char> &buf,
+    unsigned char **pkey,
+    unsigned int *len);
+
+} // namespace db
+
+#endif // __DB_KEY_H__
@@ -0,0 +1,128 @@
+// 读写闩
+//
+// 每个frame一个：状态字最高位为写者，次高位表示有线程在睡眠，其余为读者个数；
+// 抢不到时先自旋，再按地址散列到公共的等待队列上睡眠，由释放者唤醒。
+// 另有一个版本号，每次释放排它闩时加1，供乐观读校验：读前没有写者、
+// 读后版本未变，则读到的内容是一致的，乐观读不修改闩，也不等待。
+// 闩只保护block内容在短时间内的一致性，不是事务锁，不检测死锁，
+// 加闩顺序由使用者保证，参见Table::WriteLatch。
+#ifndef __DB_LATCH_H__
+#define __DB_LATCH_H__
+
+#include <atomic>
+
+namespace db {
+
+class Latch
+{
+  private:
+    static const unsigned WRITER = 0x80000000u;  // 写者持有
+    static const unsigned WAITING = 0x40000000u; // 有线程睡眠
+    static const unsigned READERS = 0x3fffffffu; // 读者个数
+
+    std::atomic<unsigned> state_;   // 状态字
+    std::atomic<unsigned> version_; // 版本号
+
+  public:
+    Latch()
+        : state_(0)
+        , version_(0)
+    {}
+    // 复制得到一个未加闩的新闩
+    Latch(const Latch &)
+        : state_(0)
+        , version_(0)
+    {}
+    Latch &operator=(const Latch &) { return *this; }
+
+    // 尝试加共享闩，不等待
+    inline bool tryLockShared()
+    {
+        unsigned s = state_.load(std::memory_order_relaxed);
+        while (!(s & WRITER))
+            if (state_.compare_exchange_weak(
+                    s, s + 1, std::memory_order_acquire))
+                return true;
+        return false;
+    }
+    // 尝试加排它闩，不等待
+    inline bool tryLock()
+    {
+        unsigned s = 0;
+        if (!state_.compare_exchange_strong(
+                s, WRITER, std::memory_order_acquire))
+            return false;
+        // 之后对block的写不能早于写者位被乐观读者看到
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+    // 加共享闩，有写者时等待
+    inline void lockShared()
+    {
+        if (!tryLockShared()) wait(false);
+    }
+    // 加排它闩，有读者或写者时等待
+    inline void lock()
+    {
+        if (!tryLock()) wait(true);
+    }
+    // 释放共享闩，最后一个读者负责唤醒
+    inline void unlockShared()
+    {
+        unsigned s = state_.load(std::memory_order_relaxed), n;
+        do {
+            n = s - 1;
+            if (!(n & READERS)) n = 0; // 没有持有者时一并清掉等待位
+        } while (!state_.compare_exchange_weak(
+            s, n, std::memory_order_release, std::memory_order_relaxed));
+        if (n == 0 && (s & WAITING)) wake();
+    }
+    // 释放排它闩，版本号先加1
+    inline void unlock()
+    {
+        version_.fetch_add(1, std::memory_order_release);
+        if (state_.exchange(0, std::memory_order_release) & WAITING) wake();
+    }
+
+    // 版本号加1，之前的乐观读都校验失败，如frame被淘汰另作他用
+    inline void invalidate()
+    {
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+    // 开始乐观读，有写者时返回false
+    inline bool readBegin(unsigned &version)
+    {
+        if (state_.load(std::memory_order_acquire) & WRITER) return false;
+        version = version_.load(std::memory_order_acquire);
+        return true;
+    }
+    // 结束乐观读，期间没有写者加过排它闩时返回true
+    inline bool readValidate(unsigned version)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return !(state_.load(std::memory_order_relaxed) & WRITER) &&
+               version_.load(std::memory_order_relaxed) == version;
+    }
+
+    // 是否有写者
+    inline bool locked()
+    {
+        return (state_.load(std::memory_order_relaxed) & WRITER) != 0;
+    }
+    // 读者个数
+    inline unsigned readers()
+    {
+        return state_.load(std::memory_order_relaxed) & READERS;
+    }
+
+  private:
+    // 自旋后睡眠，直到加上闩
+    void wait(bool exclusive);
+    // 唤醒在本闩上睡眠的线程
+    void wake();
+};
+
+} // namespace db
+
+#endif // __DB_LATCH_H__
@@ -21,7 +21,7 @@
 
 #include <utility>
 #include <vector>
-#include "./config.h"
+#include <db/config.h>
 #include "./integer.h"
 
 const int ALIGN_SIZE = 8; // 按8B对齐
@@ -35,6 +35,7 @@ const unsigned char RECORD_FULL_START = 0x01; // 记录开始
 const unsigned char RECORD_FULL_MID = 0x02;   // 记录中间
 const unsigned char RECORD_FULL_END = 0x03;   // 记录结束
 
+#if defined(WIN32)
 struct iovec
 {  
     // iov_base: the address of a buffer
@@ -43,6 +44,9 @@ struct iovec
     void *iov_base;
     size_t iov_len;
 };
+#else
+#    include <sys/uio.h> // posix自带iovec
+#endif
 
 namespace db {
 
@@ -88,7 +92,7 @@ class Record
     bool getByIndex(char *buffer, unsigned int *len, unsigned int index);
     // 从buffer引用各字段
     bool ref(std::vector<struct iovec> &iov, unsigned char *header);
-    // 从buffer引用某个字段
+    // 从buffer引用某个字段，只解码到该字段的偏移量，不分配内存
     bool
     refByIndex(unsigned char **buffer, unsigned int *len, unsigned int index);
     // TODO:
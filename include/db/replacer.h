@@ -0,0 +1,47 @@
+// buffer替换策略
+//
+// Buffer只负责借还和读写，淘汰哪个block由替换策略决定：
+// LRU    - 最近最少使用，一次全表扫描会冲掉热的索引块；
+// 2Q     - 首次访问进入FIFO(A1in)，淘汰后在A1out留下键，再次访问才进入LRU(Am)；
+// CLOCKPRO - 冷热两类页共用一个时钟，冷页在测试期内再访问才变热，冷区大小自适应。
+#ifndef __DB_REPLACER_H__
+#define __DB_REPLACER_H__
+
+#include <stddef.h>
+
+namespace db {
+
+struct BufDesp;
+
+// 替换策略接口，描述符的next/prev和link字段归策略使用，调用者持分区锁
+// 无锁命中不调用access，只在描述符上留下touched，由策略选淘汰对象时消费
+class Replacer
+{
+  public:
+    // 判断能否淘汰，脏块由调用者在放锁后写回
+    using Evictable = bool (*)(BufDesp *desp, void *arg);
+
+  public:
+    virtual ~Replacer() {}
+
+    // 策略名字
+    virtual const char *name() = 0;
+    // 缺页读入一个block
+    virtual void admit(BufDesp *desp) = 0;
+    // 预读读入一个block，优先级低：被访问之前先于其它block淘汰，也不算再次访问
+    virtual void admitCold(BufDesp *desp) = 0;
+    // 命中一个block
+    virtual void access(BufDesp *desp) = 0;
+    // 选出一个可淘汰的block并移出策略，没有返回NULL
+    virtual BufDesp *victim(Evictable evictable, void *arg) = 0;
+    // 移出策略，不留历史
+    virtual void remove(BufDesp *desp) = 0;
+};
+
+// 根据名字创建替换策略，frames为buffer个数，返回NULL表示不支持
+// LRU 2Q CLOCKPRO
+Replacer *createReplacer(const char *name, size_t frames);
+
+} // namespace db
+
+#endif // __DB_REPLACER_H__
@@ -5,6 +5,7 @@
 // 3. 域的个数；
 // 4. 各域的描述；（变长）
 // 5. 各种统计信息，表的大小，行数等；
+// 6. 组合键依次的域；
 // 
 // 存储元数据方式：看成一个 Record，但该 Record 是变长的（因为不同表所存元数据总长不同）
 #ifndef __DB_SCHEMA_H__
@@ -12,9 +13,11 @@
 
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 #include "./datatype.h"
 #include "./record.h"
+#include "./latch.h"
 
 namespace db {
 
@@ -35,16 +38,22 @@ struct FieldInfo
     {}
     FieldInfo(const FieldInfo &o) = default;
 };
+struct IndexCache;
+
 // 内存中描述关系
 struct RelationInfo
 {
     std::string path;              // 文件路径
     unsigned short count;          // 域的个数
     unsigned short type;           // 类型
-    unsigned int key;              // 键的域
+    unsigned int key;              // 键的域，组合键时为第一列
+    std::vector<unsigned int> keys; // 组合键依次的域，少于2个时键只有key一列
     unsigned long long size;       // 大小
     unsigned long long rows;       // 行数
     std::vector<FieldInfo> fields; // 各域的描述
+    DataType compound;             // 组合键的类型，比较编码后的键，见key.h
+    Latch latch;                   // 表闩，串行化对表的修改
+    std::shared_ptr<IndexCache> cache; // 索引上层的缓存，原子地读写
 
     RelationInfo()
         : count(0)
@@ -52,6 +61,7 @@ struct RelationInfo
         , key(0)
         , size(0)
         , rows(0)
+        , compound()
     {}
     RelationInfo(const char *p)
         : path(p)
@@ -60,9 +70,12 @@ struct RelationInfo
         , key(0)
         , size(0)
         , rows(0)
+        , compound()
     {}
-    // 根据关系属性得到iov的维度
-    int iovSize() { return 7 + count * 4; }
+    // 根据关系属性得到iov的维度，最后一个为组合键
+    int iovSize() { return 7 + count * 4 + 1; }
+    // 是否为组合键
+    inline bool composite() { return keys.size() > 1; }
 };
 
 ////
@@ -118,7 +131,12 @@ class Schema
 };
 
 // 初始化数据库全局变量，缺省buffer大小为256MB
-void dbInit(size_t bufsize = 256);
+// direct为真时表文件绕过页缓存，直接读写buffer
+// policy为buffer替换策略：LRU 2Q CLOCKPRO
+void dbInit(
+    size_t bufsize = 256,
+    bool direct = false,
+    const char *policy = "LRU");
 
 // 全局schema
 extern Schema kSchema;
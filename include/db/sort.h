@@ -0,0 +1,111 @@
+// 外排序
+//
+// 无序的记录按表的键排序，供批量装载使用。加入时键先做保序编码(见key.h)，
+// 与记录存在一起，排序和合并时比较键只需memcmp。
+// 内存向buffer借frame：记录依次紧排在frame中，满了按键排序后写成一个有序段(run)，
+// 所有run存于一个临时文件；合并时每个run占一个frame作输入缓冲，由败者树选出最小键，
+// run多于frame时先多路合并成更长的run，直到能一趟合并完。
+#ifndef __DB_SORT_H__
+#define __DB_SORT_H__
+
+#include <string>
+#include <vector>
+#include "./file.h"
+
+struct iovec;
+
+namespace db {
+
+class Table;
+struct BufDesp;
+
+class Sorter
+{
+  public:
+    static const size_t DEFAULT_FRAMES = 64; // 缺省借的frame个数
+    static const size_t MIN_FRAMES = 3;      // 至少2路合并加1个输出缓冲
+
+  private:
+    // 临时文件中的一个run，按block对齐
+    struct Run
+    {
+        unsigned long long begin; // 起始偏移
+        unsigned long long end;   // 结束偏移
+    };
+    // 合并时一个run的读位置
+    struct Cursor
+    {
+        unsigned long long offset; // 下一个要读的block
+        unsigned long long end;    // run的结束偏移
+        unsigned char *buffer;     // 输入缓冲，一个frame
+        size_t pos;                // 缓冲内的偏移
+        unsigned char *row;        // 当前记录，NULL表示读完
+    };
+
+    Table *table_;                      // 被排序的表
+    std::vector<unsigned char> key_;    // 编码键的缓冲
+    std::vector<BufDesp *> frames_;     // 向buffer借的frame
+    std::vector<unsigned char *> rows_; // 内存中的记录
+    size_t used_;                       // 正在填的frame
+    size_t offset_;                     // frame内已用空间
+    std::string path_;                  // 临时文件路径
+    File file_;                         // 临时文件
+    unsigned long long length_;         // 临时文件长度
+    std::vector<Run> runs_;             // 已写出的run
+    std::vector<Cursor> cursors_;       // 正在合并的run
+    std::vector<int> tree_;             // 败者树，tree_[0]为胜者
+    size_t index_;                      // 全在内存时的输出位置
+    bool merging_;                      // 是否在最后一趟合并中输出
+    bool pending_;                      // 上次输出的胜者尚未前进
+    int error_;                         // 合并中读临时文件的错误
+
+  public:
+    Sorter();
+    ~Sorter() { close(); }
+
+    // 开始排序，向buffer借frames个frame，借不到MIN_FRAMES个时返回ENOMEM
+    int open(Table *table, size_t frames = DEFAULT_FRAMES);
+    // 归还frame，删除临时文件
+    void close();
+    // 加入一条记录，iov按表的字段排列，键为网络字节序
+    // 返回值：EINVAL记录放不进一个frame，写临时文件出错时返回错误码
+    int add(std::vector<struct iovec> &iov);
+    // 加入完毕，有run时合并到只剩一趟
+    int finish();
+    // 按键递增取出下一条记录，iov指向内部缓冲，下次调用前有效
+    // 取完或出错返回false，出错时error()不为S_OK
+    bool next(std::vector<struct iovec> &iov);
+    // 作为Table::bulkLoad的记录来源，arg为Sorter，出错时返回error()
+    static int source(std::vector<struct iovec> &iov, void *arg);
+    // next出错的错误码，出错后不再输出
+    inline int error() { return error_; }
+
+    // 已写出的run个数
+    inline size_t runs() { return runs_.size(); }
+    // 借到的frame个数
+    inline size_t frames() { return frames_.size(); }
+
+  private:
+    // 记录x编码后的键是否小于y
+    bool less(unsigned char *x, unsigned char *y);
+    // 内存中的记录排序后写成一个run
+    int spill();
+    // 向输出缓冲追加一条记录，满了写到临时文件
+    int emit(unsigned char *row, size_t &pos);
+    // 输出缓冲写到临时文件尾，pos清零
+    int flushOut(size_t &pos);
+    // 以第first起的count个run开始合并，建败者树
+    int start(size_t first, size_t count);
+    // 读到run的下一条记录
+    int fetch(Cursor &cursor);
+    // 胜者前进到下一条记录，重新调整败者树
+    int advance();
+    // 叶子s的键变化后，沿路径到根重新比赛
+    void adjust(int s);
+    // a是否胜过b，-1为建树时的哨兵，读完的run最后
+    bool beats(int a, int b);
+};
+
+} // namespace db
+
+#endif // __DB_SORT_H__
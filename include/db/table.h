@@ -18,11 +18,17 @@ namespace db {
 class Table
 {
   public:
-    // 表的迭代器
+    // 表的迭代器，读者对当前block加共享闩，前进时先放开再借下一个
+    // 异步模式下沿next链预读：链上blockid连续时预读后面一个窗口，
+    // 追上尚未读完的预读时窗口加倍，链跳出窗口时缩回最小
     struct BlockIterator
     {
         DataBlock block;
         BufDesp *bufdesp;
+        int intent;          // 借用意图
+        unsigned int from;   // 已预读的第一个blockid
+        unsigned int to;     // 已预读的最后一个blockid
+        unsigned int window; // 预读窗口，0表示不预读
 
         BlockIterator();
         ~BlockIterator();
@@ -37,10 +43,79 @@ class Table
 
         // 释放buffer
         void release();
+        // 按当前block的next预读
+        void readahead();
     };
 
+    // 范围扫描的游标，按键递增给出[low, high]内的记录
+    // 自根下降一次到low所在的叶节点，之后沿next链前进，只对当前叶节点加共享闩；
+    // 给出的Record直接指向buffer，游标前进之前有效
+    struct ScanIterator
+    {
+        BlockIterator blocks;            // 当前叶节点
+        unsigned short index;            // 当前记录的slot
+        std::vector<unsigned char> high; // 上界
+        bool bounded;                    // 是否有上界
+        bool prefix;                     // 上界是否为前缀
+        std::vector<unsigned char> key;  // 组合键的编码
+        Record record;                   // 当前记录
+
+        ScanIterator();
+
+        // 是否已越过上界或到表尾
+        inline bool end() { return blocks.bufdesp == nullptr; }
+        // 前置操作
+        ScanIterator &operator++();
+        // 当前记录
+        inline Record *operator->() { return &record; }
+        inline Record &operator*() { return record; }
+
+        // 提前结束，释放buffer
+        void release();
+        // 从index起取第一条记录，越过上界或到表尾时结束
+        void settle();
+    };
+
+    // 修改表时持有的闩
+    // 表闩串行化同一张表的修改者，修改者之间不靠block闩互斥，下降时不加闩；
+    // 只对要改的block加排它闩，一层改完、上一层已加闩后即放开，不等到修改结束。
+    // 叶节点分裂后先放开再改父节点，经父节点旧指针来的读者沿next右移。
+    // 同一线程内嵌套时只有最外层生效，内层用mark/dropTo放开自己加的闩。
+    class WriteLatch
+    {
+      private:
+        Table *table_;                // 被修改的表，嵌套时为NULL
+        std::vector<BufDesp *> held_; // 已加排它闩的block
+
+      public:
+        WriteLatch(Table *table);
+        ~WriteLatch();
+
+        // 当前线程是否正在修改
+        static bool active();
+        // 对借到的block加排它闩，不在修改中或已持有时什么都不做
+        // 返回是否新加了闩
+        static bool hold(BufDesp *desp);
+        // 提前放开一个已加排它闩的block
+        static void drop(BufDesp *desp);
+        // 当前持有的闩个数，作为dropTo的位置
+        static size_t mark();
+        // 放开mark之后新加的闩，之前已持有的不动
+        static void dropTo(size_t mark);
+        // 读block时的借用意图，修改中已持有排它闩，不再加闩
+        static inline int readIntent()
+        {
+            return active() ? BORROW_NONE : BORROW_READ;
+        }
+    };
+
+    // 逐条取出待装载的记录，iov按表的字段排列
+    // 返回值：S_OK取到一条，ENOENT取完，其它为出错，由bulkLoad原样返回
+    using RowSource = int (*)(std::vector<struct iovec> &iov, void *arg);
+
   public:
     std::string name_;   // 表名
+    unsigned int id_;    // 文件池中的编号
     RelationInfo *info_; // 表的元数据
     unsigned int maxid_; // 最大的blockid
     unsigned int idle_;  // 空闲链
@@ -48,24 +123,46 @@ class Table
 
   public:
     Table()
-        : info_(NULL)
+        : id_(0)
+        , info_(NULL)
         , maxid_(0)
         , idle_(0)
         , first_(0)
     {}
 
     // 打开一张表
+    // 返回值：EEXIST表不存在，ENOTSUP表文件的格式版本不符
     int open(const char *name);
+    // 表文件是否只读映射，映射的表不能修改，修改接口返回EROFS
+    bool mapped();
 
-    // 采用枚举的方式定位一个key在哪个block
+    // 定位一个key在哪个block，经由索引下降
     // 返回值：blockid
     unsigned int locate(void *keybuf, unsigned int len);
-    // 定位一个block后，插入一条记录
+    // 定位一个block后，插入一条记录，放不下时经由索引分裂并上提分隔键
     int insert(unsigned int blkid, std::vector<struct iovec> &iov);
     int remove(unsigned int blkid, void *keybuf, unsigned int len);
     int update(unsigned int blkid, std::vector<struct iovec> &iov);
     // btree搜索
     unsigned int search(void *keybuf, unsigned int len);
+    // 范围扫描[low, high]，键为网络字节序
+    // low为NULL时从第1条记录开始，high为NULL时扫到表尾
+    ScanIterator scan(
+        void *low,
+        unsigned int lowLen,
+        void *high = NULL,
+        unsigned int highLen = 0);
+    // 前缀扫描，给出键以prefix开头的记录
+    // 组合键的前导列由encodePrefix编码，不必扫全表
+    // 只用于组合键和CHAR/VARCHAR键；其它定长键的prefix须是整个键，否则返回空游标
+    ScanIterator scanPrefix(void *prefix, unsigned int len);
+    // 自底向上批量装载
+    // 记录须按键严格递增，键为网络字节序；表须为空
+    // 叶节点按fill填充后沿next链接，每满一个节点向上一层追加分隔键，最后写根
+    // 返回值：EEXIST表不空，EINVAL键无序或记录放不进一个block，EROFS表只读映射，
+    // source出错时返回它的错误码，
+    // 出错前装载的记录仍然组成完整的B+树；装载期间持有超块的排它闩，读者等待
+    int bulkLoad(RowSource source, void *arg, double fill = 0.9);
 
     // 返回表上总的记录数目
     size_t recordCount();
@@ -79,6 +176,7 @@ class Table
     BlockIterator endblock();
 
     // 新分配一个block，返回blockid，但并没有将该block插入数据链上
+    // 只读映射的表返回0
     unsigned int allocate();
     // 回收一个block
     void deallocate(unsigned int blockid);
@@ -0,0 +1,355 @@
+// 实现异步块io
+#include <string.h>
+#include <db/aio.h>
+#include <db/file.h>
+#if defined(HAVE_IO_URING)
+#    include <stdint.h>
+#    include <unistd.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <linux/io_uring.h>
+#endif
+
+namespace db {
+
+int AsyncIO::init(unsigned depth, unsigned threads)
+{
+    // 已经初始化过
+    if (ring_ != -1 || !workers_.empty()) return S_OK;
+    inflight_ = 0;
+
+    // 优先io_uring
+    if (initRing(depth) == S_OK) return S_OK;
+
+    // 退化为线程池
+    if (threads == 0) threads = 1;
+    stop_ = false;
+    for (unsigned i = 0; i < threads; ++i)
+        workers_.push_back(std::thread(&AsyncIO::work, this));
+    return S_OK;
+}
+
+void AsyncIO::shutdown()
+{
+    // 停止线程池
+    if (!workers_.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i)
+            workers_[i].join();
+        workers_.clear();
+    }
+    queue_.clear();
+    finished_.clear();
+
+#if defined(HAVE_IO_URING)
+    // 释放io_uring
+    if (ring_ != -1) {
+        ::munmap(sqes_, entries_ * sizeof(struct io_uring_sqe));
+        if (cqPtr_ != sqPtr_) ::munmap(cqPtr_, cqSize_);
+        ::munmap(sqPtr_, sqSize_);
+        ::close(ring_);
+        ring_ = -1;
+    }
+#endif
+    slots_.clear();
+    free_.clear();
+    pending_ = 0;
+    inflight_ = 0;
+}
+
+int AsyncIO::submit(
+    File *file,
+    unsigned long long offset,
+    char *buffer,
+    size_t length,
+    bool write,
+    void *tag)
+{
+    // 首次使用时初始化
+    if (ring_ == -1 && workers_.empty()) {
+        int ret = init();
+        if (ret) return ret;
+    }
+
+    Request request = {file, offset, buffer, length, write, tag, S_OK};
+    if (ring_ != -1) {
+        ++inflight_;
+        // 槽位用完，先排队，等有请求完成再放入ring
+        if (free_.empty()) {
+            queue_.push_back(request);
+            return S_OK;
+        }
+        unsigned slot = free_.back();
+        free_.pop_back();
+        slots_[slot] = request;
+        return queueRing(slot);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(request);
+    ++inflight_;
+    return S_OK;
+}
+
+int AsyncIO::flush()
+{
+#if defined(HAVE_IO_URING)
+    if (ring_ != -1) {
+        while (pending_ > 0) {
+            int ret = (int) ::syscall(
+                __NR_io_uring_enter, ring_, pending_, 0, 0, NULL, 0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            if (ret == 0) break;
+            pending_ -= ret;
+        }
+        return S_OK;
+    }
+#endif
+    // 唤醒工作线程
+    ready_.notify_all();
+    return S_OK;
+}
+
+bool AsyncIO::complete(void **tag, int *result, bool wait)
+{
+#if defined(HAVE_IO_URING)
+    if (ring_ != -1) {
+        for (;;) {
+            if (reapRing(tag, result)) return true;
+            if (!wait || inflight_ == 0) return false;
+
+            // 提交剩余请求，并等待至少一个完成
+            int ret = (int) ::syscall(
+                __NR_io_uring_enter,
+                ring_,
+                pending_,
+                1,
+                IORING_ENTER_GETEVENTS,
+                NULL,
+                0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            pending_ -= ret;
+        }
+    }
+#endif
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (wait && finished_.empty() && inflight_ > 0) {
+        ready_.notify_all();
+        done_.wait(lock, [this] { return !finished_.empty(); });
+    }
+    if (finished_.empty()) return false;
+
+    Request &request = finished_.front();
+    *tag = request.tag;
+    *result = request.result;
+    finished_.pop_front();
+    --inflight_;
+    return true;
+}
+
+int AsyncIO::initRing(unsigned depth)
+{
+#if defined(HAVE_IO_URING)
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) ::syscall(__NR_io_uring_setup, depth, &params);
+    if (fd < 0) return errno;
+    // IORING_OP_READ/WRITE自5.6起支持，与IORING_FEAT_RW_CUR_POS同时引入
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        ::close(fd);
+        return EINVAL;
+    }
+
+    // 映射提交队列和完成队列，新内核两者共用一次映射
+    sqSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize_ = params.cq_off.cqes +
+              params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sqSize_ = cqSize_ = sqSize_ > cqSize_ ? sqSize_ : cqSize_;
+    sqPtr_ = ::mmap(
+        NULL,
+        sqSize_,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd,
+        IORING_OFF_SQ_RING);
+    if (sqPtr_ == MAP_FAILED) {
+        ::close(fd);
+        return errno;
+    }
+    cqPtr_ = sqPtr_;
+    if (!single) {
+        cqPtr_ = ::mmap(
+            NULL,
+            cqSize_,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            fd,
+            IORING_OFF_CQ_RING);
+        if (cqPtr_ == MAP_FAILED) {
+            ::munmap(sqPtr_, sqSize_);
+            ::close(fd);
+            return errno;
+        }
+    }
+    sqes_ = ::mmap(
+        NULL,
+        params.sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd,
+        IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        if (cqPtr_ != sqPtr_) ::munmap(cqPtr_, cqSize_);
+        ::munmap(sqPtr_, sqSize_);
+        ::close(fd);
+        return errno;
+    }
+
+    unsigned char *sq = (unsigned char *) sqPtr_;
+    unsigned char *cq = (unsigned char *) cqPtr_;
+    sqHead_ = (unsigned *) (sq + params.sq_off.head);
+    sqTail_ = (unsigned *) (sq + params.sq_off.tail);
+    sqMask_ = (unsigned *) (sq + params.sq_off.ring_mask);
+    sqArray_ = (unsigned *) (sq + params.sq_off.array);
+    cqHead_ = (unsigned *) (cq + params.cq_off.head);
+    cqTail_ = (unsigned *) (cq + params.cq_off.tail);
+    cqMask_ = (unsigned *) (cq + params.cq_off.ring_mask);
+    cqes_ = cq + params.cq_off.cqes;
+
+    // 在途请求不超过提交队列长度，完成队列(2倍长)不会溢出
+    ring_ = fd;
+    entries_ = params.sq_entries;
+    pending_ = 0;
+    slots_.resize(entries_);
+    free_.clear();
+    for (unsigned i = entries_; i > 0; --i)
+        free_.push_back(i - 1);
+    return S_OK;
+#else
+    (void) depth;
+    return ENOSYS;
+#endif
+}
+
+int AsyncIO::queueRing(unsigned slot)
+{
+#if defined(HAVE_IO_URING)
+    // 槽位数不超过队列长度，提交队列不会满
+    Request &request = slots_[slot];
+    unsigned tail = *sqTail_;
+    unsigned index = tail & *sqMask_;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *) sqes_ + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request.write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = request.file->handle_;
+    sqe->off = request.offset;
+    sqe->addr = (unsigned long long) (uintptr_t) request.buffer;
+    sqe->len = (unsigned) request.length;
+    sqe->user_data = slot;
+    sqArray_[index] = index;
+    // 先填好sqe，再推进tail
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++pending_;
+    return S_OK;
+#else
+    (void) slot;
+    return ENOSYS;
+#endif
+}
+
+bool AsyncIO::reapRing(void **tag, int *result)
+{
+#if defined(HAVE_IO_URING)
+    unsigned head = *cqHead_;
+    while (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe =
+            (struct io_uring_cqe *) cqes_ + (head & *cqMask_);
+        unsigned slot = (unsigned) cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(cqHead_, ++head, __ATOMIC_RELEASE);
+
+        Request &request = slots_[slot];
+        if (res == -EINTR || res == -EAGAIN) {
+            // 重新提交
+            queueRing(slot);
+            continue;
+        } else if (res < 0) {
+            request.result = -res;
+        } else if (res == 0) {
+            // 读到文件尾，剩余部分清零；写不进去视为出错
+            if (request.write)
+                request.result = EIO;
+            else
+                memset(request.buffer, 0, request.length);
+        } else if ((size_t) res < request.length) {
+            // 只完成一部分，继续提交剩余部分
+            request.buffer += res;
+            request.offset += res;
+            request.length -= res;
+            queueRing(slot);
+            continue;
+        }
+
+        *tag = request.tag;
+        *result = request.result;
+        free_.push_back(slot);
+        --inflight_;
+
+        // 有排队的请求，放入空出的槽位
+        if (!queue_.empty()) {
+            slot = free_.back();
+            free_.pop_back();
+            slots_[slot] = queue_.front();
+            queue_.pop_front();
+            queueRing(slot);
+        }
+        return true;
+    }
+    return false;
+#else
+    (void) tag;
+    (void) result;
+    return false;
+#endif
+}
+
+void AsyncIO::work()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        ready_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (stop_) return;
+        Request request = queue_.front();
+        queue_.pop_front();
+
+        // 同步读写，不持锁
+        lock.unlock();
+        if (request.write)
+            request.result = request.file->write(
+                request.offset, request.buffer, request.length);
+        else
+            request.result = request.file->read(
+                request.offset, request.buffer, request.length);
+        lock.lock();
+
+        finished_.push_back(request);
+        done_.notify_all();
+    }
+}
+
+// 全局异步io
+AsyncIO kAio;
+
+} // namespace db
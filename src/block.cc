@@ -1,11 +1,490 @@
 // 实现block
 #include <algorithm>
+#include <climits>
 #include <cmath>
+#include <map>
+#include <thread>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#    include <immintrin.h>
+#endif
 #include <db/block.h>
+#include <db/file.h>
+#include <db/key.h>
 #include <db/record.h>
 #include <db/table.h>
 
 namespace db {
+namespace {
+// 乐观读时的节点拷贝，每个线程一份
+thread_local unsigned char tSnapshot[BLOCK_SIZE];
+
+// 紧凑索引节点中公共前缀和定长项的可用空间
+const unsigned short INDEX_CAPACITY =
+    BLOCK_SIZE - sizeof(IndexHeader) - sizeof(Trailer);
+
+// 紧凑索引节点的freesize，按不压缩的项长计
+inline unsigned short indexFreeSize(unsigned short count, unsigned short size)
+{
+    int used = count * (size + (int) sizeof(unsigned int));
+    return (unsigned short) std::max(0, INDEX_CAPACITY - used);
+}
+
+// 两个键的公共前缀长度，至多len
+inline unsigned short
+commonPrefix(const unsigned char *x, const unsigned char *y, unsigned short len)
+{
+    unsigned short i = 0;
+    while (i < len && x[i] == y[i])
+        ++i;
+    return i;
+}
+
+// 大序的定长键转为主机字节序的整数，翻转符号位后按无符号比较即是有符号的顺序
+inline unsigned long long keyValue(const unsigned char *key, size_t len)
+{
+    unsigned long long value = 0;
+    for (size_t i = 0; i < len; ++i)
+        value = value << 8 | key[i];
+    if (len) value ^= 1ULL << (8 * len - 1);
+    return value;
+}
+
+// 按项宽写键目录的一项
+inline void
+storeValue(unsigned char *entry, unsigned short width, unsigned long long value)
+{
+    unsigned char v8 = (unsigned char) value;
+    unsigned short v16 = (unsigned short) value;
+    unsigned int v32 = (unsigned int) value;
+    switch (width) {
+    case 1:
+        memcpy(entry, &v8, width);
+        break;
+    case 2:
+        memcpy(entry, &v16, width);
+        break;
+    case 4:
+        memcpy(entry, &v32, width);
+        break;
+    default:
+        memcpy(entry, &value, width);
+        break;
+    }
+}
+
+// 键目录的向量比较，按项宽特化；无符号比较先翻转符号位再做有符号比较
+#if defined(__AVX2__)
+using Vector = __m256i;
+inline Vector loadVector(const unsigned char *p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const Vector *>(p));
+}
+inline Vector flipVector(Vector x, Vector y) { return _mm256_xor_si256(x, y); }
+inline unsigned int maskOf(Vector x) { return _mm256_movemask_epi8(x); }
+template <typename T>
+Vector splat(T x);
+template <typename T>
+Vector greater(Vector x, Vector y);
+template <>
+inline Vector splat(unsigned char x)
+{
+    return _mm256_set1_epi8((char) x);
+}
+template <>
+inline Vector splat(unsigned short x)
+{
+    return _mm256_set1_epi16((short) x);
+}
+template <>
+inline Vector splat(unsigned int x)
+{
+    return _mm256_set1_epi32((int) x);
+}
+template <>
+inline Vector splat(unsigned long long x)
+{
+    return _mm256_set1_epi64x((long long) x);
+}
+template <>
+inline Vector greater<unsigned char>(Vector x, Vector y)
+{
+    return _mm256_cmpgt_epi8(x, y);
+}
+template <>
+inline Vector greater<unsigned short>(Vector x, Vector y)
+{
+    return _mm256_cmpgt_epi16(x, y);
+}
+template <>
+inline Vector greater<unsigned int>(Vector x, Vector y)
+{
+    return _mm256_cmpgt_epi32(x, y);
+}
+template <>
+inline Vector greater<unsigned long long>(Vector x, Vector y)
+{
+    return _mm256_cmpgt_epi64(x, y);
+}
+#elif defined(__SSE4_2__)
+using Vector = __m128i;
+inline Vector loadVector(const unsigned char *p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const Vector *>(p));
+}
+inline Vector flipVector(Vector x, Vector y) { return _mm_xor_si128(x, y); }
+inline unsigned int maskOf(Vector x) { return _mm_movemask_epi8(x); }
+template <typename T>
+Vector splat(T x);
+template <typename T>
+Vector greater(Vector x, Vector y);
+template <>
+inline Vector splat(unsigned char x)
+{
+    return _mm_set1_epi8((char) x);
+}
+template <>
+inline Vector splat(unsigned short x)
+{
+    return _mm_set1_epi16((short) x);
+}
+template <>
+inline Vector splat(unsigned int x)
+{
+    return _mm_set1_epi32((int) x);
+}
+template <>
+inline Vector splat(unsigned long long x)
+{
+    return _mm_set1_epi64x((long long) x);
+}
+template <>
+inline Vector greater<unsigned char>(Vector x, Vector y)
+{
+    return _mm_cmpgt_epi8(x, y);
+}
+template <>
+inline Vector greater<unsigned short>(Vector x, Vector y)
+{
+    return _mm_cmpgt_epi16(x, y);
+}
+template <>
+inline Vector greater<unsigned int>(Vector x, Vector y)
+{
+    return _mm_cmpgt_epi32(x, y);
+}
+template <>
+inline Vector greater<unsigned long long>(Vector x, Vector y)
+{
+    return _mm_cmpgt_epi64(x, y);
+}
+#endif
+
+// 键目录中一个窗口的字节数，二分缩到窗口内后顺序比较
+const unsigned short DIRECTORY_WINDOW = 64;
+
+// 有序的n项中小于key的个数
+template <typename T>
+unsigned short countLess(const unsigned char *entry, unsigned short n, T key)
+{
+    unsigned short i = 0;
+    unsigned short less = 0;
+#if defined(__AVX2__) || defined(__SSE4_2__)
+    const unsigned short lanes = sizeof(Vector) / sizeof(T);
+    Vector bias = splat<T>((T) ((T) 1 << (sizeof(T) * 8 - 1)));
+    Vector target = flipVector(splat<T>(key), bias);
+    for (; i + lanes <= n; i += lanes) {
+        Vector v = flipVector(loadVector(entry + i * sizeof(T)), bias);
+        less += __builtin_popcount(maskOf(greater<T>(target, v))) / sizeof(T);
+    }
+#endif
+    for (; i < n; ++i) {
+        T v;
+        memcpy(&v, entry + i * sizeof(T), sizeof(T));
+        if (!(v < key)) break;
+        ++less;
+    }
+    return less;
+}
+
+// 键目录上的lowerbound
+template <typename T>
+unsigned short
+directoryBound(const unsigned char *directory, unsigned short count, T key)
+{
+    unsigned short low = 0;
+    unsigned short n = count;
+    while (n > DIRECTORY_WINDOW / sizeof(T)) {
+        unsigned short half = n / 2;
+        T v;
+        memcpy(&v, directory + (low + half) * sizeof(T), sizeof(T));
+        if (v < key) {
+            low += half + 1;
+            n -= half + 1;
+        } else
+            n = half;
+    }
+    return low + countLess<T>(directory + low * sizeof(T), n, key);
+}
+
+// 把block的前size个字节拷贝到tSnapshot，返回拷贝时的版本
+// optimistic为真时，拷贝前后版本一致才算读到，有写者时让出cpu重读
+unsigned int snapshot(BufDesp *bd, size_t size, bool optimistic)
+{
+    for (;;) {
+        unsigned int version = 0;
+        if (!optimistic || bd->latch.readBegin(version)) {
+            memcpy(tSnapshot, bd->buffer, size);
+            if (!optimistic || bd->latch.readValidate(version)) return version;
+        }
+        std::this_thread::yield();
+    }
+}
+
+// 根节点的blockid，新建的表还没有索引，根就是第1个数据块
+inline unsigned int rootOf(SuperBlock &super)
+{
+    unsigned int root = super.getRoot();
+    return root ? root : super.getFirst();
+}
+
+// 准备与like结构相同的记录缓冲，各域取类型的最大长度
+void recordBuffer(
+    RelationInfo *info,
+    std::vector<struct iovec> &like,
+    std::vector<std::vector<char>> &fields,
+    std::vector<struct iovec> &iov)
+{
+    fields.resize(like.size());
+    iov.resize(like.size());
+    for (size_t i = 0; i < like.size(); ++i) {
+        size_t size = i < info->fields.size()
+                          ? getKeyBytes(info->fields[i].type)
+                          : like[i].iov_len;
+        fields[i].resize(std::max(size, like[i].iov_len));
+        iov[i].iov_base = &fields[i][0];
+        iov[i].iov_len = fields[i].size();
+    }
+}
+
+// 缓冲各域的容量，取出变长的记录后iov_len会缩短，再取下一条前须复原
+inline std::vector<size_t> capacityOf(std::vector<struct iovec> &iov)
+{
+    std::vector<size_t> capacity(iov.size());
+    for (size_t i = 0; i < iov.size(); ++i)
+        capacity[i] = iov[i].iov_len;
+    return capacity;
+}
+inline void
+restore(std::vector<struct iovec> &iov, const std::vector<size_t> &capacity)
+{
+    for (size_t i = 0; i < iov.size(); ++i)
+        iov[i].iov_len = capacity[i];
+}
+
+// 两个键是否相等，变长键和截短的分隔键先比长度
+inline bool sameKey(const void *x, size_t xlen, const void *y, size_t ylen)
+{
+    return xlen == ylen && memcmp(x, y, xlen) == 0;
+}
+
+// 在索引节点中为键选择子节点
+// 等于分隔键时走其右侧指针，否则走左侧，小于所有分隔键时走最左指针
+unsigned int childOf(DataBlock &node, void *keybuf, unsigned int len)
+{
+    // blockid 的数据类型是固定的
+    DataType *intType = findDataType("INT");
+    DataType *keyType = db::keyType(node.table_->info_);
+    size_t keySize = getKeyBytes(keyType);
+    std::vector<char> tmpKey(keySize);
+    unsigned int tmpVal;
+    std::vector<struct iovec> tmp = {
+        {&tmpKey[0], keySize}, {&tmpVal, sizeof(unsigned int)}};
+
+    unsigned short ret = node.searchRecord(keybuf, len);
+    if (ret < node.getSlots()) {
+        node.fetchRecord(ret, tmp);
+        if (!sameKey(keybuf, len, tmp[0].iov_base, tmp[0].iov_len)) {
+            if (ret == 0) return node.getNext(); // 最左侧指针
+            node.fetchRecord(ret - 1, tmp);
+        }
+    } else
+        node.fetchRecord(node.getSlots() - 1, tmp);
+    intType->betoh(tmp[1].iov_base);
+    return tmpVal;
+}
+
+// 叶节点分裂后的分隔键放入key：left最大键与right最小键之间最短的键
+void separatorOf(DataBlock &left, DataBlock &right, struct iovec &key)
+{
+    DataType *keyType = db::keyType(left.table_->info_);
+    std::vector<unsigned char> last(getKeyBytes(keyType));
+    struct iovec lastIov = {&last[0], last.size()};
+    left.fetchKey(left.getSlots() - 1, lastIov);
+    right.fetchKey(0, key);
+    key.iov_len = keyType->shorten(
+        &last[0],
+        (unsigned int) lastIov.iov_len,
+        (unsigned char *) key.iov_base,
+        (unsigned int) key.iov_len);
+}
+
+// tSnapshot中的节点解码成IndexNode
+std::shared_ptr<IndexNode> decode(
+    Table *table,
+    BufDesp *desp,
+    unsigned int version,
+    unsigned int blockid)
+{
+    DataBlock data;
+    data.setTable(table);
+    data.attach(tSnapshot);
+    std::shared_ptr<IndexNode> node = std::make_shared<IndexNode>();
+    node->desp = desp;
+    node->version = version;
+    node->blockid = blockid;
+    node->leaf = data.getType() == BLOCK_TYPE_DATA;
+    if (node->leaf) return node;
+
+    DataType *intType = findDataType("INT");
+    DataType *keyType = db::keyType(table->info_);
+    std::vector<unsigned char> key(getKeyBytes(keyType));
+    unsigned int child;
+    std::vector<struct iovec> iov = {
+        {&key[0], key.size()}, {&child, sizeof(unsigned int)}};
+    unsigned short slots = data.getSlots();
+    node->first = data.getNext();
+    node->offsets.reserve(slots + 1);
+    node->children.reserve(slots);
+    node->offsets.push_back(0);
+    for (unsigned short i = 0; i < slots; ++i) {
+        iov[0].iov_len = key.size();
+        data.fetchRecord(i, iov);
+        node->keys.insert(node->keys.end(), &key[0], &key[0] + iov[0].iov_len);
+        node->offsets.push_back((unsigned int) node->keys.size());
+        intType->betoh(&child);
+        node->children.push_back(child);
+    }
+    return node;
+}
+
+// 乐观地读入并解码一个节点，parent在pversion时指向它
+// parent已经变了时返回空
+std::shared_ptr<IndexNode> load(
+    Table *table,
+    unsigned int blockid,
+    BufDesp *parent,
+    unsigned int pversion)
+{
+    BufDesp *bd = kBuffer.borrow(table->id_, blockid);
+    unsigned int version = snapshot(bd, BLOCK_SIZE, true);
+    std::shared_ptr<IndexNode> node;
+    if (parent->latch.readValidate(pversion))
+        node = decode(table, bd, version, blockid);
+    kBuffer.releaseBuf(bd);
+    return node;
+}
+
+// 表的上层索引缓存，根作废时重建，超块正在变化时返回空
+std::shared_ptr<IndexCache> cacheOf(Table *table)
+{
+    RelationInfo *info = table->info_;
+    std::shared_ptr<IndexCache> cache = std::atomic_load(&info->cache);
+    if (cache && cache->root->valid()) return cache;
+
+    SuperBlock super;
+    BufDesp *sd = kBuffer.borrow(table->id_, 0);
+    unsigned int sversion = snapshot(sd, sizeof(SuperHeader), true);
+    super.attach(tSnapshot);
+    std::shared_ptr<IndexNode> root = load(table, rootOf(super), sd, sversion);
+    kBuffer.releaseBuf(sd);
+    if (!root) return NULL;
+
+    // 根的内容变了不等于下一层都变了，仍有效的子节点按blockid留用
+    std::shared_ptr<IndexCache> fresh = std::make_shared<IndexCache>();
+    fresh->root = root;
+    if (!root->leaf) {
+        fresh->below.resize(root->children.size() + 1);
+        std::map<unsigned int, std::shared_ptr<IndexNode>> kept;
+        for (size_t i = 0; cache && i < cache->below.size(); ++i) {
+            std::shared_ptr<IndexNode> node = std::atomic_load(&cache->below[i]);
+            if (node && node->valid()) kept[node->blockid] = node;
+        }
+        for (size_t pos = 0; !kept.empty() && pos < fresh->below.size(); ++pos) {
+            auto it = kept.find(root->child(pos));
+            if (it != kept.end()) fresh->below[pos] = it->second;
+        }
+    }
+    std::atomic_store(&info->cache, fresh);
+    return fresh;
+}
+
+// 下降的起点，乐观读时先走完缓存的上层索引
+// 返回第一个要从buffer读的节点，parent为指向它的节点，已加引用，pversion供校验
+// 不能用缓存时从超块开始
+unsigned int startOf(
+    Table *table,
+    void *keybuf,
+    unsigned int len,
+    bool optimistic,
+    BufDesp *&parent,
+    unsigned int &pversion)
+{
+    std::shared_ptr<IndexCache> cache;
+    if (optimistic) cache = cacheOf(table);
+    if (cache) {
+        DataType *type = keyType(table->info_);
+        IndexNode *node = cache->root.get();
+        unsigned int blockid = node->blockid; // 根为叶节点时直接读根
+        std::shared_ptr<IndexNode> below;
+        if (!node->leaf) {
+            size_t pos = node->route(type, keybuf, len);
+            below = std::atomic_load(&cache->below[pos]);
+            // 子节点是叶节点时不会就地变成内节点，不必校验
+            if (!below || (!below->leaf && !below->valid())) {
+                below = load(table, node->child(pos), node->desp, node->version);
+                if (below) std::atomic_store(&cache->below[pos], below);
+            }
+            if (below && !below->leaf) {
+                node = below.get();
+                pos = node->route(type, keybuf, len);
+            }
+            blockid = node->child(pos);
+        }
+        // 先加引用再校验，frame在此之前被淘汰时版本已变
+        parent = node->desp;
+        parent->addref();
+        pversion = node->version;
+        if (node->valid()) return blockid;
+        parent->relref();
+    }
+
+    SuperBlock super;
+    parent = kBuffer.borrow(table->id_, 0);
+    pversion = snapshot(parent, sizeof(SuperHeader), optimistic);
+    super.attach(tSnapshot);
+    return rootOf(super);
+}
+} // namespace
+
+bool IndexNode::valid() { return desp->latch.readValidate(version); }
+
+size_t IndexNode::route(DataType *type, void *keybuf, unsigned int len)
+{
+    // 第一个大于键的分隔键
+    size_t low = 0, high = children.size();
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (type->less(
+                (unsigned char *) keybuf,
+                len,
+                &keys[offsets[mid]],
+                offsets[mid + 1] - offsets[mid]))
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
 
 DataBlock::RecordIterator::RecordIterator()
     : block(nullptr)
@@ -21,7 +500,7 @@ DataBlock::RecordIterator::RecordIterator(const RecordIterator &other)
 DataBlock::RecordIterator &DataBlock::RecordIterator::operator++()
 {
     if (block == nullptr || block->getSlots() == 0) return *this;
-    index = (++index) % (block->getSlots() + 1);
+    index = (index + 1) % (block->getSlots() + 1);
     if (index == block->getSlots()) {
         record.detach();
         return *this;
@@ -36,7 +515,7 @@ DataBlock::RecordIterator DataBlock::RecordIterator::operator++(int)
 {
     RecordIterator tmp(*this);
     if (block == nullptr || block->getSlots() == 0) return tmp;
-    index = (++index) % (block->getSlots() + 1);
+    index = (index + 1) % (block->getSlots() + 1);
     if (index == block->getSlots()) {
         record.detach();
         return tmp;
@@ -124,6 +603,8 @@ void SuperBlock::clear(unsigned short spaceid)
     setFirst(0);
     // 设定maxid
     setMaxid(0);
+    // 设定格式版本
+    setVersion(FORMAT_VERSION);
     // 设定self
     setSelf();
     // 设定空闲块，缺省从1开始
@@ -172,43 +653,42 @@ void MetaBlock::clear(
 }
 
 // TODO: 如果record非full，直接分配，不考虑slot
-std::pair<unsigned char *, bool>
-MetaBlock::allocate(unsigned short space, unsigned short index)
+unsigned char *MetaBlock::allocate(unsigned short space, unsigned short index)
 {
-    bool need_reorder = false;
-    MetaHeader *header = reinterpret_cast<MetaHeader *>(buffer_);
     space = ALIGN_TO_SIZE(space); // 先将需要空间数对齐8B
 
     // 计算需要分配的空间，需要考虑到分配Slot的问题
     unsigned short demand_space = space;
     unsigned short freesize = getFreeSize(); // block当前的剩余空间
-    unsigned short current_trailersize = getTrailerSize();
-    unsigned short demand_trailersize =
-        (getSlots() + 1) * sizeof(Slot) + sizeof(int);
-    if (current_trailersize < demand_trailersize)
-        demand_space += ALIGN_TO_SIZE(sizeof(Slot)); // 需要的空间数目
+    unsigned short growth = getTrailerGrowth(); // slot和键目录项的空间
+    demand_space += growth;                     // 需要的空间数目
 
     // 该block空间不够
     if (freesize < demand_space)
-        return std::pair<unsigned char *, bool>(nullptr, false);
+        return nullptr;
 
     // 如果freespace空间不够，先回收删除的记录
-    unsigned short freespacesize = getFreespaceSize();
-    // freespace的空间要减去要分配的slot的空间
-    if (current_trailersize < demand_trailersize)
-        freespacesize -= ALIGN_TO_SIZE(sizeof(Slot));
-    // NOTE: 这里这里没法reorder，才分配还未填充记录
-    if (freespacesize < demand_space) {
-        shrink();
-        need_reorder = true;
-    }
+    // shrink不改变slots[]的顺序，新记录的槽位仍可直接插在index处
+    if (getFreespaceSize() < demand_space) shrink();
 
     // 从freespace分配空间
     unsigned char *ret = buffer_ + getFreeSpace();
 
-    // 增加slots计数
+    // 键目录与slots[]一起下移，index处空出一项由调用者填写
     unsigned short old = getSlots();
     unsigned short total = std::min<unsigned short>(old, index);
+    unsigned short width = getDirectoryWidth();
+    if (width) {
+        unsigned char *directory = getDirectoryPointer();
+        memmove(
+            directory - sizeof(Slot) - width, directory, total * width);
+        memmove(
+            directory + total * width - sizeof(Slot),
+            directory + total * width,
+            (old - total) * width);
+    }
+
+    // 增加slots计数
     setSlots(old + 1);
     // 在slots[]顶部增加一个条目
     Slot *new_position = getSlotsPointer();
@@ -223,13 +703,12 @@ MetaBlock::allocate(unsigned short space, unsigned short index)
     // 设定freespace偏移量
     setFreeSpace(getFreeSpace() + space);
 
-    return std::pair<unsigned char *, bool>(ret, need_reorder);
+    return ret;
 }
 
 // TODO: 需要考虑record非full的情况
 void MetaBlock::deallocate(unsigned short index)
 {
-    MetaHeader *header = reinterpret_cast<MetaHeader *>(buffer_);
 
     // 计算需要删除的记录的槽位
     Slot *pslot = reinterpret_cast<Slot *>(
@@ -253,6 +732,17 @@ void MetaBlock::deallocate(unsigned short index)
         pslot->length = from->length;
         pslot = from;
     }
+    // 键目录随slots[]上移，去掉index处的一项
+    unsigned short width = getDirectoryWidth();
+    if (width) {
+        unsigned char *directory = getDirectoryPointer();
+        unsigned short count = getSlots();
+        memmove(
+            directory + (index + 1) * width + sizeof(Slot),
+            directory + (index + 1) * width,
+            (count - index - 1) * width);
+        memmove(directory + width + sizeof(Slot), directory, index * width);
+    }
 
     // 回收slots[]空间
     unsigned short previous_trailersize = getTrailerSize();
@@ -267,28 +757,26 @@ void MetaBlock::deallocate(unsigned short index)
 
 void MetaBlock::shrink()
 {
-    MetaHeader *header = reinterpret_cast<MetaHeader *>(buffer_);
     Slot *slots = getSlotsPointer();
 
-    // 按照偏移量重新排序slots[]函数
-    struct OffsetSort
-    {
-        bool operator()(const Slot &x, const Slot &y)
-        {
-            return be16toh(x.offset) < be16toh(y.offset);
-        }
-    };
-    OffsetSort osort;
-    std::sort(slots, slots + getSlots(), osort);
+    // 按偏移量排的是槽位下标，slots[]本身保持按键有序，不必再reorder
+    std::vector<unsigned short> order(getSlots());
+    for (unsigned short i = 0; i < getSlots(); ++i)
+        order[i] = i;
+    std::sort(
+        order.begin(), order.end(), [slots](unsigned short x, unsigned short y) {
+            return be16toh(slots[x].offset) < be16toh(slots[y].offset);
+        });
 
-    // 枚举所有record，然后向前移动
+    // 按偏移量递增枚举所有record，然后向前移动
     unsigned short offset = sizeof(MetaHeader);
     unsigned short space = 0;
     for (unsigned short i = 0; i < getSlots(); ++i) {
-        unsigned short len = be16toh((slots + i)->length);
-        unsigned short off = be16toh((slots + i)->offset);
+        Slot *slot = slots + order[i];
+        unsigned short len = be16toh(slot->length);
+        unsigned short off = be16toh(slot->offset);
         if (offset < off) memmove(buffer_ + offset, buffer_ + off, len);
-        (slots + i)->offset = htobe16(offset);
+        slot->offset = htobe16(offset);
         offset += len;
         space += len;
     }
@@ -299,12 +787,21 @@ void MetaBlock::shrink()
     setFreeSize(BLOCK_SIZE - sizeof(MetaHeader) - getTrailerSize() - space);
 }
 
+void MetaBlock::setDirectory(unsigned short index, unsigned int key)
+{
+    Record record;
+    refslots(index, record);
+    unsigned char *pkey;
+    unsigned int len;
+    record.refByIndex(&pkey, &len, key);
+    unsigned short width = getDirectoryWidth();
+    storeValue(
+        getDirectoryPointer() + index * width, width, keyValue(pkey, len));
+}
+
 std::pair<unsigned short, bool>
 DataBlock::splitPosition(size_t space, unsigned short index)
 {
-    DataHeader *header = reinterpret_cast<DataHeader *>(buffer_);
-    RelationInfo *info = table_->info_;
-    unsigned int key = info->key;
     static const unsigned short BlockHalf =
         (BLOCK_SIZE - sizeof(DataHeader) - 8) / 2; // 一半的大小
 
@@ -335,48 +832,137 @@ DataBlock::splitPosition(size_t space, unsigned short index)
 unsigned short DataBlock::requireLength(std::vector<struct iovec> &iov)
 {
     size_t length = ALIGN_TO_SIZE(Record::size(iov)); // 对齐8B后的长度
-    size_t trailer =
-        ALIGN_TO_SIZE((getSlots() + 1) * sizeof(Slot) + sizeof(unsigned int)) -
-        ALIGN_TO_SIZE(
-            getSlots() * sizeof(Slot) +
-            sizeof(unsigned int)); // trailer新增部分
+    size_t trailer = getTrailerGrowth();               // trailer新增部分
     return (unsigned short) (length + trailer);
 }
 
+unsigned short directoryWidth(RelationInfo *info)
+{
+    DataType *type = keyType(info);
+    if (type->size > 0 && type->size <= INDEX_KEY_MAX)
+        return (unsigned short) type->size;
+    return 0;
+}
+
+void DataBlock::setTable(Table *table) { table_ = table; }
+
+unsigned short DataBlock::directorySearch(void *key, size_t len)
+{
+    unsigned char *directory = getDirectoryPointer();
+    unsigned short count = getSlots();
+    unsigned long long value = keyValue((unsigned char *) key, len);
+    switch (len) {
+    case 1:
+        return directoryBound<unsigned char>(
+            directory, count, (unsigned char) value);
+    case 2:
+        return directoryBound<unsigned short>(
+            directory, count, (unsigned short) value);
+    case 4:
+        return directoryBound<unsigned int>(
+            directory, count, (unsigned int) value);
+    default:
+        return directoryBound<unsigned long long>(directory, count, value);
+    }
+}
+
 unsigned short DataBlock::searchRecord(void *buf, size_t len)
 {
-    DataHeader *header = reinterpret_cast<DataHeader *>(buffer_);
+    if (isCompact()) return indexSearch(buf, len);
+    if (getDirectoryWidth() && len == getDirectoryWidth())
+        return directorySearch(buf, len);
 
-    // 获取key位置
+    // 内节点的键在第0个域，组合键的叶节点现编码
     RelationInfo *info = table_->info_;
-    unsigned int key = info->key;
+    if (getType() != BLOCK_TYPE_DATA)
+        return keyType(info)->search(buffer_, 0, buf, len);
+    if (info->composite()) return keySearch(buf, len);
 
     // 调用数据类型的搜索
-    return info->fields[key].type->search(buffer_, key, buf, len);
+    return info->fields[info->key].type->search(buffer_, info->key, buf, len);
+}
+
+unsigned short DataBlock::keySearch(void *buf, size_t len)
+{
+    RelationInfo *info = table_->info_;
+    std::vector<unsigned char> key;
+    unsigned short low = 0, high = getSlots();
+    while (low < high) {
+        unsigned short mid = (low + high) / 2;
+        Record record;
+        refslots(mid, record);
+        unsigned char *pkey;
+        unsigned int klen;
+        refKey(info, record, key, &pkey, &klen);
+        if (compareKey(pkey, klen, buf, len) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+void DataBlock::reorder()
+{
+    RelationInfo *info = table_->info_;
+    if (!info->composite()) {
+        MetaBlock::reorder(info->fields[info->key].type, info->key);
+        return;
+    }
+
+    // 每条记录的键只编码一次
+    unsigned short count = getSlots();
+    Slot *slots = getSlotsPointer();
+    std::vector<std::pair<std::vector<unsigned char>, Slot>> keys(count);
+    for (unsigned short i = 0; i < count; ++i) {
+        Record record;
+        refslots(i, record);
+        unsigned char *pkey;
+        unsigned int klen;
+        refKey(info, record, keys[i].first, &pkey, &klen);
+        keys[i].second = slots[i];
+    }
+    std::stable_sort(
+        keys.begin(),
+        keys.end(),
+        [](const std::pair<std::vector<unsigned char>, Slot> &x,
+           const std::pair<std::vector<unsigned char>, Slot> &y) {
+            return compareKey(
+                       x.first.data(),
+                       x.first.size(),
+                       y.first.data(),
+                       y.first.size()) < 0;
+        });
+    for (unsigned short i = 0; i < count; ++i)
+        slots[i] = keys[i].second;
 }
 
 std::pair<bool, unsigned short>
 DataBlock::insertRecord(std::vector<struct iovec> &iov)
 {
+    if (isCompact()) return indexInsert(iov, INDEX_CAPACITY);
+
+    // 内节点的键在第0个域
     RelationInfo *info = table_->info_;
     unsigned int key = info->key;
-    DataType *type = info->fields[key].type;
+    std::vector<unsigned char> keybuf, slotbuf;
+    struct iovec target =
+        getType() == BLOCK_TYPE_DATA ? keyOf(info, iov, keybuf) : iov[0];
 
     // 先确定插入位置
-    unsigned short index =
-        type->search(buffer_, key, iov[key].iov_base, iov[key].iov_len);
+    unsigned short index = searchRecord(target.iov_base, target.iov_len);
 
     // 比较key
     Record record;
     if (index < getSlots()) {
-        Slot *slots = getSlotsPointer();
-        record.attach(
-            buffer_ + be16toh(slots[index].offset),
-            be16toh(slots[index].length));
+        refslots(index, record);
         unsigned char *pkey;
         unsigned int len;
-        record.refByIndex(&pkey, &len, key);
-        if (memcmp(pkey, iov[key].iov_base, len) == 0) // key相等不能插入
+        if (getType() == BLOCK_TYPE_DATA)
+            refKey(info, record, slotbuf, &pkey, &len);
+        else
+            record.refByIndex(&pkey, &len, 0);
+        if (sameKey(pkey, len, target.iov_base, target.iov_len)) // key相等不能插入
             return std::pair<bool, unsigned short>(false, -1);
     }
 
@@ -384,23 +970,54 @@ DataBlock::insertRecord(std::vector<struct iovec> &iov)
     if (getFreeSize() < requireLength(iov))
         return std::pair<bool, unsigned short>(false, index);
 
-    // 分配空间
+    // 槽位直接插在lowerbound处，slots[]保持有序
     unsigned short actlen = (unsigned short) Record::size(iov);
-    std::pair<unsigned char *, bool> alloc_ret = allocate(actlen, index);
+    unsigned char *alloc_ret = allocate(actlen, index);
     // 填写记录
-    record.attach(alloc_ret.first, actlen);
+    record.attach(alloc_ret, actlen);
     unsigned char header = 0;
     record.set(iov, &header);
-    // 重新排序
-    if (alloc_ret.second) reorder(type, key);
+    if (getDirectoryWidth()) setDirectory(index, key);
 
     return std::pair<bool, unsigned short>(true, index);
 }
 
+bool DataBlock::appendRecord(
+    std::vector<struct iovec> &iov,
+    unsigned short limit)
+{
+    // 空block的可用空间
+    static const unsigned short Capacity =
+        BLOCK_SIZE - sizeof(DataHeader) - sizeof(Trailer);
+
+    if (isCompact())
+        return indexInsert(
+                   iov,
+                   getSlots() ? std::min(limit, INDEX_CAPACITY)
+                              : INDEX_CAPACITY)
+            .first;
+
+    unsigned short length = requireLength(iov);
+    if (getFreeSize() < length) return false;
+    if (getSlots() && Capacity - getFreeSize() + length > limit) return false;
+
+    // 分配在尾部，记录按键递增写入
+    unsigned short actlen = (unsigned short) Record::size(iov);
+    unsigned char *alloc_ret = allocate(actlen, getSlots());
+    Record record;
+    record.attach(alloc_ret, actlen);
+    unsigned char header = 0;
+    record.set(iov, &header);
+    if (getDirectoryWidth()) setDirectory(getSlots() - 1, table_->info_->key);
+    return true;
+}
+
 std::pair<unsigned int, bool> DataBlock::split(
     unsigned short insertPos,
     std::vector<struct iovec> &iov)
 {
+    if (isCompact()) return indexSplit(insertPos);
+
     // 分裂 block
     std::pair<unsigned short, bool> splitPos =
         splitPosition(Record::size(iov), insertPos);
@@ -409,8 +1026,10 @@ std::pair<unsigned int, bool> DataBlock::split(
     DataBlock next;
     next.setTable(table_);
     unsigned int blkid = table_->allocate();
-    BufDesp *bd = kBuffer.borrow(table_->name_.c_str(), blkid);
+    BufDesp *bd = kBuffer.borrow(table_->id_, blkid);
+    Table::WriteLatch::hold(bd);
     next.attach(bd->buffer);
+    next.setType(getType() | getFlags()); // 新节点沿用本节点的格式
 
     // 移动记录到新的 block 上
     while (getSlots() > splitPos.first) {
@@ -419,6 +1038,7 @@ std::pair<unsigned int, bool> DataBlock::split(
         next.copyRecord(record);
         deallocate(splitPos.first);
     }
+    kBuffer.writeBuf(bd);
     kBuffer.releaseBuf(bd);
 
     // 返回应插在旧还是新 block
@@ -438,7 +1058,8 @@ bool DataBlock::updateRecord(std::vector<struct iovec>& iov)
     if (!pret.first && pret.second != (unsigned short) -1) { // Block 空间不足       
         std::pair<unsigned int, bool> splitRet = split(pret.second, iov);
         DataBlock next;
-        BufDesp *bd = kBuffer.borrow(table_->name_.c_str(), splitRet.first);
+        BufDesp *bd = kBuffer.borrow(table_->id_, splitRet.first);
+        Table::WriteLatch::hold(bd);
         next.attach(bd->buffer);
         next.setTable(table_);
 
@@ -448,13 +1069,16 @@ bool DataBlock::updateRecord(std::vector<struct iovec>& iov)
         // 维护数据链
         next.setNext(getNext());
         setNext(next.getSelf());
+        kBuffer.writeBuf(bd);
         bd->relref();
 
         // 维护超块头部中的记录数目
         SuperBlock super;
-        bd = kBuffer.borrow(table_->name_.c_str(), 0);
+        bd = kBuffer.borrow(table_->id_, 0);
+        Table::WriteLatch::hold(bd);
         super.attach(bd->buffer);
         super.setRecords(super.getRecords() + 1);
+        kBuffer.writeBuf(bd);
         bd->relref();
     }
     return true;
@@ -462,27 +1086,27 @@ bool DataBlock::updateRecord(std::vector<struct iovec>& iov)
 
 bool DataBlock::removeRecord(std::vector<struct iovec>& iov) 
 { 
+    if (isCompact()) return indexRemove(iov);
+
     RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
-    DataType *keyType = info->fields[keyIdx].type;
+    std::vector<unsigned char> keybuf, slotbuf;
+    struct iovec target =
+        getType() == BLOCK_TYPE_DATA ? keyOf(info, iov, keybuf) : iov[0];
 
     // 确定该记录对应的 slot 下标
-    unsigned short index =
-        keyType->search(buffer_, keyIdx, iov[keyIdx].iov_base, iov[keyIdx].iov_len);
+    unsigned short index = searchRecord(target.iov_base, target.iov_len);
     if (index >= getSlots()) return false; // 记录不存在
 
     // 当 index 处于范围中时仍可能记录不存在
-    Slot *slots = getSlotsPointer();
     Record record;
-    record.attach(
-        buffer_ + be16toh(slots[index].offset), be16toh(slots[index].length));
-
-    size_t keySize = getKeyBytes(keyType);
-    std::vector<char> tmpKey(keySize);
-    unsigned int tmpKeyLen = (unsigned int) iov[keyIdx].iov_len;
-    
-    record.getByIndex((char *) &tmpKey[0], &tmpKeyLen, keyIdx);
-    if (memcmp(&tmpKey[0], iov[keyIdx].iov_base, iov[keyIdx].iov_len) != 0) return false;
+    refslots(index, record);
+    unsigned char *pkey;
+    unsigned int len;
+    if (getType() == BLOCK_TYPE_DATA)
+        refKey(info, record, slotbuf, &pkey, &len);
+    else
+        record.refByIndex(&pkey, &len, 0);
+    if (!sameKey(pkey, len, target.iov_base, target.iov_len)) return false;
 
     // 设置记录的 tombstone，挤压 slots
     // 修改 slots 数目，freesize 加回删除的 slot
@@ -491,110 +1115,556 @@ bool DataBlock::removeRecord(std::vector<struct iovec>& iov)
     return true; 
 }
 
+void DataBlock::setIndexType()
+{
+    DataType *type = keyType(table_->info_);
+    if (type->size > 0 && type->size <= INDEX_KEY_MAX)
+        setType(BLOCK_TYPE_INDEX | BLOCK_FLAG_COMPACT);
+    else
+        setType(BLOCK_TYPE_INDEX);
+}
+
+void DataBlock::setDataType()
+{
+    setType(
+        BLOCK_TYPE_DATA |
+        directoryWidth(table_->info_) << BLOCK_DIRECTORY_SHIFT);
+}
+
+void DataBlock::fetchRecord(unsigned short idx, std::vector<struct iovec> &iov)
+{
+    if (!isCompact()) {
+        // 分隔键可能被截短，每次按最大键长重取
+        if (getType() == BLOCK_TYPE_INDEX) iov[0].iov_len = indexKeySize();
+        getRecord(buffer_, getSlotsPointer(), idx, iov);
+        return;
+    }
+    fetchKey(idx, iov[0]);
+    unsigned short suffix = indexKeySize() - indexPrefix();
+    unsigned char *entry = buffer_ + sizeof(IndexHeader) + indexPrefix() +
+                           idx * (suffix + sizeof(unsigned int));
+    memcpy(iov[1].iov_base, entry + suffix, sizeof(unsigned int));
+    iov[1].iov_len = sizeof(unsigned int);
+}
+
+void DataBlock::fetchKey(unsigned short idx, struct iovec &iov)
+{
+    RelationInfo *info = table_->info_;
+    if (getType() == BLOCK_TYPE_DATA && info->composite()) {
+        Record record;
+        refslots(idx, record);
+        std::vector<unsigned char> buf;
+        unsigned char *pkey;
+        unsigned int len;
+        refKey(info, record, buf, &pkey, &len);
+        memcpy(iov.iov_base, pkey, len);
+        iov.iov_len = len;
+        return;
+    }
+    if (!isCompact()) {
+        unsigned int field = getType() == BLOCK_TYPE_DATA ? info->key : 0;
+        iov.iov_len = indexKeySize();
+        getRecordByIndex(buffer_, getSlotsPointer(), idx, iov, field);
+        return;
+    }
+    unsigned short size = indexKeySize();
+    unsigned short prefix = indexPrefix();
+    unsigned short suffix = size - prefix;
+    unsigned char *key = (unsigned char *) iov.iov_base;
+    memcpy(key, buffer_ + sizeof(IndexHeader), prefix);
+    memcpy(
+        key + prefix,
+        buffer_ + sizeof(IndexHeader) + prefix +
+            idx * (suffix + sizeof(unsigned int)),
+        suffix);
+    iov.iov_len = size;
+}
+
+unsigned short DataBlock::indexKeySize()
+{
+    return (unsigned short) getKeyBytes(keyType(table_->info_));
+}
+
+unsigned short DataBlock::indexPrefix()
+{
+    IndexHeader *header = reinterpret_cast<IndexHeader *>(buffer_);
+    return be16toh(header->prefix);
+}
+
+unsigned short DataBlock::indexSearch(void *key, size_t len)
+{
+    DataType *type = keyType(table_->info_);
+    unsigned short size = indexKeySize();
+    unsigned short prefix = indexPrefix();
+    unsigned short suffix = size - prefix;
+    size_t width = suffix + sizeof(unsigned int);
+    unsigned char *base = buffer_ + sizeof(IndexHeader) + prefix;
+
+    // 各项拼上公共前缀后按键类型比较
+    unsigned char full[INDEX_KEY_MAX];
+    memcpy(full, buffer_ + sizeof(IndexHeader), prefix);
+    unsigned short low = 0, high = getSlots();
+    while (low < high) {
+        unsigned short mid = (low + high) / 2;
+        memcpy(full + prefix, base + mid * width, suffix);
+        if (type->less(full, size, (unsigned char *) key, (unsigned int) len))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+std::pair<bool, unsigned short>
+DataBlock::indexInsert(std::vector<struct iovec> &iov, unsigned short limit)
+{
+    unsigned short size = indexKeySize();
+    unsigned short prefix = indexPrefix();
+    unsigned short count = getSlots();
+    unsigned char *key = (unsigned char *) iov[0].iov_base;
+    unsigned short index = indexSearch(key, size);
+
+    unsigned char full[INDEX_KEY_MAX];
+    struct iovec probe = {full, size};
+    if (index < count) {
+        fetchKey(index, probe);
+        if (memcmp(full, key, size) == 0) // key相等不能插入
+            return std::pair<bool, unsigned short>(false, -1);
+    }
+
+    // 新键不在公共前缀内时前缀变短，所有项变宽
+    unsigned short keep =
+        count ? commonPrefix(buffer_ + sizeof(IndexHeader), key, prefix) : size;
+    size_t width = size - keep + sizeof(unsigned int);
+    if (keep + (count + 1) * width > limit)
+        return std::pair<bool, unsigned short>(false, index);
+
+    if (count && keep == prefix) {
+        unsigned char *entry =
+            buffer_ + sizeof(IndexHeader) + prefix + index * width;
+        memmove(entry + width, entry, (count - index) * width);
+        memcpy(entry, key + prefix, size - prefix);
+        memcpy(entry + size - prefix, iov[1].iov_base, sizeof(unsigned int));
+        setSlots(count + 1);
+        setFreeSize(indexFreeSize(count + 1, size));
+    } else {
+        std::vector<unsigned char> keys, children;
+        indexDecode(keys, children);
+        keys.insert(keys.begin() + index * size, key, key + size);
+        unsigned char *child = (unsigned char *) iov[1].iov_base;
+        children.insert(
+            children.begin() + index * sizeof(unsigned int),
+            child,
+            child + sizeof(unsigned int));
+        indexRebuild(&keys[0], &children[0], count + 1);
+    }
+    return std::pair<bool, unsigned short>(true, index);
+}
+
+bool DataBlock::indexRemove(std::vector<struct iovec> &iov)
+{
+    unsigned short size = indexKeySize();
+    unsigned short count = getSlots();
+    unsigned short index = indexSearch(iov[0].iov_base, iov[0].iov_len);
+    if (index >= count) return false;
+
+    unsigned char full[INDEX_KEY_MAX];
+    struct iovec probe = {full, size};
+    fetchKey(index, probe);
+    if (memcmp(full, iov[0].iov_base, size) != 0) return false;
+
+    // 后面的项前移，公共前缀不变
+    unsigned short prefix = indexPrefix();
+    size_t width = size - prefix + sizeof(unsigned int);
+    unsigned char *entry = buffer_ + sizeof(IndexHeader) + prefix + index * width;
+    memmove(entry, entry + width, (count - index - 1) * width);
+    setSlots(count - 1);
+    setFreeSize(indexFreeSize(count - 1, size));
+    return true;
+}
+
+std::pair<unsigned int, bool> DataBlock::indexSplit(unsigned short insertPos)
+{
+    std::vector<unsigned char> keys, children;
+    indexDecode(keys, children);
+    unsigned short size = indexKeySize();
+    unsigned short count = getSlots();
+
+    // 连同待插入的项对半分，待插入的项落在左半时左边少留一项
+    unsigned short half = (count + 1) / 2;
+    bool included = insertPos < half;
+    unsigned short keep = included ? half - 1 : half;
+
+    DataBlock next;
+    next.setTable(table_);
+    unsigned int blkid = table_->allocate();
+    BufDesp *bd = kBuffer.borrow(table_->id_, blkid);
+    Table::WriteLatch::hold(bd);
+    next.attach(bd->buffer);
+    next.setType(BLOCK_TYPE_INDEX | BLOCK_FLAG_COMPACT);
+    next.indexRebuild(
+        &keys[0] + keep * size,
+        &children[0] + keep * sizeof(unsigned int),
+        count - keep);
+    kBuffer.writeBuf(bd);
+    kBuffer.releaseBuf(bd);
+
+    // 两半各自重算公共前缀，通常都比原来长
+    indexRebuild(&keys[0], &children[0], keep);
+    return std::make_pair(blkid, included);
+}
+
+void DataBlock::indexDecode(
+    std::vector<unsigned char> &keys,
+    std::vector<unsigned char> &children)
+{
+    unsigned short size = indexKeySize();
+    unsigned short prefix = indexPrefix();
+    unsigned short suffix = size - prefix;
+    unsigned short count = getSlots();
+    unsigned char *entry = buffer_ + sizeof(IndexHeader) + prefix;
+
+    keys.reserve((count + 1) * size); // 多留一项给插入
+    children.reserve((count + 1) * sizeof(unsigned int));
+    keys.resize(count * size);
+    children.resize(count * sizeof(unsigned int));
+    for (unsigned short i = 0; i < count; ++i) {
+        memcpy(&keys[i * size], buffer_ + sizeof(IndexHeader), prefix);
+        memcpy(&keys[i * size + prefix], entry, suffix);
+        memcpy(
+            &children[i * sizeof(unsigned int)],
+            entry + suffix,
+            sizeof(unsigned int));
+        entry += suffix + sizeof(unsigned int);
+    }
+}
+
+void DataBlock::indexRebuild(
+    const unsigned char *keys,
+    const unsigned char *children,
+    unsigned short count)
+{
+    unsigned short size = indexKeySize();
+    unsigned short prefix = count ? size : 0;
+    for (unsigned short i = 1; i < count; ++i)
+        prefix = commonPrefix(keys, keys + i * size, prefix);
+
+    IndexHeader *header = reinterpret_cast<IndexHeader *>(buffer_);
+    header->prefix = htobe16(prefix);
+    if (count) memcpy(buffer_ + sizeof(IndexHeader), keys, prefix);
+    unsigned short suffix = size - prefix;
+    unsigned char *entry = buffer_ + sizeof(IndexHeader) + prefix;
+    for (unsigned short i = 0; i < count; ++i) {
+        memcpy(entry, keys + i * size + prefix, suffix);
+        memcpy(
+            entry + suffix,
+            children + i * sizeof(unsigned int),
+            sizeof(unsigned int));
+        entry += suffix + sizeof(unsigned int);
+    }
+    setSlots(count);
+    setFreeSize(indexFreeSize(count, size));
+}
+
 int DataBlock::search(
     void *keybuf,
     unsigned int len,
     std::vector<struct iovec> &iov)
 {
     RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
-    DataType *keyType = info->fields[keyIdx].type;
+    std::vector<unsigned char> found;
+
+    // 只读映射时提示随机访问
+    File *file = kFiles.get(table_->id_);
+    if (file) file->advise(File::ADVICE_RANDOM);
+
+    // 乐观锁耦合：节点拷贝到本地后校验版本，跟随指针前再校验父节点，
+    // 父节点变了说明指针可能已失效，从根重来；读者不加闩。
+    // 叶节点分裂后先于父节点放开，键大于叶节点所有记录时像 B-link 那样
+    // 沿next右移，右兄弟同样以左兄弟的版本校验；内节点没有右链，只能重来。
+    // 根和下一层先查缓存的解码结果，参见IndexCache。
+    // 修改中的线程已持有排它闩，直接读
+    bool optimistic = !Table::WriteLatch::active();
+    DataBlock data;
+    data.setTable(table_);
 
-    SuperBlock super;
-    BufDesp *bd = kBuffer.borrow(table_->name_.c_str(), 0);
-    super.attach(bd->buffer);
+    for (;;) { // 从根开始
+        BufDesp *parent;
+        unsigned int pversion;
+        unsigned int blockid =
+            startOf(table_, keybuf, len, optimistic, parent, pversion);
+
+        for (;;) {
+            BufDesp *bd = kBuffer.borrow(table_->id_, blockid);
+            unsigned int version = snapshot(bd, BLOCK_SIZE, optimistic);
+            bool stale = optimistic && !parent->latch.readValidate(pversion);
+            kBuffer.releaseBuf(parent);
+            if (stale) {
+                kBuffer.releaseBuf(bd);
+                break;
+            }
+            parent = bd;
+            pversion = version;
 
-    // 用于暂存搜索的结果
-    size_t keySize = getKeyBytes(keyType);
-    std::vector<char> tmpKey(keySize);
-    unsigned int tmpVal;
-    std::vector<struct iovec> tmp = {
-        {&tmpKey[0], keySize}, {&tmpVal, sizeof(unsigned int)}};
+            data.attach(tSnapshot);
+            if (data.getType() != BLOCK_TYPE_DATA) {
+                blockid = childOf(data, keybuf, len);
+                continue;
+            }
 
-    std::stack<unsigned int> stk; // 存 blockid
-    stk.push(super.getRoot());
-    kBuffer.releaseBuf(bd); // 释放超块
+            // 叶节点，键大于所有记录时可能已分裂到右兄弟
+            unsigned short ret = data.searchRecord(keybuf, len);
+            if (ret >= data.getSlots() && data.getNext()) {
+                blockid = data.getNext();
+                continue;
+            }
+            kBuffer.releaseBuf(bd);
+            if (ret >= data.getSlots()) return EFAULT; // 记录不存在
+            getRecord(data.buffer_, data.getSlotsPointer(), ret, iov);
 
-    // blockid 的数据类型是固定的
-    DataType *int_type = findDataType("INT"); 
-    while (!stk.empty()) {
-        unsigned int blockid = stk.top();
-        stk.pop();
+            // ret == 0 时仍可能记录不存在
+            struct iovec key = keyOf(info, iov, found);
+            if (!sameKey(keybuf, len, key.iov_base, key.iov_len))
+                return EFAULT;
+            else
+                return S_OK;
+        }
+    }
+}
 
-        DataBlock data;
-        bd = kBuffer.borrow(table_->name_.c_str(), blockid);
-        data.attach(bd->buffer);
-        data.setTable(table_);
-        Slot *slots = data.getSlotsPointer();
+size_t DataBlock::multiSearch(
+    std::vector<struct iovec> &keys,
+    std::vector<std::vector<struct iovec>> &iovs,
+    std::vector<int> &rets)
+{
+    RelationInfo *info = table_->info_;
+    DataType *keyType = db::keyType(info);
+    std::vector<unsigned char> buf;
+    rets.assign(keys.size(), EFAULT);
+    if (keys.empty()) return 0;
+
+    // 只读映射时提示随机访问
+    File *file = kFiles.get(table_->id_);
+    if (file) file->advise(File::ADVICE_RANDOM);
+
+    // 键排序后，落在同一节点下的键是连续的一段
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&keys, keyType](size_t x, size_t y) {
+        return keyType->less(
+            (unsigned char *) keys[x].iov_base,
+            (unsigned int) keys[x].iov_len,
+            (unsigned char *) keys[y].iov_base,
+            (unsigned int) keys[y].iov_len);
+    });
+
+    // 一段键及其所在的节点，parent为上一层节点在parents中的下标
+    struct Group
+    {
+        unsigned int blockid;
+        size_t begin;
+        size_t end;
+        size_t parent;
+    };
 
-        unsigned short ret = data.searchRecord(keybuf, len);
-        if (data.getType() == BLOCK_TYPE_DATA) { // 叶节点
-            if (ret >= data.getSlots()) { // 记录不存在
+    // 逐层下降，每层的节点各读一次；与search一样乐观读，
+    // 父节点在读子节点前变了的那段键，最后逐个重查
+    bool optimistic = !Table::WriteLatch::active();
+    std::vector<BufDesp *> parents(1, kBuffer.borrow(table_->id_, 0));
+    std::vector<unsigned int> pversions(
+        1, snapshot(parents[0], sizeof(SuperHeader), optimistic));
+    SuperBlock super;
+    super.attach(tSnapshot);
+    std::vector<Group> level(1, Group{rootOf(super), 0, keys.size(), 0});
+    std::vector<size_t> retry;
+    DataBlock node;
+    node.setTable(table_);
+    size_t found = 0;
+
+    while (!level.empty()) {
+        std::vector<Group> below;
+        std::vector<BufDesp *> descs;
+        std::vector<unsigned int> versions;
+        for (size_t g = 0; g < level.size(); ++g) {
+            Group &group = level[g];
+            BufDesp *bd = kBuffer.borrow(table_->id_, group.blockid);
+            unsigned int version = snapshot(bd, BLOCK_SIZE, optimistic);
+            if (optimistic && !parents[group.parent]->latch.readValidate(
+                                  pversions[group.parent])) {
                 kBuffer.releaseBuf(bd);
-                return EFAULT;
-            } 
-            getRecord(data.buffer_, slots, ret, iov);
+                for (size_t i = group.begin; i < group.end; ++i)
+                    retry.push_back(order[i]);
+                continue;
+            }
+            node.attach(tSnapshot);
 
-            // ret == 0 时仍可能记录不存在
-            if (memcmp(keybuf, iov[keyIdx].iov_base, iov[keyIdx].iov_len) != 0) {                
+            // 叶节点，整段键在拷贝上查找，大于所有记录的键可能已分裂到
+            // 右兄弟，留给search沿next右移
+            if (node.getType() == BLOCK_TYPE_DATA) {
                 kBuffer.releaseBuf(bd);
-                return EFAULT;
-            } else {
-                kBuffer.releaseBuf(bd);
-                return S_OK;
+                for (size_t i = group.begin; i < group.end; ++i) {
+                    size_t k = order[i];
+                    unsigned short ret = node.searchRecord(
+                        keys[k].iov_base, keys[k].iov_len);
+                    if (ret >= node.getSlots()) {
+                        if (node.getNext()) retry.push_back(k);
+                        continue;
+                    }
+                    std::vector<struct iovec> &iov = iovs[k];
+                    getRecord(node.buffer_, node.getSlotsPointer(), ret, iov);
+                    struct iovec key = keyOf(info, iov, buf);
+                    if (sameKey(
+                            keys[k].iov_base,
+                            keys[k].iov_len,
+                            key.iov_base,
+                            key.iov_len)) {
+                        rets[k] = S_OK;
+                        ++found;
+                    }
+                }
+                continue;
             }
-        } else { // BLOCK_TYPE_INDEX
-            if (ret >= data.getSlots()) { 
-                getRecord(data.buffer_, slots, data.getSlots() - 1, tmp);
-                int_type->betoh(tmp[1].iov_base);
 
-                stk.push(*(unsigned int *) tmp[1].iov_base);
-            } else {
-                getRecord(data.buffer_, slots, ret, tmp);
+            // 内节点，相邻的键落在同一子节点时合成一段，子节点随即预读
+            size_t parent = descs.size();
+            descs.push_back(bd);
+            versions.push_back(version);
+            unsigned int child = 0;
+            for (size_t i = group.begin; i < group.end; ++i) {
+                size_t k = order[i];
+                unsigned int id = childOf(
+                    node, keys[k].iov_base, (unsigned int) keys[k].iov_len);
+                if (i > group.begin && id == child) {
+                    below.back().end = i + 1;
+                    continue;
+                }
+                child = id;
+                below.push_back(Group{child, i, i + 1, parent});
+                if (kBuffer.async()) kBuffer.prefetch(table_->id_, child);
+            }
+        }
 
-                // 若相等则为键的右侧指针，否则为左侧
-                if (memcmp(keybuf, tmp[keyIdx].iov_base, tmp[keyIdx].iov_len) == 0) {
-                    int_type->betoh(tmp[1].iov_base);
-                    stk.push(*(unsigned int *) tmp[1].iov_base);
-                } else if (ret > 0) {
-                    getRecord(data.buffer_, slots, ret - 1, tmp);
-                    int_type->betoh(tmp[1].iov_base);
+        // 本层的预读一起提交，下一层借用时多半已读完
+        if (kBuffer.async()) kBuffer.flush();
+        for (size_t i = 0; i < parents.size(); ++i)
+            kBuffer.releaseBuf(parents[i]);
+        parents.swap(descs);
+        pversions.swap(versions);
+        level.swap(below);
+    }
+    for (size_t i = 0; i < parents.size(); ++i)
+        kBuffer.releaseBuf(parents[i]);
+
+    for (size_t i = 0; i < retry.size(); ++i) {
+        size_t k = retry[i];
+        rets[k] =
+            search(keys[k].iov_base, (unsigned int) keys[k].iov_len, iovs[k]);
+        if (rets[k] == S_OK) ++found;
+    }
+    return found;
+}
 
-                    stk.push(*(unsigned int *) tmp[1].iov_base);
-                } else {
-                    stk.push(data.getNext()); // 最左侧指针
+BufDesp *DataBlock::descend(void *keybuf, unsigned int len, int intent)
+{
+    // 与search相同的乐观下降，只在叶节点上按intent加闩
+    bool optimistic = !Table::WriteLatch::active();
+    RelationInfo *info = table_->info_;
+    DataType *type = keyType(info);
+    std::vector<unsigned char> buf;
+    DataBlock node;
+    node.setTable(table_);
+
+    for (;;) { // 从根开始
+        BufDesp *parent;
+        unsigned int pversion;
+        unsigned int blockid =
+            startOf(table_, keybuf, len, optimistic, parent, pversion);
+
+        for (;;) {
+            BufDesp *bd = kBuffer.borrow(table_->id_, blockid);
+            unsigned int version = snapshot(bd, BLOCK_SIZE, optimistic);
+            bool stale = optimistic && !parent->latch.readValidate(pversion);
+            kBuffer.releaseBuf(parent);
+            if (stale) {
+                kBuffer.releaseBuf(bd);
+                break;
+            }
+            parent = bd;
+            pversion = version;
+
+            node.attach(tSnapshot);
+            if (node.getType() != BLOCK_TYPE_DATA) {
+                blockid = childOf(node, keybuf, len);
+                continue;
+            }
+
+            // 键大于叶节点所有记录时，右兄弟的第1个键不大于键则右移
+            unsigned int next = node.getNext();
+            if (next && node.searchRecord(keybuf, len) >= node.getSlots()) {
+                BufDesp *nd = kBuffer.borrow(table_->id_, next);
+                snapshot(nd, BLOCK_SIZE, optimistic);
+                kBuffer.releaseBuf(nd);
+                if (optimistic && !bd->latch.readValidate(version)) {
+                    kBuffer.releaseBuf(bd);
+                    break;
+                }
+                node.attach(tSnapshot);
+                Record record;
+                if (node.refslots(0, record)) {
+                    unsigned char *pkey;
+                    unsigned int klen;
+                    refKey(info, record, buf, &pkey, &klen);
+                    if (!type->less((unsigned char *) keybuf, len, pkey, klen)) {
+                        blockid = next;
+                        continue;
+                    }
                 }
             }
+
+            // 加闩后叶节点与拷贝时相比没有变化，才是键所在的叶节点
+            if (intent == BORROW_READ) bd->latch.lockShared();
+            if (!optimistic || bd->latch.readValidate(version)) return bd;
+            kBuffer.releaseBuf(bd, intent);
+            break;
         }
     }
-    return EFAULT;
 }
 
-void DataBlock::attachBuffer(struct BufDesp **bd, unsigned int blockid)
+void DataBlock::attachBuffer(
+    struct BufDesp **bd,
+    unsigned int blockid,
+    bool modify)
 {
-    *bd = kBuffer.borrow(table_->name_.c_str(), blockid);
+    *bd = kBuffer.borrow(table_->id_, blockid);
+    if (modify) Table::WriteLatch::hold(*bd);
     attach((*bd)->buffer);
 }
 
 int DataBlock::insert(std::vector<struct iovec> &iov) 
 {
     RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
-    DataType *keyType = info->fields[keyIdx].type;
+    DataType *keyType = db::keyType(info);
     DataType *int_type = findDataType("INT");
+    if (table_->mapped()) return EROFS; // 映射区只读
+    Table::WriteLatch latch(table_);
+
+    // 待插入记录的键，组合键编码后存于keyBuf
+    std::vector<unsigned char> keyBuf;
+    struct iovec key = keyOf(info, iov, keyBuf);
 
     SuperBlock super;
     BufDesp *bd, *bd2 = nullptr, *bd3 = nullptr;
-    bd = kBuffer.borrow(table_->name_.c_str(), 0);
+    bd = kBuffer.borrow(table_->id_, 0);
     super.attach(bd->buffer);
 
     std::stack<unsigned int> stk; // 存 blockid
-    stk.push(super.getRoot());
+    stk.push(rootOf(super));
     kBuffer.releaseBuf(bd); // 释放超块
 
-    Record tmpRecord;
-    std::vector<char> tmpKeyBuf(iov[keyIdx].iov_len);
-    unsigned int tmpKeyLen = (unsigned int) iov[keyIdx].iov_len;
+    std::vector<char> tmpKeyBuf(getKeyBytes(keyType));
+    unsigned int tmpKeyLen = (unsigned int) tmpKeyBuf.size();
+    struct iovec tmpKeyIov = {&tmpKeyBuf[0], tmpKeyLen};
     unsigned int tmpNextId;
 
     unsigned int blockid;
@@ -610,7 +1680,7 @@ int DataBlock::insert(std::vector<struct iovec> &iov)
 
     std::vector<struct iovec> rec; // 上一节点要插入的记录
     std::pair<unsigned int, bool> splitRet;
-    std::pair<bool, unsigned int> pret;        
+    std::pair<bool, unsigned short> pret;
 
     DataBlock data, next, parent, root; // 复用时无需再 setTable
     data.setTable(table_);
@@ -620,35 +1690,99 @@ int DataBlock::insert(std::vector<struct iovec> &iov)
 
     while (!stk.empty()) {
         blockid = stk.top();
-        data.attachBuffer(&bd, blockid);
-        Slot *slots = data.getSlotsPointer();
-        unsigned short ret = data.searchRecord(iov[keyIdx].iov_base, iov[keyIdx].iov_len);  
+        // 下降时只读，不加闩
+        data.attachBuffer(&bd, blockid, false);
+        unsigned short ret = data.searchRecord(key.iov_base, key.iov_len);
 
         if (data.getType() == BLOCK_TYPE_DATA) { // 叶节点            
             stk.pop(); // 准备向上回溯   
-            getRecord(data.buffer_, slots, ret, tmp);
 
-            // 检查记录是否已存在
-            if (memcmp(iov[keyIdx].iov_base, tmp[keyIdx].iov_base, iov[keyIdx].iov_len) == 0) {
-                kBuffer.releaseBuf(bd);
-                return EFAULT;
-            }
+            // 只对要改的节点加闩，本次加的闩返回前都放开
+            // 记录是否已存在由insertRecord在持闩后检查，满的叶节点也不会分裂
+            size_t mark = Table::WriteLatch::mark();
+            Table::WriteLatch::hold(bd);
             pret = data.insertRecord(iov);
-            if (!pret.first && pret.second != (unsigned int) -1) { // Block 空间不足
-                splitRet = data.split(pret.second, iov);
-                next.attachBuffer(&bd2, splitRet.first);
-                next.setType(BLOCK_TYPE_DATA);
-                data.setNext(next.getSelf()); // 维护叶节点的单链表
-
-                if (splitRet.second) data.insertRecord(iov);
-                else next.insertRecord(iov);
-
-                // 获取新 block 的最小键
-                Slot *nextSlots = next.getSlotsPointer();
-                tmpRecord.attach(
-                    next.buffer_ + be16toh(nextSlots[0].offset),
-                    be16toh(nextSlots[0].length));
-                tmpRecord.getByIndex(&tmpKeyBuf[0], &tmpKeyLen, keyIdx);
+            kBuffer.writeBuf(bd);
+            kBuffer.releaseBuf(bd);
+            if (pret.first || pret.second == (unsigned short) -1) {
+                Table::WriteLatch::dropTo(mark);
+                return pret.first ? S_OK : EFAULT;
+            }
+
+            // Block 空间不足
+            splitRet = data.split(pret.second, iov);
+            next.attachBuffer(&bd2, splitRet.first); // 格式已随分裂设好
+            next.setNext(data.getNext()); // 维护叶节点的单链表
+            data.setNext(next.getSelf());
+
+            if (splitRet.second) data.insertRecord(iov);
+            else next.insertRecord(iov);
+
+            // 上提截短的分隔键，变长键可增大内节点的扇出
+            separatorOf(data, next, tmpKeyIov);
+            tmpKeyLen = (unsigned int) tmpKeyIov.iov_len;
+            tmpNextId = next.getSelf();
+            int_type->htobe(&tmpNextId);
+
+            rec.clear();
+            rec = {
+                {&tmpKeyBuf[0], tmpKeyLen},
+                {&tmpNextId, sizeof(unsigned int)}}; // 都为网络字节序
+
+            kBuffer.writeBuf(bd2);
+            kBuffer.releaseBuf(bd2);
+
+            // 分裂好的两个叶节点先放开，经父节点旧指针来的读者沿next右移
+            unsigned int leftId = data.getSelf();
+            data.detach();
+            Table::WriteLatch::dropTo(mark);
+
+            if (stk.empty()) { // 根为叶节点，新建一个根
+                unsigned int rootId = table_->allocate();
+                root.attachBuffer(&bd2, rootId);
+                root.setIndexType();
+                root.insertRecord(rec);
+                root.setNext(leftId);
+                kBuffer.writeBuf(bd2);
+                kBuffer.releaseBuf(bd2);
+
+                bd2 = kBuffer.borrow(table_->id_, 0);
+                Table::WriteLatch::hold(bd2);
+                super.attach(bd2->buffer);
+                super.setRoot(rootId);
+                kBuffer.writeBuf(bd2);
+                kBuffer.releaseBuf(bd2);
+                Table::WriteLatch::dropTo(mark);
+                return S_OK;
+            }
+
+            // 父节点加闩后插入分隔键，放不下时留着闩去分裂
+            BufDesp *upper;
+            blockid = stk.top();
+            parent.attachBuffer(&upper, blockid, false);
+            bool upperHeld = Table::WriteLatch::hold(upper);
+            pret = parent.insertRecord(rec);
+            if (!pret.first && pret.second != (unsigned short) -1) // 父节点需要分裂
+                needToSplit = true;
+            kBuffer.writeBuf(upper);
+            kBuffer.releaseBuf(upper);
+
+            while (needToSplit && stk.size() > 1) { // 开始回溯
+                blockid = stk.top();
+                stk.pop();
+                needToSplit = false;
+
+                data.attachBuffer(&bd, blockid); // 已加闩
+                splitRet = data.split(pret.second, rec);
+                next.attachBuffer(&bd2, splitRet.first); // 格式已随分裂设好
+
+                if (splitRet.second)
+                    data.insertRecord(rec);
+                else
+                    next.insertRecord(rec);
+
+                next.fetchKey(0, tmpKeyIov);
+                tmpKeyLen = (unsigned int) tmpKeyIov.iov_len;
                 tmpNextId = next.getSelf();
                 int_type->htobe(&tmpNextId);
 
@@ -657,82 +1791,49 @@ int DataBlock::insert(std::vector<struct iovec> &iov)
                     {&tmpKeyBuf[0], tmpKeyLen},
                     {&tmpNextId, sizeof(unsigned int)}}; // 都为网络字节序
 
+                kBuffer.writeBuf(bd);
+                kBuffer.writeBuf(bd2);
+                kBuffer.releaseBuf(bd);
                 kBuffer.releaseBuf(bd2);
 
+                // 内节点没有右链，先给父节点加闩再放开分裂的两个节点，
+                // 经父节点旧指针来的读者校验失败后重来
                 blockid = stk.top();
-                parent.attachBuffer(&bd2, blockid);
+                parent.attachBuffer(&upper, blockid, false);
+                bool held = Table::WriteLatch::hold(upper);
+                if (upperHeld) Table::WriteLatch::drop(bd);
+                Table::WriteLatch::drop(bd2);
+                upperHeld = held;
+
+                // 尝试给父节点插入中位键
                 pret = parent.insertRecord(rec);
-                if (!pret.first && pret.second != (unsigned int) -1) // 父节点需要分裂
+                if (!pret.first && pret.second != (unsigned short) -1)
                     needToSplit = true;
-                
-                kBuffer.releaseBuf(bd2);                                
-            }
-            kBuffer.releaseBuf(bd);
-
-            while (!stk.empty()) { // 开始回溯
-                blockid = stk.top();
-                stk.pop();
-
-                if (needToSplit) {
-                    needToSplit = false;
-                    data.attachBuffer(&bd, blockid);
-                    splitRet = data.split(pret.second, rec);
-                    next.attachBuffer(&bd2, splitRet.first);
-                    next.setType(BLOCK_TYPE_INDEX);
-
-                    if (splitRet.second)
-                        data.insertRecord(rec);
-                    else
-                        next.insertRecord(rec);
-
-                    Slot *nextSlots = next.getSlotsPointer();
-                    tmpRecord.attach(
-                        next.buffer_ + be16toh(nextSlots[0].offset),
-                        be16toh(nextSlots[0].length));
-                    tmpRecord.getByIndex(&tmpKeyBuf[0], &tmpKeyLen, keyIdx);
-                    tmpNextId = next.getSelf();
-                    int_type->htobe(&tmpNextId);
-
-                    rec.clear();
-                    rec = {
-                        {&tmpKeyBuf[0], tmpKeyLen},
-                        {&tmpNextId, sizeof(unsigned int)}}; // 都为网络字节序
-
-                    kBuffer.releaseBuf(bd);
-                    kBuffer.releaseBuf(bd2);
 
-                    // 尝试给父节点插入中位键
-                    blockid = stk.top();
-                    parent.attachBuffer(&bd, blockid);
-                    pret = parent.insertRecord(rec);
-                    if (!pret.first && pret.second != (unsigned int) -1)
-                        needToSplit = true;
-
-                    kBuffer.releaseBuf(bd);
-                }
+                kBuffer.writeBuf(upper);
+                kBuffer.releaseBuf(upper);
             }
             if (needToSplit) { // 根节点需要分裂再插入
-                bd = kBuffer.borrow(table_->name_.c_str(), 0); // 获取超块
+                bd = kBuffer.borrow(table_->id_, 0); // 获取超块
+                Table::WriteLatch::hold(bd);
                 super.attach(bd->buffer);
 
                 blockid = super.getRoot();
                 data.attachBuffer(&bd2, blockid); // 获取根
                 splitRet = data.split(pret.second, rec);
                 next.attachBuffer(&bd3, splitRet.first); // 获取新 block
-                next.setType(BLOCK_TYPE_INDEX);
 
                 if (splitRet.second)
                     data.insertRecord(rec);
                 else
                     next.insertRecord(rec);
+                kBuffer.writeBuf(bd2);
+                kBuffer.writeBuf(bd3);
                 kBuffer.releaseBuf(bd2);
                 kBuffer.releaseBuf(bd3);
 
-                Slot *nextSlots = next.getSlotsPointer();
-                tmpRecord.attach(
-                    next.buffer_ + be16toh(nextSlots[0].offset),
-                    be16toh(nextSlots[0].length));
-                tmpRecord.getByIndex(&tmpKeyBuf[0], &tmpKeyLen, keyIdx);
+                next.fetchKey(0, tmpKeyIov);
+                tmpKeyLen = (unsigned int) tmpKeyIov.iov_len;
                 tmpNextId = next.getSelf();
                 int_type->htobe(&tmpNextId);
 
@@ -743,14 +1844,17 @@ int DataBlock::insert(std::vector<struct iovec> &iov)
 
                 unsigned int rootId = table_->allocate(); // 申请新 block 作为根
                 root.attachBuffer(&bd2, rootId);
+                root.setIndexType();
                 root.insertRecord(rec);
                 root.setNext(data.getSelf());
-                root.setType(BLOCK_TYPE_INDEX);
                 super.setRoot(rootId); // 维护超块中的根 blockid
 
+                kBuffer.writeBuf(bd);
+                kBuffer.writeBuf(bd2);
                 kBuffer.releaseBuf(bd);
                 kBuffer.releaseBuf(bd2);
             }
+            Table::WriteLatch::dropTo(mark);
             return S_OK;
         } else { // BLOCK_TYPE_INDEX
             // 由于 mergeBlock 中需先删除父节点中的记录再 insert，
@@ -759,19 +1863,19 @@ int DataBlock::insert(std::vector<struct iovec> &iov)
                 stk.push(data.getNext()); 
 
             } else if (ret >= data.getSlots()) {
-                getRecord(data.buffer_, slots, data.getSlots() - 1, tmp);
+                data.fetchRecord(data.getSlots() - 1, tmp);
                 int_type->betoh(tmp[1].iov_base);
 
                 stk.push(*(unsigned int *) tmp[1].iov_base);               
             } else {
-                getRecord(data.buffer_, slots, ret, tmp);
+                data.fetchRecord(ret, tmp);
 
                 // 若相等则为键的右侧指针，否则为左侧
-                if (memcmp(tmp[keyIdx].iov_base, iov[keyIdx].iov_base, iov[keyIdx].iov_len) == 0) {
+                if (sameKey(tmp[0].iov_base, tmp[0].iov_len, key.iov_base, key.iov_len)) {
                     int_type->betoh(tmp[1].iov_base);
                     stk.push(*(unsigned int *) tmp[1].iov_base);
                 } else if (ret > 0) {
-                    getRecord(data.buffer_, slots, ret - 1, tmp);
+                    data.fetchRecord(ret - 1, tmp);
                     int_type->betoh(tmp[1].iov_base);
 
                     stk.push(*(unsigned int *) tmp[1].iov_base);
@@ -788,18 +1892,19 @@ int DataBlock::insert(std::vector<struct iovec> &iov)
 bool DataBlock::borrow(
     int idx,
     unsigned int blockid,
-    std::vector<struct iovec> &dataIov)
+    std::vector<struct iovec> &dataIov,
+    bool force)
 {
     bool ret = false;
     unsigned short leFreesize = USHRT_MAX, riFreesize = USHRT_MAX;
-    unsigned int leftId = -1, rightId = -1, tmpLen = sizeof(unsigned int);
+    unsigned int leftId = -1, rightId = -1;
     
     RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
-    DataType *keyType = info->fields[keyIdx].type;
+    DataType *keyType = db::keyType(info);
+    std::vector<unsigned char> firstBuf; // 叶节点组合键的编码
+    std::vector<size_t> capacity = capacityOf(dataIov);
 
     BufDesp *bd = nullptr, *bd2 = nullptr, *bd3 = nullptr;   
-    Slot *slots = getSlotsPointer();
     DataType *intType = findDataType("INT");
 
     DataBlock data, sibling;
@@ -832,17 +1937,13 @@ bool DataBlock::borrow(
         left.setTable(table_);
         if (!idx) { // 若 data 为从左往右数第二个子节点
             leftId = getNext();
-            left.attachBuffer(&bd, leftId);
+            left.attachBuffer(&bd, leftId, false);
         } else {
             // 当对应 slots 中下标不为0时
-            Record record;
-            record.attach(
-                buffer_ + be16toh(slots[idx - 1].offset),
-                be16toh(slots[idx - 1].length));
-            record.getByIndex((char *) &leftId, &tmpLen, 1);
-
+            fetchRecord(idx - 1, tmpIov);
+            memcpy(&leftId, tmpIov[1].iov_base, sizeof(unsigned int));
             intType->betoh(&leftId);
-            left.attachBuffer(&bd, leftId);
+            left.attachBuffer(&bd, leftId, false);
         }
         leFreesize = left.getFreeSize();
         kBuffer.releaseBuf(bd);
@@ -850,16 +1951,13 @@ bool DataBlock::borrow(
 
     // 若不为最右节点，获取右兄弟 freesize
     if (idx < getSlots() - 1) {
-        Record record;
-        record.attach(
-            buffer_ + be16toh(slots[idx + 1].offset),
-            be16toh(slots[idx + 1].length));       
-        record.getByIndex((char *) &rightId, &tmpLen, 1);
+        fetchRecord(idx + 1, tmpIov);
+        memcpy(&rightId, tmpIov[1].iov_base, sizeof(unsigned int));
         intType->betoh(&rightId); // 保持 leftId 及 rightId 均为主机序
 
         DataBlock right;
         right.setTable(table_);
-        right.attachBuffer(&bd, rightId);
+        right.attachBuffer(&bd, rightId, false);
         riFreesize = right.getFreeSize();
         kBuffer.releaseBuf(bd);
     }
@@ -873,30 +1971,28 @@ bool DataBlock::borrow(
         std::vector<struct iovec> &iovRef =
             sibling.getType() == BLOCK_TYPE_DATA ? dataIov : iov;
 
-        getRecord( // 获取最右键
-            sibling.buffer_,
-            sibling.getSlotsPointer(),
-            sibling.getSlots() - 1,
-            iovRef);
+        sibling.fetchRecord(sibling.getSlots() - 1, iovRef); // 获取最右键
         sibling.removeRecord(iovRef);
-        if (sibling.isUnderflow()) { // 若借出键后会下溢
+        if (!force && sibling.isUnderflow()) { // 若借出键后会下溢
             sibling.insertRecord(iovRef);
             ret = false;
         } else {
             data.insertRecord(iovRef);
 
             // 修改两个子节点对应的中位键
-            getRecord(buffer_, getSlotsPointer(), idx, splitIov);
+            fetchRecord(idx, splitIov);
             removeRecord(splitIov);
 
             // 重新获取 data 的第一个键
-            getRecord(data.buffer_, data.getSlotsPointer(), 0, iovRef);
+            if (&iovRef == &dataIov) restore(dataIov, capacity);
+            data.fetchRecord(0, iovRef);
     
             // splitIov 的主键字段指向 splitKey
-            memcpy(
-                &splitKey[0],
-                iovRef[data.getType() == BLOCK_TYPE_DATA ? keyIdx : 0].iov_base,
-                keySize);      
+            struct iovec first = data.getType() == BLOCK_TYPE_DATA
+                                     ? keyOf(info, iovRef, firstBuf)
+                                     : iovRef[0];
+            memcpy(&splitKey[0], first.iov_base, first.iov_len);
+            splitIov[0].iov_len = first.iov_len;
             splitVal = blockid;
             intType->htobe(&splitVal); // iov 此时的值为被移动的记录
 
@@ -911,24 +2007,26 @@ bool DataBlock::borrow(
         
         // 兄弟为叶节点时，next 指向下一叶节点而非最左指针
         if (sibling.getType() == BLOCK_TYPE_DATA) {
-            getRecord(sibling.buffer_, sibling.getSlotsPointer(), 0, dataIov);
+            sibling.fetchRecord(0, dataIov);
             sibling.removeRecord(dataIov);
 
-            if (sibling.isUnderflow()) {
+            if (!force && sibling.isUnderflow()) {
                 sibling.insertRecord(dataIov);
                 ret = false;
             } else {
                 data.insertRecord(dataIov);
 
                 // 修改两个子节点对应的中位键
-                getRecord(buffer_, getSlotsPointer(), (unsigned short) idx + 1, splitIov);
+                fetchRecord((unsigned short) idx + 1, splitIov);
                 removeRecord(splitIov);
 
                 // 因为 sibling 的原第一个记录已被删除，
                 // 故需重新获取它的第一个记录
-                getRecord(
-                    sibling.buffer_, sibling.getSlotsPointer(), 0, dataIov);
-                memcpy(&splitKey[0], dataIov[keyIdx].iov_base, keySize);
+                restore(dataIov, capacity);
+                sibling.fetchRecord(0, dataIov);
+                struct iovec first = keyOf(info, dataIov, firstBuf);
+                memcpy(&splitKey[0], first.iov_base, first.iov_len);
+                splitIov[0].iov_len = first.iov_len;
                 splitVal = rightId;
 
                 // 注意是转换 splitVal 而非 rightId 的字节序
@@ -940,23 +2038,22 @@ bool DataBlock::borrow(
             // 需要到 next 指向的子节点获取最左键
             DataBlock child;
             child.setTable(table_);
-            child.attachBuffer(&bd3, sibling.getNext());
+            child.attachBuffer(&bd3, sibling.getNext(), false);
 
             // 获得 child 第一条记录对应的键
-            getRecordByIndex(
-                child.buffer_, child.getSlotsPointer(), 0, iov[0], 0);
+            child.fetchKey(0, iov[0]);
             val = sibling.getNext(); // 此时 iov 即为要借出的键值对
             intType->htobe(&val);    // 保持 iov 都为网络字节序
             kBuffer.releaseBuf(bd3);
 
             // 修改 sibling 的 next 并重排其记录
-            getRecord(sibling.buffer_, sibling.getSlotsPointer(), 0, tmpIov);
+            sibling.fetchRecord(0, tmpIov);
             intType->betoh(tmpIov[1].iov_base);
             sibling.setNext(*(unsigned int *) tmpIov[1].iov_base);
             intType->htobe(tmpIov[1].iov_base);
             sibling.removeRecord(tmpIov);
 
-            if (sibling.isUnderflow()) { // 若借出键后会下溢
+            if (!force && sibling.isUnderflow()) { // 若借出键后会下溢
                 intType->betoh(&val);
                 sibling.setNext(val); // 将 next 重置为旧值
                 intType->htobe(&val);
@@ -966,14 +2063,14 @@ bool DataBlock::borrow(
                 data.insertRecord(iov);
 
                 // 修改两个子节点对应的中位键
-                getRecord(buffer_, getSlotsPointer(), idx + 1, splitIov);
+                fetchRecord(idx + 1, splitIov);
                 removeRecord(splitIov);
 
                 // 重新获取 sibling 的第一个记录
                 // 注意内节点使用 tmpIov
-                getRecord(
-                    sibling.buffer_, sibling.getSlotsPointer(), 0, tmpIov);
-                memcpy(&splitKey[0], tmpIov[0].iov_base, keySize);
+                sibling.fetchRecord(0, tmpIov);
+                memcpy(&splitKey[0], tmpIov[0].iov_base, tmpIov[0].iov_len);
+                splitIov[0].iov_len = tmpIov[0].iov_len;
                 splitVal = rightId; // 注意中位键对应的是右侧的 sibling
                 intType->htobe(&splitVal);
                 insertRecord(splitIov);
@@ -981,25 +2078,24 @@ bool DataBlock::borrow(
             }
         }      
     }       
+    kBuffer.writeBuf(bd);
+    kBuffer.writeBuf(bd2);
     kBuffer.releaseBuf(bd);
     kBuffer.releaseBuf(bd2);
     return ret;
 }
 
-void DataBlock::merge(
+int DataBlock::merge(
     int idx,
     unsigned int blockid,
     std::vector<struct iovec> &dataIov)
 {
     unsigned short leFreesize = 0, riFreesize = 0;
-    unsigned int leftId = -1, rightId = -1, tmpLen = sizeof(unsigned int);   
+    unsigned int leftId = -1, rightId = -1;   
     BufDesp *bd = nullptr, *bd2;
-    Slot *slots = getSlotsPointer();
     DataType *intType = findDataType("INT");
 
-    RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
-    DataType *keyType = info->fields[keyIdx].type;
+    DataType *keyType = db::keyType(table_->info_);
 
     DataBlock data, sibling;
     data.setTable(table_);
@@ -1017,32 +2113,25 @@ void DataBlock::merge(
         left.setTable(table_);
         if (!idx) { // 从左往右数第二个子节点
             leftId = getNext();
-            left.attachBuffer(&bd, leftId);
+            left.attachBuffer(&bd, leftId, false);
         } else {
-            Record record;
-            record.attach(
-                buffer_ + be16toh(slots[idx - 1].offset),
-                be16toh(slots[idx - 1].length));
-            record.getByIndex((char *) &leftId, &tmpLen, 1);
-
+            fetchRecord(idx - 1, tmpIov);
+            memcpy(&leftId, tmpIov[1].iov_base, sizeof(unsigned int));
             intType->betoh(&leftId); // 保持 blockid 均为主机序
-            left.attachBuffer(&bd, leftId);
+            left.attachBuffer(&bd, leftId, false);
         }
         leFreesize = left.getFreeSize();
         kBuffer.releaseBuf(bd);
     }
 
     if (idx < getSlots() - 1) { // 不为最右的子节点
-        Record record;
-        record.attach(
-            buffer_ + be16toh(slots[idx + 1].offset),
-            be16toh(slots[idx + 1].length));
-        record.getByIndex((char *) &rightId, &tmpLen, 1);
+        fetchRecord(idx + 1, tmpIov);
+        memcpy(&rightId, tmpIov[1].iov_base, sizeof(unsigned int));
         intType->betoh(&rightId);
 
         DataBlock right;
         right.setTable(table_);
-        right.attachBuffer(&bd, rightId);
+        right.attachBuffer(&bd, rightId, false);
         riFreesize = right.getFreeSize();
         kBuffer.releaseBuf(bd);
     }
@@ -1050,41 +2139,86 @@ void DataBlock::merge(
     // 选 freesize 更大的兄弟节点合并
     // 对于叶节点，将右合并到左更容易维护单链表
     sibling.attachBuffer(&bd, leFreesize >= riFreesize ? leftId : rightId);
-    if (leFreesize >= riFreesize)
-        sibling.mergeBlock(blockid, getSelf(), idx, dataIov);
-    else
-        data.mergeBlock(sibling.getSelf(), getSelf(), idx + 1, dataIov);
 
-    // 设置 data 的 next
+    // 内节点合并时多出最左指针下拉的一项，两边都在半满附近时可能放不下
+    // 叶节点经 insert 合并，放不下时会分裂
+    if (data.getType() == BLOCK_TYPE_INDEX &&
+        !(leFreesize >= riFreesize ? sibling.canAbsorb(data)
+                                   : data.canAbsorb(sibling))) {
+        kBuffer.releaseBuf(bd);
+        kBuffer.releaseBuf(bd2);
+        return ENOSPC;
+    }
+
     // 若为叶节点，则需维护单链表
+    // 须在合并前摘掉被清空的叶子，合并中 insert 的分裂会接在新的 next 上
     if (data.getType() == BLOCK_TYPE_DATA) {
         if (leFreesize >= riFreesize) {
             sibling.setNext(data.getNext());
-            data.setNext(NULL);
+            data.setNext(0);
         } else {
             data.setNext(sibling.getNext());
-            sibling.setNext(NULL);
-        }           
+            sibling.setNext(0);
+        }
     }
+
+    bool ok;
+    if (leFreesize >= riFreesize)
+        ok = sibling.mergeBlock(blockid, getSelf(), idx, dataIov);
+    else
+        ok = data.mergeBlock(sibling.getSelf(), getSelf(), idx + 1, dataIov);
+    kBuffer.writeBuf(bd);
+    kBuffer.writeBuf(bd2);
     kBuffer.releaseBuf(bd);
     kBuffer.releaseBuf(bd2);
+    return ok ? S_OK : EFAULT;
+}
+
+bool DataBlock::canAbsorb(DataBlock &from)
+{
+    size_t keySize = getKeyBytes(keyType(table_->info_));
+    std::vector<char> key(keySize);
+    unsigned int val;
+    std::vector<struct iovec> iov = {
+        {&key[0], keySize}, {&val, sizeof(unsigned int)}};
+    // 紧凑节点的freesize按不压缩的定长项计；Record格式按对齐的记录加一个槽位计，
+    // trailer按8B对齐增长，多留8B
+    auto space = [&]() {
+        if (isCompact()) return keySize + sizeof(unsigned int);
+        return ALIGN_TO_SIZE(Record::size(iov)) + sizeof(Slot);
+    };
+
+    size_t need = isCompact() ? 0 : 8;
+    for (unsigned short i = 0; i < from.getSlots(); ++i) {
+        iov[0].iov_len = keySize;
+        from.fetchRecord(i, iov);
+        need += space();
+    }
+    BufDesp *bd = nullptr;
+    DataBlock child;
+    child.setTable(table_);
+    child.attachBuffer(&bd, from.getNext(), false);
+    iov[0].iov_len = keySize;
+    child.fetchKey(0, iov[0]);
+    kBuffer.releaseBuf(bd);
+    need += space();
+    return need <= getFreeSize();
 }
 
-void DataBlock::mergeBlock(
+bool DataBlock::mergeBlock(
     unsigned int blockid,
     unsigned int parentId,
     int blockIdx,
     std::vector<struct iovec> &dataIov)
 {
-    RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
-    DataType *keyType = info->fields[keyIdx].type;
+    DataType *keyType = db::keyType(table_->info_);
 
     BufDesp *bd = nullptr, *bd2 = nullptr;
     DataType *intType = findDataType("INT");
     DataBlock data;
     data.setTable(table_);
     data.attachBuffer(&bd, blockid);
+    bool ok = true;
 
     size_t keySize = getKeyBytes(keyType);
     std::vector<char> tmpKey(keySize);
@@ -1099,61 +2233,66 @@ void DataBlock::mergeBlock(
     parent.attachBuffer(&bd2, parentId);
 
     if (blockIdx == -1) {
-        getRecord(parent.buffer_, parent.getSlotsPointer(), 0, tmpIov);
+        parent.fetchRecord(0, tmpIov);
         parent.removeRecord(tmpIov);
         intType->betoh(tmpIov[1].iov_base);
         parent.setNext(*(unsigned int *) tmpIov[1].iov_base);
     } else {
-        getRecord(parent.buffer_, parent.getSlotsPointer(), blockIdx, tmpIov);
+        parent.fetchRecord(blockIdx, tmpIov);
         parent.removeRecord(tmpIov);
     }
+    kBuffer.writeBuf(bd2);
     kBuffer.releaseBuf(bd2);
 
     if (data.getType() == BLOCK_TYPE_INDEX) {
         // 本实验假设内节点记录为定长
         // 因此为了效率，使用不需要从根开始搜的 insertRecord
-        while (data.getSlots()) {
-            getRecord(data.buffer_, data.getSlotsPointer(), 0, tmpIov);
-            insertRecord(tmpIov);
+        // 调用者已用 canAbsorb 确认放得下，插入失败说明节点已损坏
+        while (ok && data.getSlots()) {
+            data.fetchRecord(0, tmpIov);
+            ok = insertRecord(tmpIov).first;
             data.removeRecord(tmpIov); // 为了可重用该 block
         }
 
         // 移动 data 的最左指针
-        DataBlock child;
-        child.setTable(table_);
-        child.attachBuffer(&bd2, data.getNext());
+        if (ok) {
+            DataBlock child;
+            child.setTable(table_);
+            child.attachBuffer(&bd2, data.getNext(), false);
 
-        getRecordByIndex(
-            child.buffer_, child.getSlotsPointer(), 0, tmpIov[0], keyIdx);
-        tmpVal = data.getNext();
-        intType->htobe(&tmpVal);
-        insertRecord(tmpIov);
+            child.fetchKey(0, tmpIov[0]);
+            tmpVal = data.getNext();
+            intType->htobe(&tmpVal);
+            ok = insertRecord(tmpIov).first;
 
-        kBuffer.releaseBuf(bd2);
+            kBuffer.releaseBuf(bd2);
+        }
     } else {        
         // 当合并到叶节点时，因为可能为变长记录，
         // 所以需要使用会处理分裂的 insert 而非 insertRecord
-        while (data.getSlots()) {
-            getRecord(data.buffer_, data.getSlotsPointer(), 0, dataIov);
+        std::vector<size_t> capacity = capacityOf(dataIov);
+        while (ok && data.getSlots()) {
+            restore(dataIov, capacity);
+            data.fetchRecord(0, dataIov);
             data.removeRecord(dataIov); // 为了可重用该 block                                  
-            insert(dataIov);
+            ok = insert(dataIov) == S_OK;
         }        
     }    
+    kBuffer.writeBuf(bd);
     kBuffer.releaseBuf(bd);
+    return ok;
 }
 
 void DataBlock::showRecords(unsigned int blockid)
 {
     using namespace db;
 
-    RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
 
     DataType *bigint = findDataType("BIGINT");
     BufDesp *bd = nullptr;
     DataBlock data;
     data.setTable(table_);
-    data.attachBuffer(&bd, blockid);
+    data.attachBuffer(&bd, blockid, false);
     Slot *slots = data.getSlotsPointer();
 
     long long tmpKey;
@@ -1171,7 +2310,7 @@ void DataBlock::showRecords(unsigned int blockid)
     }
 
     printf("blockid = %u\n", blockid);
-    for (int i = 0; i < debugKeys.size(); ++i) {
+    for (size_t i = 0; i < debugKeys.size(); ++i) {
         printf("%lld ", debugKeys[i]);
     }
     printf("\n\n");
@@ -1182,19 +2321,24 @@ void DataBlock::showRecords(unsigned int blockid)
 int DataBlock::remove(std::vector<struct iovec> &iov)
 {
     RelationInfo *info = table_->info_;
-    unsigned int keyIdx = info->key;
-    DataType *keyType = info->fields[keyIdx].type;
+    DataType *keyType = db::keyType(info);
     DataType *intType = findDataType("INT");
+    if (table_->mapped()) return EROFS; // 映射区只读
+    Table::WriteLatch latch(table_);
+
+    // 待删除记录的键，组合键编码后存于keyBuf
+    std::vector<unsigned char> keyBuf;
+    struct iovec key = keyOf(info, iov, keyBuf);
 
     SuperBlock super;
     BufDesp *bd, *bd2 = nullptr;
-    bd = kBuffer.borrow(table_->name_.c_str(), 0);
+    bd = kBuffer.borrow(table_->id_, 0);
     super.attach(bd->buffer);
 
     // 存 blockid 及在父节点中的下标
     std::stack<std::pair<unsigned int, int>> stk;
     std::pair<unsigned int, int> blockInfo;
-    stk.push({super.getRoot(), -1});
+    stk.push({rootOf(super), -1});
     kBuffer.releaseBuf(bd); // 释放超块
    
     // preRet 用于存放本节点在父节点 slots 中的下标
@@ -1209,6 +2353,10 @@ int DataBlock::remove(std::vector<struct iovec> &iov)
     std::vector<struct iovec> tmp = {
         {&tmpKey[0], keySize}, {&tmpVal, sizeof(unsigned int)}};
 
+    // 借键与合并时搬动叶节点记录用的缓冲，调用者的iov不能被改写
+    std::vector<std::vector<char>> fields;
+    std::vector<struct iovec> dataIov;
+
     DataBlock data, parent;
     data.setTable(table_);
     parent.setTable(table_);
@@ -1217,92 +2365,112 @@ int DataBlock::remove(std::vector<struct iovec> &iov)
         blockInfo = stk.top();
         preRet = blockInfo.second;
 
-        data.attachBuffer(&bd, blockInfo.first);
-        Slot *slots = data.getSlotsPointer();
-        ret = (int) data.searchRecord(iov[keyIdx].iov_base, iov[keyIdx].iov_len);
+        // 下降时只读，不加闩
+        data.attachBuffer(&bd, blockInfo.first, false);
+        ret = (int) data.searchRecord(key.iov_base, key.iov_len);
 
         if (data.getType() == BLOCK_TYPE_DATA) { // 叶节点
             stk.pop();                           // 准备向上回溯
+
+            // 只对要改的节点加闩，本次加的闩返回前都放开
+            size_t mark = Table::WriteLatch::mark();
+            bool held = Table::WriteLatch::hold(bd);
             if (!data.removeRecord(iov)) {       // 记录不存在
                 kBuffer.releaseBuf(bd);
+                Table::WriteLatch::dropTo(mark);
                 return EFAULT;
             }
 
             // 若为根节点则无需处理下溢
-            bd2 = kBuffer.borrow(table_->name_.c_str(), 0);
+            bd2 = kBuffer.borrow(table_->id_, 0);
             super.attach(bd2->buffer);
-            if (blockInfo.first == super.getRoot()) { 
-                kBuffer.releaseBuf(bd2);
+            kBuffer.writeBuf(bd); // 已删除记录
+            bool isRoot = blockInfo.first == rootOf(super);
+            kBuffer.releaseBuf(bd2);
+            if (isRoot || !data.isUnderflow()) {
                 kBuffer.releaseBuf(bd);
+                Table::WriteLatch::dropTo(mark);
                 return S_OK;
             }
-            kBuffer.releaseBuf(bd2);
 
-            // 删除后下溢
-            if (data.isUnderflow()) { 
+            // 删除后下溢，借键或合并前父节点先加闩，改完一层放开下面的节点，
+            // 父节点留到再上一层加闩之后，经其旧指针来的读者校验失败后重来
+            while (!stk.empty()) {
                 parentId = stk.top().first;
-                parent.attachBuffer(&bd2, parentId);
-                if (!parent.borrow(preRet, data.getSelf(), iov)) { // 借键失败
-                    parent.merge(preRet, data.getSelf(), iov);
+                parent.attachBuffer(&bd2, parentId, false);
+                bool parentHeld = Table::WriteLatch::hold(bd2);
+                size_t level = Table::WriteLatch::mark();
+                recordBuffer(info, iov, fields, dataIov);
+                if (!parent.borrow(preRet, data.getSelf(), dataIov)) { // 借键失败
+                    // 无需调用 merge 后检查 parent 是否下溢，
+                    // 因为下一轮会对其检查
+                    recordBuffer(info, iov, fields, dataIov);
+                    int merged = parent.merge(preRet, data.getSelf(), dataIov);
+                    if (merged == ENOSPC) { // 合并放不下，从兄弟借一项
+                        recordBuffer(info, iov, fields, dataIov);
+                        parent.borrow(preRet, data.getSelf(), dataIov, true);
+                    } else if (merged) {
+                        kBuffer.writeBuf(bd2);
+                        kBuffer.releaseBuf(bd2);
+                        kBuffer.releaseBuf(bd);
+                        Table::WriteLatch::dropTo(mark);
+                        return merged;
+                    }
                 }
-                kBuffer.releaseBuf(bd2);                
-            }
-            kBuffer.releaseBuf(bd);
+                kBuffer.writeBuf(bd2);
+                Table::WriteLatch::dropTo(level);
+                kBuffer.releaseBuf(bd);
+                if (held) Table::WriteLatch::drop(bd);
 
-            while (!stk.empty()) { // 向上回溯
+                // 向上回溯，父节点没有下溢时上面的节点都没有变
+                bd = bd2;
+                held = parentHeld;
                 blockInfo = stk.top();
                 stk.pop();
                 preRet = blockInfo.second;
-
-                data.attachBuffer(&bd, blockInfo.first);
-                if (data.isUnderflow()) {
-                    if (!stk.empty()) { // 不是根节点
-                        parentId = stk.top().first;
-                        parent.attachBuffer(&bd2, parentId);
-                        if (!parent.borrow(
-                                preRet, data.getSelf(), iov)) { // 借键失败
-                            // 无需调用 merge 后检查 parent 是否下溢，
-                            // 因为下一轮会对其检查
-                            parent.merge(preRet, data.getSelf(), iov);
-                        }
-                        kBuffer.releaseBuf(bd2); 
-                    } else {
-                        // 根节点下溢分两种情况：
-                        // 只剩一个指针时，将根节点删除，并将根设为原来的唯一子节点
-                        // 否则，根节点需保留
-                        if (!data.getSlots()) {
-                            bd2 = kBuffer.borrow(table_->name_.c_str(), 0);
-                            super.attach(bd2->buffer);
-                            super.setRoot(data.getNext());
-                            data.setNext(NULL);
-                            kBuffer.releaseBuf(bd2);
-                        }
-                        kBuffer.releaseBuf(bd);
-                        return S_OK;
+                data.attach(bd->buffer);
+                if (!data.isUnderflow()) break;
+
+                // 根节点下溢分两种情况：
+                // 只剩一个指针时，将根节点删除，并将根设为原来的唯一子节点
+                // 否则，根节点需保留
+                if (stk.empty()) {
+                    if (!data.getSlots()) {
+                        bd2 = kBuffer.borrow(table_->id_, 0);
+                        Table::WriteLatch::hold(bd2);
+                        super.attach(bd2->buffer);
+                        super.setRoot(data.getNext());
+                        data.setNext(0);
+                        kBuffer.writeBuf(bd);
+                        kBuffer.writeBuf(bd2);
+                        kBuffer.releaseBuf(bd2);
                     }
-                }               
-                kBuffer.releaseBuf(bd);
+                    break;
+                }
             }
+            kBuffer.releaseBuf(bd);
+            Table::WriteLatch::dropTo(mark);
             return S_OK;
         } else { // BLOCK_TYPE_INDEX
             if (ret >= (int) data.getSlots()) {
-                getRecord(data.buffer_, slots, data.getSlots() - 1, tmp);
+                data.fetchRecord(data.getSlots() - 1, tmp);
                 intType->betoh(tmp[1].iov_base);
                 stk.push(
                     {*(unsigned int *) tmp[1].iov_base, data.getSlots() - 1});
             } else {
-                getRecord(data.buffer_, slots, (unsigned short) ret, tmp);
+                data.fetchRecord((unsigned short) ret, tmp);
                 
                 // 若相等则为键的右侧指针，否则为左侧
-                if (memcmp(
-                        tmp[keyIdx].iov_base,
-                        iov[keyIdx].iov_base,
-                        iov[keyIdx].iov_len) == 0) {
+                if (sameKey(
+                        tmp[0].iov_base,
+                        tmp[0].iov_len,
+                        key.iov_base,
+                        key.iov_len)) {
                     intType->betoh(tmp[1].iov_base);
 
                     stk.push({*(unsigned int *) tmp[1].iov_base, ret});
                 } else if (ret > 0) {
-                    getRecord(data.buffer_, slots, (unsigned short) ret - 1, tmp);
+                    data.fetchRecord((unsigned short) ret - 1, tmp);
                     intType->betoh(tmp[1].iov_base);
 
                     stk.push({*(unsigned int *) tmp[1].iov_base, ret - 1});
@@ -1318,6 +2486,9 @@ int DataBlock::remove(std::vector<struct iovec> &iov)
 
 int DataBlock::update(std::vector<struct iovec> &iov)
 {
+    // 删除和插入在同一次修改中，读者看不到中间状态
+    if (table_->mapped()) return EROFS; // 映射区只读
+    Table::WriteLatch latch(table_);
     if (remove(iov) == S_OK && insert(iov) == S_OK)
         return S_OK;
     else
@@ -1329,14 +2500,13 @@ bool DataBlock::copyRecord(Record &record)
     // 判断剩余空间是否足够
     size_t blen = getFreespaceSize(); // 该block的富余空间
     unsigned short actlen = (unsigned short) record.allocLength();
-    unsigned short trailerlen =
-        ALIGN_TO_SIZE((getSlots() + 1) * sizeof(Slot) + sizeof(unsigned int)) -
-        ALIGN_TO_SIZE(getSlots() * sizeof(Slot) + sizeof(unsigned int));
+    unsigned short trailerlen = getTrailerGrowth();
     if (blen < actlen + trailerlen) return false;
 
     // 分配空间，然后copy
-    std::pair<unsigned char *, bool> alloc_ret = allocate(actlen, getSlots());
-    memcpy(alloc_ret.first, record.buffer_, actlen);
+    unsigned char *alloc_ret = allocate(actlen, getSlots());
+    memcpy(alloc_ret, record.buffer_, actlen);
+    if (getDirectoryWidth()) setDirectory(getSlots() - 1, table_->info_->key);
 
 #if 0
     // 重新排序，最后才重拍？
@@ -1,26 +1,150 @@
 // 实现 buffer
-#include <malloc.h> // windows
+#if defined(WIN32)
+#    include <malloc.h> // windows
+#else
+#    include <stdlib.h> // posix_memalign
+#    define _aligned_free(p) free(p)
+#endif
+#include <algorithm>
 #include <db/buffer.h>
 #include <db/block.h>
 #include <db/file.h>
+#include <db/record.h>
 
 namespace db {
-Buffer::~Buffer()
+namespace {
+// block在文件中的偏移量，超块之后是各个block
+inline unsigned long long blockOffset(unsigned int blockid)
 {
-    if (buffer_) {
-        // 释放所有lru上的描述符，TODO: 恢复？
-        while (lru_.next) {
-            BufDesp *descriptor = lru_.next;
-            lru_.next = descriptor->next;
-            delete (descriptor);
-        }
+    return blockid == 0
+               ? 0
+               : (unsigned long long) blockid * BLOCK_SIZE + SUPER_SIZE;
+}
+
+// 一次合并写的最大block个数，远小于IOV_MAX
+const size_t MAX_RUN = 64;
+
+// 刷盘顺序：按表，再按blockid
+inline bool flushOrder(BufDesp *x, BufDesp *y)
+{
+    return x->table != y->table ? x->table < y->table
+                                : x->blockid < y->blockid;
+}
+} // namespace
+
+// buffer按4096对齐分配，block在文件中的偏移量也需对齐，才能直接io
+static_assert(
+    SUPER_SIZE % File::DIRECT_ALIGN == 0 &&
+        BLOCK_SIZE % File::DIRECT_ALIGN == 0,
+    "block offsets must be aligned for direct io");
+
+BlockMap::~BlockMap()
+{
+    Slots *slots = slots_.load(std::memory_order_relaxed);
+    if (slots) retired_.push_back(slots);
+    for (size_t i = 0; i < retired_.size(); ++i) {
+        delete[] retired_[i]->entries;
+        delete retired_[i];
+    }
+}
+
+void BlockMap::reserve(size_t count)
+{
+    // 负载不超过1/2
+    size_t capacity = 16;
+    unsigned shift = 60;
+    while (capacity < count * 2) {
+        capacity <<= 1;
+        --shift;
+    }
+    Slots *old = slots_.load(std::memory_order_relaxed);
+    if (old && capacity <= old->mask + 1) return;
+
+    // 在新数组上重新散列，填好后再发布
+    Slots *slots = new Slots;
+    slots->entries = new Entry[capacity];
+    memset(slots->entries, 0, capacity * sizeof(Entry));
+    slots->mask = capacity - 1;
+    slots->shift = shift;
+    for (size_t i = 0; old && i <= old->mask; ++i) {
+        Entry &entry = old->entries[i];
+        if (entry.desp == NULL) continue;
+        size_t j = hash(slots, entry.key);
+        while (slots->entries[j].desp)
+            j = (j + 1) & slots->mask;
+        slots->entries[j] = entry;
+    }
+    slots_.store(slots, std::memory_order_release);
+    if (old) retired_.push_back(old);
+}
+
+void BlockMap::insert(unsigned int table, unsigned int blockid, BufDesp *desp)
+{
+    Slots *slots = slots_.load(std::memory_order_relaxed);
+    if (slots == NULL || (size_ + 1) * 2 > slots->mask + 1) {
+        reserve(size_ + 1);
+        slots = slots_.load(std::memory_order_relaxed);
+    }
+
+    unsigned long long k = key(table, blockid);
+    size_t i = hash(slots, k);
+    while (slots->entries[i].desp && slots->entries[i].key != k)
+        i = (i + 1) & slots->mask;
+    if (slots->entries[i].desp == NULL) ++size_;
+    slots->entries[i].key = k;
+    slots->entries[i].desp = desp;
+}
+
+bool BlockMap::erase(unsigned int table, unsigned int blockid)
+{
+    Slots *slots = slots_.load(std::memory_order_relaxed);
+    if (slots == NULL) return false;
+    Entry *entries = slots->entries;
+    size_t mask = slots->mask;
+
+    unsigned long long k = key(table, blockid);
+    size_t i = hash(slots, k);
+    for (;; i = (i + 1) & mask) {
+        if (entries[i].desp == NULL) return false;
+        if (entries[i].key == k) break;
+    }
 
-        // 释放所有buffer内存
-        _aligned_free(buffer_);
+    // 后移填补：把探测链上后面的元素挪到空位，保证查找不会提前遇到空位
+    size_t j = i;
+    for (;;) {
+        entries[i].desp = NULL;
+        size_t home;
+        do {
+            j = (j + 1) & mask;
+            if (entries[j].desp == NULL) {
+                --size_;
+                return true;
+            }
+            home = hash(slots, entries[j].key);
+            // home在(i, j]之间时，j不能挪到i
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        entries[i] = entries[j];
+        i = j;
     }
 }
 
-void Buffer::init(FilePool *fp, size_t size)
+Buffer::~Buffer()
+{
+    stopFlusher();
+    for (size_t i = 0; i < shardCount_; ++i) {
+        // 映射区的描述符单独分配
+        for (size_t j = 0; j < shards_[i].mapped.size(); ++j)
+            delete shards_[i].mapped[j];
+        delete[] shards_[i].descs;
+        delete shards_[i].replacer;
+    }
+    delete[] shards_;
+
+    // 释放所有buffer内存
+    if (buffer_) _aligned_free(buffer_);
+}
+
+void Buffer::init(FilePool *fp, size_t size, const char *policy, size_t shards)
 {
     // 已经初始化过
     if (buffer_) return;
@@ -29,116 +153,745 @@ void Buffer::init(FilePool *fp, size_t size)
     // 按照4096B对齐，以1MB为单位分配内存
     // Requested memory allocation: size MB
     // Alignment value: 4096
-    unsigned char *buffer_ =
-        (unsigned char *) _aligned_malloc(size * 1024 * 1024, 4096);
-
-    // 初始化所有block
-    BufDesp *prev = NULL;
-    idleCount_ = 0;
-    for (size_t i = 0; i < size * 1024 * 1024 / BLOCK_SIZE; ++i) {
-        idle_ = (BufDesp *) (buffer_ + i * BLOCK_SIZE);
-        idle_->next = prev;
-        prev = idle_;
-        idle_->prev = NULL;
-        idle_->size = BLOCK_SIZE;
-        idle_->name = NULL;
-        idle_->type = 0;
-        ++idleCount_;
-    }
-}
-
-BufDesp *Buffer::allocFromIdle()
-{
-    // 从idle头部摘下一个buffer
-    BufDesp *ptr = idle_;
-    idle_ = idle_->next;
-
-    // 分配描述符
-    BufDesp *descriptor = new BufDesp;
-    descriptor->buffer = (unsigned char *) ptr;
-    descriptor->size = BLOCK_SIZE;
-    descriptor->type = 0;
+#if defined(WIN32)
+    buffer_ = (unsigned char *) _aligned_malloc(
+        size * 1024 * 1024, File::DIRECT_ALIGN);
+    if (buffer_ == NULL) return;
+#else
+    if (posix_memalign(
+            (void **) &buffer_, File::DIRECT_ALIGN, size * 1024 * 1024)) {
+        buffer_ = NULL;
+        return;
+    }
+#endif
+    frames_ = size * 1024 * 1024 / BLOCK_SIZE;
+
+    // 分区个数取2的幂，缺省时每个分区至少1024个frame，最多64个分区
+    if (shards == 0)
+        for (shards = 1; shards < 64 && frames_ / (shards * 2) >= 1024;)
+            shards *= 2;
+    for (shardCount_ = 1; shardCount_ * 2 <= shards &&
+                          shardCount_ * 2 <= frames_;)
+        shardCount_ *= 2;
+    shards_ = new Shard[shardCount_];
+
+    // frame平均分到各分区，描述符与frame一一对应
+    Replacer *probe = createReplacer(policy, 0);
+    if (probe == NULL) policy = "LRU";
+    delete probe;
+    unsigned char *frame = buffer_;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        Shard &shard = shards_[i];
+        shard.frames = frames_ / shardCount_ + (i < frames_ % shardCount_);
+        shard.descs = new BufDesp[shard.frames];
+        for (size_t j = shard.frames; j > 0; --j) {
+            BufDesp *descriptor = &shard.descs[j - 1];
+            descriptor->buffer = frame + (j - 1) * BLOCK_SIZE;
+            descriptor->size = BLOCK_SIZE;
+            descriptor->next = shard.idle;
+            shard.idle = descriptor;
+        }
+        frame += shard.frames * BLOCK_SIZE;
+        shard.idleCount = shard.frames;
+        shard.map.reserve(shard.frames);
+        shard.replacer = createReplacer(policy, shard.frames);
+    }
+}
 
-    // 插入lru
-    prependLru(descriptor);
+BufDesp *Buffer::allocFromIdle(Shard &shard)
+{
+    // 从idle头部摘下一个描述符
+    BufDesp *descriptor = shard.idle;
+    shard.idle = descriptor->next;
+    --shard.idleCount;
 
+    descriptor->next = descriptor->prev = NULL;
+    descriptor->type = 0;
+    descriptor->touched = false;
     return descriptor;
 }
 
-void Buffer::prependLru(BufDesp *descriptor)
+BufDesp *Buffer::allocMapped(Shard &shard)
+{
+    if (shard.mapped.size() < shard.frames) {
+        BufDesp *descriptor = new BufDesp;
+        shard.mapped.push_back(descriptor);
+        return descriptor;
+    }
+
+    // 与淘汰一样，修改中的分区先改版本号再看引用计数
+    for (size_t n = 0; n < shard.mapped.size(); ++n) {
+        BufDesp *descriptor = shard.mapped[shard.mappedHand];
+        shard.mappedHand = (shard.mappedHand + 1) % shard.mapped.size();
+        if (descriptor->ref.load()) continue;
+
+        // 描述符不释放，乐观读拿到旧指针时校验会失败
+        shard.map.erase(descriptor->table, descriptor->blockid);
+        descriptor->latch.invalidate();
+        descriptor->touched = false;
+        return descriptor;
+    }
+    return NULL;
+}
+
+size_t Buffer::reserve(size_t count, std::vector<BufDesp *> &frames)
+{
+    // 各分区轮流出，连续一圈都借不到时放弃
+    size_t granted = 0, failed = 0;
+    for (size_t i = frames.size(); granted < count && failed < shardCount_;
+         ++i) {
+        if (reserved_.load() >= frames_ / 2) break;
+        Shard &shard = shards_[i & (shardCount_ - 1)];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        if (shard.idle == NULL) {
+            shard.beginWrite();
+            bool evicted = evict(shard, lock);
+            shard.endWrite();
+            if (!evicted) {
+                ++failed;
+                continue;
+            }
+        }
+        failed = 0;
+
+        // 不进块表也不进替换策略，锁定以防误用
+        BufDesp *descriptor = allocFromIdle(shard);
+        descriptor->type = BUFFER_LOCKED;
+        frames.push_back(descriptor);
+        ++reserved_;
+        ++granted;
+    }
+    return granted;
+}
+
+void Buffer::unreserve(std::vector<BufDesp *> &frames)
+{
+    for (size_t i = 0; i < frames.size(); ++i) {
+        BufDesp *descriptor = frames[i];
+        // 按描述符地址找回所属分区
+        for (size_t j = 0; j < shardCount_; ++j) {
+            Shard &shard = shards_[j];
+            if (descriptor < shard.descs ||
+                descriptor >= shard.descs + shard.frames)
+                continue;
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            descriptor->type = 0;
+            descriptor->next = shard.idle;
+            shard.idle = descriptor;
+            ++shard.idleCount;
+            --reserved_;
+            break;
+        }
+    }
+    frames.clear();
+}
+
+int Buffer::setPolicy(const char *policy)
+{
+    Replacer *replacer = createReplacer(policy, 0);
+    if (replacer == NULL) return EINVAL;
+    delete replacer;
+
+    for (size_t i = 0; i < shardCount_; ++i) {
+        Shard &shard = shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        replacer = createReplacer(policy, shard.frames);
+
+        // 已缓存的block转入新策略，映射区的block不参与替换
+        Replacer *old = shard.replacer;
+        shard.map.each([this, old, replacer](BufDesp *descriptor) {
+            if (descriptor->type & BUFFER_MAPPED) return;
+            old->remove(descriptor);
+            replacer->admit(descriptor);
+        });
+        delete old;
+        shard.replacer = replacer;
+    }
+    return S_OK;
+}
+
+size_t Buffer::idles()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < shardCount_; ++i)
+        count += shards_[i].idleCount;
+    return count;
+}
+
+size_t Buffer::mappings()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        count += shards_[i].mapped.size();
+    }
+    return count;
+}
+
+size_t Buffer::hits()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < shardCount_; ++i)
+        count += shards_[i].hits.load(std::memory_order_relaxed);
+    return count;
+}
+
+size_t Buffer::misses()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < shardCount_; ++i)
+        count += shards_[i].misses.load(std::memory_order_relaxed);
+    return count;
+}
+
+void Buffer::resetStats()
+{
+    for (size_t i = 0; i < shardCount_; ++i) {
+        shards_[i].hits = 0;
+        shards_[i].misses = 0;
+    }
+}
+
+bool Buffer::evictable(BufDesp *desp, void *arg)
+{
+    Buffer *buffer = (Buffer *) arg;
+    // 修改中的分区，先改版本号再看引用计数，与无锁借用的先加引用再校验版本相配
+    if (desp->ref.load()) return false;
+    // 异步读未完成、锁定、正在刷盘的block不淘汰，脏块由evict放锁写回
+    return !(
+        desp->type &
+        (buffer->BUFFER_IO | buffer->BUFFER_LOCKED | buffer->BUFFER_FLUSHING));
+}
+
+bool Buffer::evict(Shard &shard, std::unique_lock<std::mutex> &lock)
+{
+    // 写回失败或写回时被借用的脏块换一个，每个frame至多试一次
+    for (size_t tries = 0; tries < shard.frames; ++tries) {
+        BufDesp *victim = shard.replacer->victim(&Buffer::evictable, this);
+        if (victim == NULL) return false;
+
+        if (victim->type & BUFFER_DIRTY) {
+            // 先放回替换策略并标记刷盘，借用者等待，其它淘汰者跳过
+            shard.replacer->admit(victim);
+            victim->type |= BUFFER_FLUSHING;
+            ++shard.flushing;
+            shard.endWrite();
+            lock.unlock();
+
+            int ret = writeBack(victim);
+
+            lock.lock();
+            shard.beginWrite();
+            victim->type &= ~BUFFER_FLUSHING;
+            --shard.flushing;
+            shard.flushed.notify_all();
+            if (ret != S_OK || victim->ref.load() ||
+                (victim->type & BUFFER_DIRTY))
+                continue;
+            shard.replacer->remove(victim);
+        }
+
+        shard.map.erase(victim->table, victim->blockid);
+        // 按版本缓存了本frame内容的地方随之作废，参见IndexCache
+        victim->latch.invalidate();
+
+        // 描述符归还idle
+        victim->next = shard.idle;
+        shard.idle = victim;
+        ++shard.idleCount;
+        return true;
+    }
+    return false;
+}
+
+bool Buffer::reclaim(Shard &shard, std::unique_lock<std::mutex> &lock)
+{
+    // 没人借用的预读完成前不能淘汰，先回收一遍再试
+    shard.beginWrite();
+    bool ok = shard.idle || evict(shard, lock) ||
+              (reap(false) && evict(shard, lock));
+    shard.endWrite();
+    return ok;
+}
+
+int Buffer::writeBack(BufDesp *desp)
+{
+    // 超块只写SUPER_SIZE
+    int ret = desp->file->write(
+        blockOffset(desp->blockid),
+        (const char *) desp->buffer,
+        desp->blockid == 0 ? SUPER_SIZE : BLOCK_SIZE);
+    if (ret == S_OK) {
+        desp->type &= ~BUFFER_DIRTY;
+        --dirty_;
+    }
+    return ret;
+}
+
+void Buffer::collectDirty(std::vector<BufDesp *> &blocks, bool pinned)
+{
+    for (size_t i = 0; i < shardCount_; ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        shards_[i].map.each([this, &blocks, pinned](BufDesp *descriptor) {
+            unsigned char type = descriptor->type;
+            if ((type & BUFFER_DIRTY) && !(type & BUFFER_FLUSHING) &&
+                (pinned || descriptor->ref.load() == 0))
+                blocks.push_back(descriptor);
+        });
+    }
+}
+
+void Buffer::markFlushing(std::vector<BufDesp *> &blocks, bool pinned)
+{
+    // 收集之后可能已被借用、写回或淘汰，逐个分区重新检查
+    size_t count = 0;
+    for (size_t i = 0; i < shardCount_; ++i) {
+        Shard &shard = shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.beginWrite();
+        for (size_t j = 0; j < blocks.size(); ++j) {
+            BufDesp *descriptor = blocks[j];
+            if (descriptor == NULL ||
+                &shardOf(descriptor->table, descriptor->blockid) != &shard)
+                continue;
+            unsigned char type = descriptor->type;
+            if (shard.map.find(descriptor->table, descriptor->blockid) ==
+                    descriptor &&
+                (type & BUFFER_DIRTY) && !(type & BUFFER_FLUSHING) &&
+                (pinned || descriptor->ref.load() == 0)) {
+                descriptor->type |= BUFFER_FLUSHING;
+                ++shard.flushing;
+                ++count;
+            } else
+                blocks[j] = NULL;
+        }
+        shard.endWrite();
+    }
+
+    // 去掉不再满足条件的
+    size_t k = 0;
+    for (size_t j = 0; j < blocks.size(); ++j)
+        if (blocks[j]) blocks[k++] = blocks[j];
+    blocks.resize(k);
+}
+
+int Buffer::writeBlocks(std::vector<BufDesp *> &blocks)
+{
+    // 相邻的block合并为一次写，超块单独写
+    std::sort(blocks.begin(), blocks.end(), flushOrder);
+    int ret = S_OK;
+    std::vector<bool> written(blocks.size(), false);
+    // 被借用的block可能边写边改，写之前记下修改次数
+    std::vector<unsigned> writes(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i)
+        writes[i] = blocks[i]->writes.load();
+    struct iovec iov[MAX_RUN];
+    for (size_t first = 0, last; first < blocks.size(); first = last) {
+        BufDesp *desp = blocks[first];
+        iov[0].iov_base = desp->buffer;
+        iov[0].iov_len = desp->blockid == 0 ? SUPER_SIZE : BLOCK_SIZE;
+        for (last = first + 1; last < blocks.size() && last - first < MAX_RUN;
+             ++last) {
+            BufDesp *next = blocks[last];
+            if (desp->blockid == 0 || next->table != desp->table ||
+                next->blockid != blocks[last - 1]->blockid + 1)
+                break;
+            iov[last - first].iov_base = next->buffer;
+            iov[last - first].iov_len = BLOCK_SIZE;
+        }
+
+        int r = desp->file->writev(
+            blockOffset(desp->blockid), iov, (int) (last - first));
+        if (r) {
+            ret = r; // 写失败的block保持dirty
+            continue;
+        }
+        for (size_t i = first; i < last; ++i)
+            written[i] = true;
+    }
+
+    // 清除标记，唤醒等待的借用者
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        BufDesp *desp = blocks[i];
+        Shard &shard = shardOf(desp->table, desp->blockid);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (written[i]) {
+            // 写时又被修改的保持dirty；清除后才被writeBuf设上的已另计一次
+            desp->type &= ~BUFFER_DIRTY;
+            if (desp->writes.load() == writes[i] ||
+                (desp->type.fetch_or(BUFFER_DIRTY) & BUFFER_DIRTY))
+                --dirty_;
+        }
+        desp->type &= ~BUFFER_FLUSHING;
+        if (--shard.flushing == 0 || i + 1 == blocks.size() ||
+            &shardOf(blocks[i + 1]->table, blocks[i + 1]->blockid) != &shard)
+            shard.flushed.notify_all();
+    }
+    return ret;
+}
+
+int Buffer::startFlusher(double high, double low)
+{
+    if (low < 0 || high < low || high > 1) return EINVAL;
+    stopFlusher();
+    high_ = high;
+    low_ = low;
+    stopping_ = false;
+    flusher_ = std::thread(&Buffer::flushLoop, this);
+    return S_OK;
+}
+
+void Buffer::stopFlusher()
+{
+    if (!flusher_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(flushMutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_all();
+    flusher_.join();
+}
+
+void Buffer::flushLoop()
 {
-    descriptor->next = lru_.next;
-    lru_.next = descriptor;
-    if (descriptor->next) descriptor->next->prev = descriptor;
-    descriptor->prev = &lru_;
+    std::unique_lock<std::mutex> lock(flushMutex_);
+    for (;;) {
+        // writeBuf不持锁通知，可能错过，定时再检查一次
+        wakeup_.wait_for(lock, std::chrono::milliseconds(100), [this] {
+            return stopping_ || dirty_.load() > high_ * frames_;
+        });
+        if (stopping_) return;
+        if (dirty_.load() <= high_ * frames_) continue;
+        lock.unlock();
+
+        // 未被借用的脏块，借出的block可能正在修改
+        std::vector<BufDesp *> blocks;
+        collectDirty(blocks, false);
+
+        // 只写到低水位，保持blockid顺序以便合并
+        size_t dirty = dirty_.load();
+        size_t target = (size_t) (low_ * frames_);
+        size_t excess = dirty > target ? dirty - target : 0;
+        if (blocks.size() > excess) {
+            std::sort(blocks.begin(), blocks.end(), flushOrder);
+            blocks.resize(excess);
+        }
+        markFlushing(blocks, false);
+        if (!blocks.empty()) writeBlocks(blocks);
+
+        lock.lock();
+        // 脏块都被借用，稍后再试
+        if (blocks.empty())
+            wakeup_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+}
+
+int Buffer::flushAll()
+{
+    // 等待后台刷盘线程写完手上的一批
+    for (size_t i = 0; i < shardCount_; ++i) {
+        Shard &shard = shards_[i];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.flushed.wait(lock, [&shard] { return shard.flushing == 0; });
+    }
+
+    std::vector<BufDesp *> blocks;
+    collectDirty(blocks, true);
+    markFlushing(blocks, true);
+    if (blocks.empty()) return S_OK;
+    return writeBlocks(blocks);
+}
+
+int Buffer::checkpoint()
+{
+    int ret = flushAll();
+    if (ret) return ret;
+
+    // 所有打开的表刷到磁盘
+    File *file;
+    for (unsigned int id = 0; (file = filepool_->get(id)) != NULL; ++id) {
+        ret = file->sync();
+        if (ret) return ret;
+    }
+    return S_OK;
 }
 
-BufDesp *Buffer::borrow(const char *table, unsigned int blockid)
+BufDesp *Buffer::borrow(const char *table, unsigned int blockid, int intent)
 {
     // 利用文件池打开表
     File *file = filepool_->open(table);
+    if (file == NULL) return NULL;
+    return borrow(file, blockid, intent);
+}
+
+BufDesp *Buffer::borrow(unsigned int table, unsigned int blockid, int intent)
+{
+    File *file = filepool_->get(table);
+    if (file == NULL) return NULL;
+    return borrow(file, blockid, intent);
+}
+
+BufDesp *Buffer::borrow(File *file, unsigned int blockid, int intent)
+{
+    // 先钉住再加闩，等闩时block不会被淘汰，分区锁也已释放
+    BufDesp *descriptor = pin(file, blockid);
+    if (descriptor == NULL) return NULL;
+    if (intent == BORROW_READ)
+        descriptor->latch.lockShared();
+    else if (intent == BORROW_WRITE)
+        descriptor->latch.lock();
+    return descriptor;
+}
+
+BufDesp *Buffer::pin(File *file, unsigned int blockid)
+{
+    Shard &shard = shardOf(file->id_, blockid);
+
+    // 无锁命中：乐观查找，引用计数加1后校验分区未被修改
+    unsigned version = shard.version.load(std::memory_order_acquire);
+    if (!(version & 1)) {
+        BufDesp *descriptor = shard.map.find(file->id_, blockid);
+        if (descriptor) {
+            descriptor->addref();
+            if (shard.version.load() == version &&
+                descriptor->table == file->id_ &&
+                descriptor->blockid == blockid &&
+                !(descriptor->type & (BUFFER_IO | BUFFER_FLUSHING))) {
+                shard.hits.fetch_add(1, std::memory_order_relaxed);
+                descriptor->touch();
+                return descriptor;
+            }
+            descriptor->relref();
+        }
+    }
 
-    // 根据表名+offset查找
-    std::pair<const char *, unsigned int> block(table, blockid);
-    BlockMap::iterator it = map_.find(block);
+    // 加锁查找
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    for (;;) {
+        BufDesp *descriptor = shard.map.find(file->id_, blockid);
 
-    // 找到，将描述符移动到lru头部
-    if (it != map_.end()) {
-        // 将该描述符从队列中摘下
-        BufDesp *prev = it->second->prev;
-        prev->next = it->second->next;
-        if (prev->next) prev->next->prev = it->second->prev;
+        // 找到，通知替换策略
+        if (descriptor) {
+            // 正在刷盘，等待写完；淘汰时写回的脏块写完后描述符可能已重用，
+            // 重新查找
+            if (descriptor->type & BUFFER_FLUSHING) {
+                shard.flushed.wait(lock, [this, descriptor] {
+                    return !(descriptor->type & BUFFER_FLUSHING);
+                });
+                continue;
+            }
 
-        // prepend到lru的头部
-        prependLru(it->second);
+            shard.hits.fetch_add(1, std::memory_order_relaxed);
+            if (!(descriptor->type & BUFFER_MAPPED))
+                shard.replacer->access(descriptor);
 
-        // 增加引用计数
-        it->second->addref();
-        // 返回buffer指针
-        return it->second;
+            // 增加引用计数，之后不会被淘汰
+            descriptor->addref();
+            lock.unlock();
+
+            // 预读尚未完成，等待
+            while (descriptor->type & BUFFER_IO)
+                reap(true);
+            return descriptor;
+        }
+
+        // 没有空闲frame时先淘汰，淘汰脏块时放过锁，block可能已被别人读入
+        if (shard.idle || file->mapping(blockOffset(blockid), BLOCK_SIZE))
+            break;
+        if (!reclaim(shard, lock)) return NULL; // 所有block都被借用
     }
 
-    // TODO: 如果空闲空间不够，从lru队列上释放buffer
-    if (idle_ == NULL) {
-        printf("OOM!!!!");
-        return NULL;
+    // 从文件读数据
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
+    shard.beginWrite();
+    BufDesp *descriptor = load(shard, file, blockid);
+    if (descriptor) descriptor->addref();
+    shard.endWrite();
+    lock.unlock();
+    if (descriptor == NULL) return NULL;
+
+    if (descriptor->type & BUFFER_IO) {
+        flush();
+        while (descriptor->type & BUFFER_IO)
+            reap(true);
+    }
+    return descriptor;
+}
+
+BufDesp *
+Buffer::load(Shard &shard, File *file, unsigned int blockid, bool cold)
+{
+    unsigned long long offset = blockOffset(blockid);
+
+    // 只读映射的表，描述符直接指向映射区，不占用buffer
+    const char *mapped = file->mapping(offset, BLOCK_SIZE);
+    if (mapped) {
+        BufDesp *descriptor = allocMapped(shard);
+        if (descriptor == NULL) return NULL;
+        descriptor->buffer = (unsigned char *) mapped;
+        descriptor->size = BLOCK_SIZE;
+        descriptor->type = BUFFER_MAPPED;
+        descriptor->name = file->name_;
+        descriptor->file = file;
+        descriptor->table = file->id_;
+        descriptor->blockid = blockid;
+        shard.map.insert(file->id_, blockid, descriptor);
+        return descriptor;
     }
 
-    // 然后从idle上分配一个block
-    BufDesp *descriptor = allocFromIdle();
-    descriptor->name = table;
+    // 从idle上分配一个block，空闲frame已由调用者备好
+    if (shard.idle == NULL) return NULL;
+    BufDesp *descriptor = allocFromIdle(shard);
+    descriptor->name = file->name_;
+    descriptor->file = file;
+    descriptor->table = file->id_;
     descriptor->blockid = blockid;
-    // prepend到lru的头部
-    prependLru(descriptor);
+
+    // 将block加入map和替换策略
+    shard.map.insert(file->id_, blockid, descriptor);
+    if (cold)
+        shard.replacer->admitCold(descriptor);
+    else
+        shard.replacer->admit(descriptor);
 
     // 从文件读数据
-    unsigned long long offset =
-        blockid == 0 ? 0 : blockid * BLOCK_SIZE + SUPER_SIZE;
+    if (async_) {
+        // 异步读，完成前置BUFFER_IO
+        descriptor->type |= BUFFER_IO;
+        std::lock_guard<std::mutex> lock(aioMutex_);
+        int ret = aio_.submit(
+            file,
+            offset,
+            (char *) descriptor->buffer,
+            BLOCK_SIZE,
+            false,
+            descriptor);
+        if (ret == S_OK) return descriptor;
+        descriptor->type &= ~BUFFER_IO; // 提交失败，改为同步读
+    }
     int ret = file->read(offset, (char *) descriptor->buffer, BLOCK_SIZE);
     if (ret) memset(descriptor->buffer, 0, BLOCK_SIZE); // 读取出错，直接清零
+    return descriptor;
+}
 
-    // 将block加入map
-    BlockMap::value_type val(
-        std::pair<const char *, unsigned int>(table, blockid), descriptor);
-    map_.insert(val);
+int Buffer::enableAsync(unsigned depth)
+{
+    std::lock_guard<std::mutex> lock(aioMutex_);
+    int ret = aio_.init(depth);
+    if (ret == S_OK) async_ = true;
+    return ret;
+}
 
-    // 增加引用计数
-    descriptor->addref();
-    return descriptor;
+void Buffer::disableAsync()
+{
+    // 先停止排队新的读，再提交并回收已排队的
+    async_ = false;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(aioMutex_);
+            aio_.flush();
+            if (aio_.inflight() == 0) return;
+        }
+        reap(true);
+    }
 }
 
-void Buffer::writeBuf(BufDesp *desp)
+int Buffer::prefetch(const char *table, unsigned int blockid)
+{
+    File *file = filepool_->open(table);
+    if (file == NULL) return EFAULT;
+    return prefetch(file, blockid, false);
+}
+
+int Buffer::prefetch(unsigned int table, unsigned int blockid, bool cold)
+{
+    File *file = filepool_->get(table);
+    if (file == NULL) return EFAULT;
+    return prefetch(file, blockid, cold);
+}
+
+int Buffer::prefetch(File *file, unsigned int blockid, bool cold)
+{
+    // 已在buffer中
+    Shard &shard = shardOf(file->id_, blockid);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    for (;;) {
+        if (shard.map.find(file->id_, blockid)) return S_OK;
+        // 淘汰时可能放过锁，重新查找
+        if (shard.idle || file->mapping(blockOffset(blockid), BLOCK_SIZE))
+            break;
+        if (!reclaim(shard, lock)) return ENOMEM;
+    }
+    shard.beginWrite();
+    BufDesp *descriptor = load(shard, file, blockid, cold);
+    shard.endWrite();
+    return descriptor ? S_OK : ENOMEM;
+}
+
+bool Buffer::reading(unsigned int table, unsigned int blockid)
+{
+    Shard &shard = shardOf(table, blockid);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    BufDesp *descriptor = shard.map.find(table, blockid);
+    return descriptor && (descriptor->type & BUFFER_IO);
+}
+
+int Buffer::flush()
+{
+    if (!async_) return S_OK;
+    std::lock_guard<std::mutex> lock(aioMutex_);
+    return aio_.flush();
+}
+
+size_t Buffer::reap(bool wait)
 {
-    // 设定dirty
-    desp->type |= BUFFER_DIRTY;
+    std::lock_guard<std::mutex> lock(aioMutex_);
+    size_t count = 0;
+    void *tag;
+    int result;
+    while (aio_.complete(&tag, &result, wait && count == 0)) {
+        BufDesp *descriptor = (BufDesp *) tag;
+        if (result) memset(descriptor->buffer, 0, BLOCK_SIZE); // 读取出错，清零
+        descriptor->type &= ~BUFFER_IO;
+        ++count;
+    }
+    return count;
+}
+
+int Buffer::borrowBatch(
+    const char *table,
+    const unsigned int *ids,
+    size_t count,
+    BufDesp **out)
+{
+    // 先把缺页全部排队，一次提交
+    for (size_t i = 0; i < count; ++i) {
+        int ret = prefetch(table, ids[i]);
+        if (ret) return ret;
+    }
+    flush();
 
-    // 将该描述符从队列中摘下
-    BufDesp *prev = desp->prev;
-    prev->next = desp->next;
-    prev->next->prev = desp->prev;
+    // 再逐个借用，borrow会等待尚未完成的读
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = borrow(table, ids[i]);
+        if (out[i] == NULL) {
+            for (size_t j = 0; j < i; ++j)
+                releaseBuf(out[j]);
+            return ENOMEM;
+        }
+    }
+    return S_OK;
+}
+
+void Buffer::writeBuf(BufDesp *desp)
+{
+    // 先记修改再设定dirty，与writeBlocks先清dirty再比较相配
+    // 借用时已通知过替换策略
+    ++desp->writes;
+    if (desp->type.fetch_or(BUFFER_DIRTY) & BUFFER_DIRTY) return;
 
-    // prepend到lru的头部
-    prependLru(desp);
+    // 超过高水位，唤醒刷盘线程
+    if (++dirty_ > high_ * frames_ && flusher_.joinable()) wakeup_.notify_one();
 }
 
 // 全局变量
@@ -1,10 +1,27 @@
 // 实现文件功能
 #include <db/file.h>
+#include <db/aio.h>
 #include <db/schema.h>
+#include <db/record.h>
+#if !defined(WIN32)
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
 
 namespace db {
 
-int File::open(const char *path)
+namespace {
+// 直接io要求偏移量、长度、buffer地址均对齐
+inline bool aligned(unsigned long long offset, const void *buffer, size_t length)
+{
+    return (offset | length | (size_t) buffer) % File::DIRECT_ALIGN == 0;
+}
+} // namespace
+
+#if defined(WIN32)
+int File::open(const char *path, bool direct)
 {
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-createfilea
     // TODO:
@@ -17,8 +34,13 @@ int File::open(const char *path)
         FILE_SHARE_READ | FILE_SHARE_WRITE, // 与其它进程共享读写
         NULL,                               // 安全属性
         OPEN_ALWAYS,           // 打开已有文件，不存在文件则创建
-        FILE_ATTRIBUTE_NORMAL, // 普通文件
+        FILE_ATTRIBUTE_NORMAL | // 普通文件
+            (direct ? FILE_FLAG_NO_BUFFERING : 0), // 绕过页缓存
         NULL);
+    direct_ = direct && handle_ != INVALID_HANDLE_VALUE;
+    if (handle_ == INVALID_HANDLE_VALUE && direct &&
+        ::GetLastError() == ERROR_INVALID_PARAMETER)
+        return open(path, false); // 不支持无缓冲io，退回普通模式
     return handle_ == INVALID_HANDLE_VALUE ? ::GetLastError() : S_OK;
 }
 
@@ -33,6 +55,7 @@ void File::close()
 int File::read(unsigned long long offset, char *buffer, size_t length)
 {
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-readfile
+    if (direct_ && !aligned(offset, buffer, length)) return EINVAL;
     DWORD len = 0; // 读长度
     OVERLAPPED over = {};
     over.Offset = (DWORD) offset;
@@ -43,13 +66,16 @@ int File::read(unsigned long long offset, char *buffer, size_t length)
         (DWORD) length,  // buffer大小
         &len,            // 读长度
         &over);          // 偏移量
-    return ret ? S_OK : ::GetLastError();
-    // TODO: len == length??
+    if (!ret) return ::GetLastError();
+    // 同步句柄上只有读到文件尾才会读不满，剩余部分清零
+    if (len < length) memset(buffer + len, 0, length - len);
+    return S_OK;
 }
 
 int File::write(unsigned long long offset, const char *buffer, size_t length)
 {
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-writefile
+    if (direct_ && !aligned(offset, buffer, length)) return EINVAL;
     DWORD len = 0; // 写长度
     OVERLAPPED over = {};
     over.Offset = (DWORD) offset;
@@ -60,8 +86,27 @@ int File::write(unsigned long long offset, const char *buffer, size_t length)
         (DWORD) length, // buffer长度
         &len,           // 写长度返回值
         &over);         // 设定偏移量
-    return ret ? S_OK : ::GetLastError();
-    // TODO: len == length??
+    if (!ret) return ::GetLastError();
+    return len == length ? S_OK : ERROR_WRITE_FAULT;
+}
+
+int File::writev(
+    unsigned long long offset,
+    const struct iovec *iov,
+    int count)
+{
+    // 没有pwritev，逐个写
+    for (int i = 0; i < count; ++i) {
+        int ret = write(offset, (const char *) iov[i].iov_base, iov[i].iov_len);
+        if (ret) return ret;
+        offset += iov[i].iov_len;
+    }
+    return S_OK;
+}
+
+int File::sync()
+{
+    return ::FlushFileBuffers(handle_) ? S_OK : ::GetLastError();
 }
 
 int File::remove(const char *path)
@@ -84,13 +129,240 @@ int File::length(unsigned long long &len)
         return S_OK;
     }
 }
+int File::map()
+{
+    // 不映射，退回非映射模式：map_保持为NULL，mapping总返回NULL，
+    // block照常读入buffer，表也仍可修改
+    map_ = NULL;
+    mapLength_ = 0;
+    return ERROR_NOT_SUPPORTED;
+}
+
+void File::unmap()
+{
+    map_ = NULL;
+    mapLength_ = 0;
+}
+
+void File::advise(int advice) { advice_ = advice; }
+#else
+int File::open(const char *path, bool direct)
+{
+    // 读写打开，不存在则创建
+    direct_ = false;
+#    if defined(O_DIRECT)
+    if (direct) {
+        handle_ = ::open(path, O_RDWR | O_CREAT | O_DIRECT, 0644);
+        if (handle_ != INVALID_HANDLE_VALUE) {
+            direct_ = true;
+            return S_OK;
+        }
+        if (errno != EINVAL) return errno;
+        // 文件系统不支持O_DIRECT，退回普通模式
+    }
+#    else
+    (void) direct;
+#    endif
+    handle_ = ::open(path, O_RDWR | O_CREAT, 0644);
+    return handle_ == INVALID_HANDLE_VALUE ? errno : S_OK;
+}
 
-void FilePool ::init(Schema *schema) { schema_ = schema; }
+void File::close()
+{
+    unmap();
+    if (handle_ != INVALID_HANDLE_VALUE) {
+        ::close(handle_);
+        handle_ = INVALID_HANDLE_VALUE;
+    }
+}
+
+// 打开时接受了O_DIRECT，读写时却被拒绝，去掉O_DIRECT
+static bool dropDirect(HANDLE handle)
+{
+#    if defined(O_DIRECT)
+    int flags = ::fcntl(handle, F_GETFL);
+    return flags != -1 && ::fcntl(handle, F_SETFL, flags & ~O_DIRECT) == 0;
+#    else
+    (void) handle;
+    return false;
+#    endif
+}
+
+int File::read(unsigned long long offset, char *buffer, size_t length)
+{
+    if (direct_ && !aligned(offset, buffer, length)) return EINVAL;
+
+    // pread可能只读到一部分，需要循环直到读满length
+    while (length > 0) {
+        ssize_t len = ::pread(handle_, buffer, length, (off_t) offset);
+        if (len < 0) {
+            if (errno == EINTR) continue; // 被信号打断，重试
+            if (errno == EINVAL && direct_ && dropDirect(handle_)) {
+                direct_ = false;
+                continue;
+            }
+            return errno;
+        }
+        // 直接io只在文件尾读不满
+        if (len == 0 || (direct_ && (size_t) len < length)) {
+            // 已到文件尾，剩余部分从未写过，清零
+            memset(buffer + len, 0, length - len);
+            return S_OK;
+        }
+        buffer += len;
+        offset += len;
+        length -= len;
+    }
+    return S_OK;
+}
+
+int File::write(unsigned long long offset, const char *buffer, size_t length)
+{
+    if (direct_ && !aligned(offset, buffer, length)) return EINVAL;
+
+    // pwrite可能只写了一部分，需要循环直到写完length
+    while (length > 0) {
+        ssize_t len = ::pwrite(handle_, buffer, length, (off_t) offset);
+        if (len < 0) {
+            if (errno == EINTR) continue; // 被信号打断，重试
+            // 剩余部分不再对齐，或文件系统拒绝直接io，退回普通模式
+            if (errno == EINVAL && direct_ && dropDirect(handle_)) {
+                direct_ = false;
+                continue;
+            }
+            return errno;
+        }
+        buffer += len;
+        offset += len;
+        length -= len;
+    }
+    return S_OK;
+}
+
+int File::writev(
+    unsigned long long offset,
+    const struct iovec *iov,
+    int count)
+{
+    if (direct_) {
+        if (!aligned(offset, NULL, 0)) return EINVAL;
+        for (int i = 0; i < count; ++i)
+            if (!aligned(0, iov[i].iov_base, iov[i].iov_len)) return EINVAL;
+    }
+
+    // pwritev可能只写了一部分，跳过写完的buffer后继续
+    std::vector<struct iovec> rest(iov, iov + count);
+    struct iovec *next = rest.data();
+    while (count > 0) {
+        ssize_t len = ::pwritev(handle_, next, count, (off_t) offset);
+        if (len < 0) {
+            if (errno == EINTR) continue; // 被信号打断，重试
+            if (errno == EINVAL && direct_ && dropDirect(handle_)) {
+                direct_ = false;
+                continue;
+            }
+            return errno;
+        }
+        offset += len;
+        while (count > 0 && (size_t) len >= next->iov_len) {
+            len -= next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count > 0) {
+            next->iov_base = (char *) next->iov_base + len;
+            next->iov_len -= len;
+        }
+    }
+    return S_OK;
+}
+
+int File::sync() { return ::fsync(handle_) ? errno : S_OK; }
+
+int File::remove(const char *path) { return ::unlink(path) ? errno : S_OK; }
+
+int File::length(unsigned long long &len)
+{
+    struct stat st;
+    if (::fstat(handle_, &st)) return errno;
+    len = st.st_size;
+    return S_OK;
+}
+
+int File::map()
+{
+    // 已经映射过
+    if (map_) return S_OK;
+
+    unsigned long long len;
+    int ret = length(len);
+    if (ret) return ret;
+    if (len == 0) return EINVAL; // 空文件无法映射
+
+    void *addr = ::mmap(NULL, (size_t) len, PROT_READ, MAP_SHARED, handle_, 0);
+    if (addr == MAP_FAILED) return errno;
+    map_ = (char *) addr;
+    mapLength_ = (size_t) len;
+    advice_ = ADVICE_NORMAL;
+    return S_OK;
+}
+
+void File::unmap()
+{
+    if (map_) {
+        ::munmap(map_, mapLength_);
+        map_ = NULL;
+        mapLength_ = 0;
+    }
+}
+
+void File::advise(int advice)
+{
+    if (map_ == NULL || advice_ == advice) return;
+    static const int kAdvice[] = {
+        MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM};
+    if (::madvise(map_, mapLength_, kAdvice[advice]) == 0) advice_ = advice;
+}
+#endif
+
+int File::submitRead(
+    unsigned long long offset,
+    char *buffer,
+    size_t length,
+    void *tag)
+{
+    int ret = kAio.submit(this, offset, buffer, length, false, tag);
+    return ret ? ret : kAio.flush();
+}
+
+int File::submitWrite(
+    unsigned long long offset,
+    const char *buffer,
+    size_t length,
+    void *tag)
+{
+    int ret = kAio.submit(this, offset, (char *) buffer, length, true, tag);
+    return ret ? ret : kAio.flush();
+}
+
+bool File::complete(void **tag, int *result, bool wait)
+{
+    return kAio.complete(tag, result, wait);
+}
+
+void FilePool ::init(Schema *schema, bool direct)
+{
+    schema_ = schema;
+    direct_ = direct;
+}
 
 File *FilePool::open(const char *table)
 {
+    // 查找、打开和登记须原子，否则并发打开同一表会重复登记
+    std::lock_guard<std::mutex> lock(mutex_);
+
     // 先查询表是否打开
-    std::map<const char *, File>::iterator it = map_.find(table);
+    std::map<std::string, File>::iterator it = map_.find(table);
     // 找到，直接返回
     if (it != map_.end()) return &it->second;
 
@@ -100,13 +372,27 @@ File *FilePool::open(const char *table)
 
     // 打开表文件
     File file;
-    int ret = file.open(bret.first->second.path.c_str());
+    int ret = file.open(bret.first->second.path.c_str(), direct_);
     if (ret) return NULL; // 文件打开失败
 
-    // 在map中增加项
-    map_[table] = file;
+    // 在map中增加项，并分配编号
+    it = map_.insert(std::make_pair(std::string(table), File())).first;
+    File &opened = it->second;
+    opened = file;
     file.handle_ = INVALID_HANDLE_VALUE; // 防止析构函数动作
-    return &map_[table];
+    opened.id_ = (unsigned int) files_.size();
+    opened.name_ = it->first.c_str();
+    files_.push_back(&opened);
+
+    // 只读映射，失败时(如空文件、windows)仍走buffer读
+    if (mapped_ && strcmp(table, Schema::META_FILE) != 0) opened.map();
+    return &opened;
+}
+
+File *FilePool::get(unsigned int id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return id < files_.size() ? files_[id] : NULL;
 }
 
 // 全局文件池
@@ -0,0 +1,176 @@
+// 实现保序的键编码
+#include <string.h>
+#include <algorithm>
+#include <db/key.h>
+#include <db/datatype.h>
+#include <db/schema.h>
+
+namespace db {
+
+namespace {
+// 定长的类型都是整数
+inline bool isInteger(DataType *type)
+{
+    return type->size > 0 && type->size <= (ptrdiff_t) sizeof(long long);
+}
+
+// 第i个键列的域
+inline unsigned int keyField(RelationInfo *info, size_t i)
+{
+    return info->composite() ? info->keys[i] : info->key;
+}
+inline size_t keyColumns(RelationInfo *info)
+{
+    return info->composite() ? info->keys.size() : 1;
+}
+
+// 追加一列的编码
+void appendField(
+    DataType *type,
+    const void *val,
+    size_t len,
+    bool last,
+    std::vector<unsigned char> &key)
+{
+    size_t size = key.size();
+    key.resize(size + encodedSize(type, len, last));
+    key.resize(size + encodeField(type, val, len, last, &key[size]));
+}
+} // namespace
+
+int compareKey(const void *x, size_t xlen, const void *y, size_t ylen)
+{
+    int ret = memcmp(x, y, std::min(xlen, ylen));
+    if (ret) return ret;
+    return xlen < ylen ? -1 : (xlen > ylen ? 1 : 0);
+}
+
+size_t encodedSize(DataType *type, size_t len, bool last)
+{
+    if (isInteger(type) || last) return len;
+    return 2 * len + 2; // 每个字节都可能转义，另加结尾
+}
+
+size_t encodeField(
+    DataType *type,
+    const void *val,
+    size_t len,
+    bool last,
+    unsigned char *out)
+{
+    const unsigned char *p = (const unsigned char *) val;
+    if (isInteger(type)) {
+        memcpy(out, p, len);
+        if (len) out[0] ^= 0x80; // 翻转符号位
+        return len;
+    }
+    if (last) {
+        memcpy(out, p, len);
+        return len;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        out[n++] = p[i];
+        if (p[i] == 0) out[n++] = 0xff;
+    }
+    out[n++] = 0;
+    out[n++] = 0;
+    return n;
+}
+
+void encodeKey(
+    RelationInfo *info,
+    std::vector<struct iovec> &iov,
+    std::vector<unsigned char> &key)
+{
+    size_t columns = keyColumns(info);
+    for (size_t i = 0; i < columns; ++i) {
+        unsigned int field = keyField(info, i);
+        appendField(
+            info->fields[field].type,
+            iov[field].iov_base,
+            iov[field].iov_len,
+            i + 1 == columns,
+            key);
+    }
+}
+
+void encodePrefix(
+    RelationInfo *info,
+    std::vector<struct iovec> &values,
+    std::vector<unsigned char> &key)
+{
+    size_t columns = keyColumns(info);
+    for (size_t i = 0; i < values.size() && i < columns; ++i)
+        appendField(
+            info->fields[keyField(info, i)].type,
+            values[i].iov_base,
+            values[i].iov_len,
+            i + 1 == columns,
+            key);
+}
+
+void initKey(RelationInfo &info)
+{
+    if (!info.composite()) return;
+
+    // 按字节比较，与VARCHAR相同；最大长度为各列按域长编码后之和
+    info.compound = *findDataType("VARCHAR");
+    info.compound.name = "KEY";
+    ptrdiff_t size = 0;
+    for (size_t i = 0; i < info.keys.size(); ++i) {
+        FieldInfo &field = info.fields[info.keys[i]];
+        long long len = field.length ? field.length : field.type->size;
+        if (len < 0) len = -len;
+        size += encodedSize(field.type, (size_t) len, i + 1 == info.keys.size());
+    }
+    info.compound.size = -size;
+}
+
+DataType *keyType(RelationInfo *info)
+{
+    return info->composite() ? &info->compound
+                             : info->fields[info->key].type;
+}
+
+struct iovec keyOf(
+    RelationInfo *info,
+    std::vector<struct iovec> &iov,
+    std::vector<unsigned char> &buf)
+{
+    if (!info->composite()) return iov[info->key];
+    buf.clear();
+    encodeKey(info, iov, buf);
+    struct iovec key = {buf.data(), buf.size()};
+    return key;
+}
+
+void refKey(
+    RelationInfo *info,
+    Record &record,
+    std::vector<unsigned char> &buf,
+    unsigned char **pkey,
+    unsigned int *len)
+{
+    if (!info->composite()) {
+        record.refByIndex(pkey, len, info->key);
+        return;
+    }
+    buf.clear();
+    for (size_t i = 0; i < info->keys.size(); ++i) {
+        unsigned char *field;
+        unsigned int flen;
+        record.refByIndex(&field, &flen, info->keys[i]);
+        appendField(
+            info->fields[info->keys[i]].type,
+            field,
+            flen,
+            i + 1 == info->keys.size(),
+            buf);
+    }
+    *pkey = buf.data();
+    *len = (unsigned int) buf.size();
+}
+
+} // namespace db
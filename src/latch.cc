@@ -0,0 +1,61 @@
+// 实现读写闩的等待和唤醒
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <db/latch.h>
+
+namespace db {
+namespace {
+// 睡眠前的自旋次数，后一半每次让出cpu
+const int SPINS = 64;
+
+// 等待队列，按闩的地址散列，多个闩共用
+struct Bucket
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+const size_t BUCKETS = 64;
+Bucket kBuckets[BUCKETS];
+
+inline Bucket &bucketOf(const void *latch)
+{
+    return kBuckets[((uintptr_t) latch >> 4) % BUCKETS];
+}
+} // namespace
+
+void Latch::wait(bool exclusive)
+{
+    for (int i = 0; i < SPINS; ++i) {
+        if (i >= SPINS / 2) std::this_thread::yield();
+        if (exclusive ? tryLock() : tryLockShared()) return;
+    }
+
+    Bucket &bucket = bucketOf(this);
+    for (;;) {
+        if (exclusive ? tryLock() : tryLockShared()) return;
+
+        // 置上等待位后才能睡眠，释放者清掉等待位后在同一把锁下唤醒，不会丢失
+        std::unique_lock<std::mutex> lock(bucket.mutex);
+        unsigned s = state_.load(std::memory_order_relaxed);
+        while (exclusive ? s != 0 : (s & WRITER) != 0) {
+            if (s & WAITING) {
+                bucket.cond.wait(lock);
+                break;
+            }
+            if (state_.compare_exchange_weak(
+                    s, s | WAITING, std::memory_order_relaxed))
+                s |= WAITING;
+        }
+    }
+}
+
+void Latch::wake()
+{
+    Bucket &bucket = bucketOf(this);
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    bucket.cond.notify_all();
+}
+
+} // namespace db
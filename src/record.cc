@@ -103,7 +103,7 @@ bool Record::set(std::vector<struct iovec> &iov, const unsigned char *header)
     // 输出padding
     if (total < length_)
         for (size_t i = 0; i < length_ - total; ++i)
-            this->buffer_[length_ - i] = 0;
+            this->buffer_[total + i] = 0;
 
     return true;
 }
@@ -294,7 +294,7 @@ bool Record::getByIndex(char *buffer, unsigned int *len, unsigned int idx)
     if (idx >= index) return false;
 
     // 逆序，先交换
-    for (int i = 0; i < index / 2; ++i) {
+    for (size_t i = 0; i < index / 2; ++i) {
         size_t tmp = vec[i];
         vec[i] = vec[index - i - 1];
         vec[index - i - 1] = tmp;
@@ -302,7 +302,7 @@ bool Record::getByIndex(char *buffer, unsigned int *len, unsigned int idx)
 
     // 计算长度
     std::vector<size_t> lvec; // 存放各字段长度
-    for (int i = 0; i < index - 1; ++i) {
+    for (size_t i = 0; i < index - 1; ++i) {
         lvec.push_back(vec[i + 1] - vec[i]);
         if (i == idx) {
             if (*len < lvec[idx]) return false;
@@ -325,54 +325,37 @@ bool Record::refByIndex(
     unsigned int *len,
     unsigned int idx)
 {
-    size_t offset = 1; // 偏移量
-
     // 总长
     Integer it;
     bool ret = it.decode((char *) buffer_ + 1, length_);
     if (!ret) return false;
     size_t length = it.get(); // 记录总长度
-    offset += it.size();
+    size_t begin = 1 + it.size(); // 偏移量数组的起点
 
-    // 枚举所有字段长度
+    // 先走到逆序数组的0结尾，得到字段个数和字段的起点，不分配内存
+    size_t offset = begin;
     size_t index = 0;
-    std::vector<size_t> vec; // 存放各字段长度
     while (true) {
         if (offset >= length_) return false;
         ret = it.decode((char *) buffer_ + offset, length_ - offset);
         if (!ret) return false;
-
-        vec.push_back(it.get()); // 临时存放偏移量，注意是逆序
         ++index;
-
-        // 找到尾部
         offset += it.size();
         if (it.value_ == 0) break;
     }
     if (idx >= index) return false;
 
-    // 逆序，先交换
-    for (int i = 0; i < index / 2; ++i) {
-        size_t tmp = vec[i];
-        vec[i] = vec[index - i - 1];
-        vec[index - i - 1] = tmp;
-    }
-
-    // 计算长度
-    std::vector<size_t> lvec; // 存放各字段长度
-    for (int i = 0; i < index - 1; ++i) {
-        lvec.push_back(vec[i + 1] - vec[i]);
-        if (i == idx) {
-            *len = (unsigned int) lvec[idx];
-            *buffer = buffer_ + offset + vec[idx];
-            return true;
-        }
+    // 第idx个字段的偏移量是数组倒数第idx+1项，它前面一项是下一字段的偏移量
+    size_t start = 0, end = length - offset;
+    size_t pos = begin;
+    for (size_t i = 0; i < index - idx; ++i) {
+        it.decode((char *) buffer_ + pos, length_ - pos);
+        pos += it.size();
+        if (i + 2 == index - idx) end = it.get();
+        if (i + 1 == index - idx) start = it.get();
     }
-
-    // 最后一个字段长度
-    lvec.push_back(length - vec[index - 1] - offset);
-    *len = (unsigned int) lvec[idx];
-    *buffer = buffer_ + offset + vec[idx];
+    *len = (unsigned int) (end - start);
+    *buffer = buffer_ + offset + start;
     return true;
 }
 
@@ -0,0 +1,449 @@
+// 实现buffer替换策略
+#include <string.h>
+#include <list>
+#include <unordered_map>
+#include <db/replacer.h>
+#include <db/buffer.h>
+
+namespace db {
+namespace {
+
+// 描述符组成的双向循环队列，head.next为头，head.prev为尾
+struct Queue
+{
+    BufDesp head; // 哨兵
+    size_t size;  // 元素个数
+
+    Queue()
+        : size(0)
+    {
+        head.next = head.prev = &head;
+    }
+    inline void pushFront(BufDesp *desp)
+    {
+        desp->next = head.next;
+        desp->prev = &head;
+        head.next->prev = desp;
+        head.next = desp;
+        ++size;
+    }
+    inline void pushBack(BufDesp *desp)
+    {
+        desp->next = &head;
+        desp->prev = head.prev;
+        head.prev->next = desp;
+        head.prev = desp;
+        ++size;
+    }
+    inline void unlink(BufDesp *desp)
+    {
+        desp->prev->next = desp->next;
+        desp->next->prev = desp->prev;
+        desp->next = desp->prev = NULL;
+        --size;
+    }
+    // 从尾部向前找可淘汰的block
+    // 无锁命中过的block，requeue为真时移到队头，否则只清除记录
+    BufDesp *victim(Replacer::Evictable evictable, void *arg, bool requeue)
+    {
+        for (BufDesp *desp = head.prev, *prev; desp != &head; desp = prev) {
+            prev = desp->prev;
+            if (desp->untouch()) {
+                if (requeue) {
+                    unlink(desp);
+                    pushFront(desp);
+                }
+            } else if (evictable(desp, arg)) {
+                unlink(desp);
+                return desp;
+            }
+        }
+        return NULL;
+    }
+};
+
+inline unsigned long long keyOf(BufDesp *desp)
+{
+    return BlockMap::key(desp->table, desp->blockid);
+}
+
+////
+// LRU，命中时移到队头，从队尾淘汰
+class LruReplacer : public Replacer
+{
+  private:
+    Queue lru_;
+
+  public:
+    const char *name() { return "LRU"; }
+    void admit(BufDesp *desp) { lru_.pushFront(desp); }
+    void admitCold(BufDesp *desp) { lru_.pushBack(desp); }
+    void access(BufDesp *desp)
+    {
+        lru_.unlink(desp);
+        lru_.pushFront(desp);
+    }
+    BufDesp *victim(Evictable evictable, void *arg)
+    {
+        return lru_.victim(evictable, arg, true);
+    }
+    void remove(BufDesp *desp) { lru_.unlink(desp); }
+};
+
+////
+// 2Q，参见Johnson & Shasha, VLDB'94
+// A1in占1/4，A1out记住1/2个被淘汰的键
+class TwoQReplacer : public Replacer
+{
+  private:
+    Queue a1in_;                          // 首次访问，FIFO
+    Queue am_;                            // 再次访问，LRU
+    std::list<unsigned long long> a1out_; // 从A1in淘汰的键，FIFO
+    std::unordered_map<
+        unsigned long long,
+        std::list<unsigned long long>::iterator>
+        ghosts_;  // A1out的索引
+    size_t kin_;  // A1in的目标长度
+    size_t kout_; // A1out的最大长度
+
+  public:
+    TwoQReplacer(size_t frames)
+        : kin_(frames / 4 ? frames / 4 : 1)
+        , kout_(frames / 2 ? frames / 2 : 1)
+    {}
+
+    const char *name() { return "2Q"; }
+
+    void admit(BufDesp *desp)
+    {
+        // 在A1out中，说明不久前访问过，直接进Am
+        std::unordered_map<
+            unsigned long long,
+            std::list<unsigned long long>::iterator>::iterator it =
+            ghosts_.find(keyOf(desp));
+        if (it != ghosts_.end()) {
+            a1out_.erase(it->second);
+            ghosts_.erase(it);
+            am_.pushFront(desp);
+            desp->link = &am_;
+        } else {
+            a1in_.pushFront(desp);
+            desp->link = &a1in_;
+        }
+    }
+
+    void admitCold(BufDesp *desp)
+    {
+        // 不查A1out，放到A1in队尾最先淘汰
+        a1in_.pushBack(desp);
+        desp->link = &a1in_;
+    }
+
+    void access(BufDesp *desp)
+    {
+        // A1in中的命中不改变位置，扫描造成的相关访问不会提升
+        if (desp->link == &am_) {
+            am_.unlink(desp);
+            am_.pushFront(desp);
+        }
+    }
+
+    BufDesp *victim(Evictable evictable, void *arg)
+    {
+        BufDesp *desp = NULL;
+        // A1in超过目标长度时先淘汰A1in，否则淘汰Am
+        if (a1in_.size > kin_ || am_.size == 0) {
+            desp = a1in_.victim(evictable, arg, false);
+            if (desp == NULL) desp = am_.victim(evictable, arg, true);
+        } else {
+            desp = am_.victim(evictable, arg, true);
+            if (desp == NULL) desp = a1in_.victim(evictable, arg, false);
+        }
+        if (desp == NULL) return NULL;
+
+        // 从A1in淘汰的记入A1out
+        if (desp->link == &a1in_) {
+            unsigned long long key = keyOf(desp);
+            a1out_.push_front(key);
+            ghosts_[key] = a1out_.begin();
+            if (a1out_.size() > kout_) {
+                ghosts_.erase(a1out_.back());
+                a1out_.pop_back();
+            }
+        }
+        desp->link = NULL;
+        return desp;
+    }
+
+    void remove(BufDesp *desp)
+    {
+        ((Queue *) desp->link)->unlink(desp);
+        desp->link = NULL;
+    }
+};
+
+////
+// CLOCK-Pro，参见Jiang, Chen & Zhang, USENIX ATC'05
+// 所有冷页都处于测试期；被淘汰的冷页留下非驻留节点直到测试期结束
+class ClockProReplacer : public Replacer
+{
+  private:
+    struct Node
+    {
+        Node *next;             // 时钟上的下一个
+        Node *prev;             // 时钟上的上一个
+        BufDesp *desp;          // 描述符，NULL表示非驻留
+        unsigned long long key; // table id + blockid
+        bool hot;               // 热页
+        bool ref;               // 访问位
+    };
+    std::unordered_map<unsigned long long, Node *> nodes_; // 所有节点
+    Node *handHot_;     // 热指针，冷却热页并结束测试期
+    Node *handCold_;    // 冷指针，淘汰冷页
+    Node *handTest_;    // 测试指针，限制非驻留节点个数
+    size_t frames_;     // buffer个数
+    size_t coldTarget_; // 冷页目标个数，自适应
+    size_t hot_;        // 驻留热页个数
+    size_t cold_;       // 驻留冷页个数
+    size_t test_;       // 非驻留节点个数
+
+  public:
+    ClockProReplacer(size_t frames)
+        : handHot_(NULL)
+        , handCold_(NULL)
+        , handTest_(NULL)
+        , frames_(frames ? frames : 1)
+        , coldTarget_(1)
+        , hot_(0)
+        , cold_(0)
+        , test_(0)
+    {}
+    ~ClockProReplacer()
+    {
+        for (std::unordered_map<unsigned long long, Node *>::iterator it =
+                 nodes_.begin();
+             it != nodes_.end();
+             ++it)
+            delete it->second;
+    }
+
+    const char *name() { return "CLOCKPRO"; }
+
+    void admit(BufDesp *desp)
+    {
+        unsigned long long key = keyOf(desp);
+        Node *node = new Node;
+        node->desp = desp;
+        node->key = key;
+        node->ref = false;
+
+        std::unordered_map<unsigned long long, Node *>::iterator it =
+            nodes_.find(key);
+        if (it != nodes_.end()) {
+            // 测试期内再访问，说明冷区太小
+            if (coldTarget_ + 1 < frames_) ++coldTarget_;
+            erase(it->second);
+            delete it->second;
+            --test_;
+            node->hot = true;
+            ++hot_;
+        } else {
+            node->hot = false;
+            ++cold_;
+        }
+        nodes_[key] = node;
+        desp->link = node;
+        insert(node);
+        coolDown();
+    }
+
+    void admitCold(BufDesp *desp)
+    {
+        unsigned long long key = keyOf(desp);
+        // 测试期内的非驻留节点直接丢弃，预读不说明冷区太小
+        std::unordered_map<unsigned long long, Node *>::iterator it =
+            nodes_.find(key);
+        if (it != nodes_.end()) {
+            erase(it->second);
+            delete it->second;
+            nodes_.erase(it);
+            --test_;
+        }
+
+        Node *node = new Node;
+        node->desp = desp;
+        node->key = key;
+        node->hot = false;
+        node->ref = false;
+        ++cold_;
+        nodes_[key] = node;
+        desp->link = node;
+        // 放在冷指针处，下一个被检查
+        if (handCold_ == NULL)
+            insert(node);
+        else {
+            insertBefore(node, handCold_);
+            handCold_ = node;
+        }
+    }
+
+    void access(BufDesp *desp) { ((Node *) desp->link)->ref = true; }
+
+    BufDesp *victim(Evictable evictable, void *arg)
+    {
+        // 转4圈，访问位全部清除、热页都已冷却，仍找不到说明都被借用
+        size_t budget = 4 * nodes_.size() + 1;
+        size_t skipped = 0; // 连续跳过的冷页
+        while (budget-- > 0 && hot_ + cold_ > 0) {
+            // 没有冷页，先冷却一个热页
+            if (cold_ == 0) {
+                runHandHot();
+                continue;
+            }
+
+            Node *node = handCold_;
+            handCold_ = node->next;
+            if (node->desp == NULL || node->hot) continue;
+            if (node->desp->untouch()) node->ref = true;
+
+            if (node->ref) {
+                // 测试期内被访问，变为热页
+                node->ref = false;
+                node->hot = true;
+                --cold_;
+                ++hot_;
+                coolDown();
+                skipped = 0;
+            } else if (!evictable(node->desp, arg)) {
+                // 冷页都被借用，冷却一个热页
+                if (++skipped >= cold_) {
+                    demote();
+                    skipped = 0;
+                }
+            } else {
+                // 淘汰，留下非驻留节点
+                BufDesp *desp = node->desp;
+                desp->link = NULL;
+                node->desp = NULL;
+                --cold_;
+                ++test_;
+                while (test_ > frames_)
+                    runHandTest();
+                return desp;
+            }
+        }
+        return NULL;
+    }
+
+    void remove(BufDesp *desp)
+    {
+        Node *node = (Node *) desp->link;
+        if (node->hot)
+            --hot_;
+        else
+            --cold_;
+        nodes_.erase(node->key);
+        erase(node);
+        delete node;
+        desp->link = NULL;
+    }
+
+  private:
+    // 插入到热指针之前，即时钟的头部
+    void insert(Node *node)
+    {
+        if (handHot_ == NULL) {
+            node->next = node->prev = node;
+            handHot_ = handCold_ = handTest_ = node;
+            return;
+        }
+        insertBefore(node, handHot_);
+    }
+    // 插入到at之前
+    void insertBefore(Node *node, Node *at)
+    {
+        node->next = at;
+        node->prev = at->prev;
+        node->prev->next = node;
+        at->prev = node;
+    }
+
+    // 从时钟上摘下，指向它的指针前移
+    void erase(Node *node)
+    {
+        Node *next = node->next == node ? NULL : node->next;
+        if (handHot_ == node) handHot_ = next;
+        if (handCold_ == node) handCold_ = next;
+        if (handTest_ == node) handTest_ = next;
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+    }
+
+    // 热页超出配额时冷却
+    void coolDown()
+    {
+        while (hot_ > 0 && hot_ + coldTarget_ > frames_)
+            runHandHot();
+    }
+
+    // 测试期结束，删除非驻留节点，冷区缩小
+    void expire(Node *node)
+    {
+        nodes_.erase(node->key);
+        erase(node);
+        delete node;
+        --test_;
+        if (coldTarget_ > 1) --coldTarget_;
+    }
+
+    // 热指针：清除热页访问位，未访问的热页变冷；经过的非驻留节点结束测试期
+    void runHandHot()
+    {
+        Node *node = handHot_;
+        handHot_ = node->next;
+        if (node->desp == NULL) {
+            expire(node);
+        } else if (node->hot) {
+            if (node->desp->untouch() || node->ref)
+                node->ref = false;
+            else {
+                node->hot = false;
+                --hot_;
+                ++cold_;
+            }
+        }
+    }
+
+    // 转动热指针直到一个热页变冷，访问位最多清除一圈
+    void demote()
+    {
+        size_t hot = hot_;
+        for (size_t n = 2 * nodes_.size(); hot_ == hot && hot_ > 0 && n > 0; --n)
+            runHandHot();
+    }
+
+    // 测试指针：删除下一个非驻留节点
+    void runHandTest()
+    {
+        for (;;) {
+            Node *node = handTest_;
+            handTest_ = node->next;
+            if (node->desp == NULL) {
+                expire(node);
+                return;
+            }
+        }
+    }
+};
+
+} // namespace
+
+Replacer *createReplacer(const char *name, size_t frames)
+{
+    if (strcmp(name, "LRU") == 0) return new LruReplacer;
+    if (strcmp(name, "2Q") == 0) return new TwoQReplacer(frames);
+    if (strcmp(name, "CLOCKPRO") == 0) return new ClockProReplacer(frames);
+    return NULL;
+}
+
+} // namespace db
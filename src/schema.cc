@@ -5,6 +5,7 @@
 #include <db/record.h>
 #include <db/file.h>
 #include <db/buffer.h>
+#include <db/key.h>
 
 namespace db {
 
@@ -49,8 +50,10 @@ void Schema::open()
     MetaBlock block;
     desp = buffer_->borrow(META_FILE, first_);
     block.attach(desp->buffer);
-    if (block.getMagic() != MAGIC_NUMBER)
+    if (block.getMagic() != MAGIC_NUMBER) {
         block.clear(0, first_, BLOCK_TYPE_META);
+        buffer_->writeBuf(desp);
+    }
 
     // 枚举所有slots，加载tablespace_
     unsigned short count = block.getSlots();
@@ -84,6 +87,11 @@ void Schema::open()
 int Schema::create(const char *table, RelationInfo &info)
 {
     if ((size_t) info.count != info.fields.size()) return EINVAL;
+    for (size_t i = 0; i < info.keys.size(); ++i)
+        if (info.keys[i] >= info.count) return EINVAL;
+    if (!info.keys.empty()) info.key = info.keys[0];
+    if (info.key >= info.count) return EINVAL;
+    initKey(info);
 
     // 先将info转化iov
     int total = info.iovSize();
@@ -107,14 +115,14 @@ int Schema::create(const char *table, RelationInfo &info)
     BufDesp *desp = buffer_->borrow(META_FILE, first_);
     meta.attach(desp->buffer);
     unsigned short length = (unsigned short) Record::size(iov);
-    std::pair<unsigned char *, bool> alloc_ret = meta.allocate(length, 0);
-    if (alloc_ret.first == NULL) {
+    unsigned char *alloc_ret = meta.allocate(length, 0);
+    if (alloc_ret == NULL) {
         // TODO: 再分配一个block
     }
 
     // 将关系信息写入buf，这里不需要排序，因为有tablespace_
     Record record;
-    record.attach(alloc_ret.first, length);
+    record.attach(alloc_ret, length);
     unsigned char header;
     htobe(iov);
     record.set(iov, &header);
@@ -146,6 +154,8 @@ int Schema::create(const char *table, RelationInfo &info)
     desp = buffer_->borrow(table, 1);
     data.attach(desp->buffer);
     data.clear(1, 1, BLOCK_TYPE_DATA);
+    data.setType(
+        BLOCK_TYPE_DATA | directoryWidth(&info) << BLOCK_DIRECTORY_SHIFT);
     buffer_->writeBuf(desp); // 写meta块
     data.detach();           // 分离超块指针
     desp->relref();          // 释放超块
@@ -203,6 +213,9 @@ void Schema::initIov(
         iov[7 + i * 4 + 3].iov_base = (void *) info.fields[i].type->name;
         iov[7 + i * 4 + 3].iov_len = strlen(info.fields[i].type->name) + 1;
     }
+    // 组合键的各域
+    iov[7 + info.count * 4].iov_base = info.keys.data();
+    iov[7 + info.count * 4].iov_len = info.keys.size() * sizeof(unsigned int);
 }
 void Schema::betoh(std::vector<struct iovec> &iov)
 {
@@ -232,6 +245,11 @@ void Schema::betoh(std::vector<struct iovec> &iov)
         l = (unsigned long long *) iov[7 + i * 4 + 2].iov_base;
         *l = be64toh(*l);
     }
+    // 组合键的各域
+    i = (unsigned int *) iov[7 + count * 4].iov_base;
+    size_t keys = iov[7 + count * 4].iov_len / sizeof(unsigned int);
+    for (size_t k = 0; k < keys; ++k)
+        i[k] = be32toh(i[k]);
 }
 void Schema::htobe(std::vector<struct iovec> &iov)
 {
@@ -261,6 +279,11 @@ void Schema::htobe(std::vector<struct iovec> &iov)
         l = (unsigned long long *) iov[7 + i * 4 + 2].iov_base;
         *l = htobe64(*l);
     }
+    // 组合键的各域
+    i = (unsigned int *) iov[7 + count * 4].iov_base;
+    size_t keys = iov[7 + count * 4].iov_len / sizeof(unsigned int);
+    for (size_t k = 0; k < keys; ++k)
+        i[k] = htobe32(i[k]);
 }
 
 void Schema::retrieveInfo(
@@ -310,15 +333,31 @@ void Schema::retrieveInfo(
 
         info.fields.push_back(field);
     }
+
+    // 组合键的各域，早先的元数据没有这一项
+    info.keys.clear();
+    if (iov.size() > 7 + count * 4) {
+        struct iovec &keys = iov[7 + count * 4];
+        info.keys.resize(keys.iov_len / sizeof(unsigned int));
+        for (size_t i = 0; i < info.keys.size(); ++i) {
+            unsigned int k;
+            ::memcpy(
+                &k,
+                (char *) keys.iov_base + i * sizeof(unsigned int),
+                sizeof(unsigned int));
+            info.keys[i] = be32toh(k);
+        }
+    }
+    initKey(info);
 }
 
-void dbInit(size_t bufsize)
+void dbInit(size_t bufsize, bool direct, const char *policy)
 {
     static bool inited = false;
     if (!inited) {
         // 初始化全局变量
-        kBuffer.init(&kFiles, bufsize);
-        kFiles.init(&kSchema);
+        kBuffer.init(&kFiles, bufsize, policy);
+        kFiles.init(&kSchema, direct);
         kSchema.init(&kBuffer);
     }
 }
@@ -0,0 +1,327 @@
+// 实现外排序
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <db/sort.h>
+#include <db/buffer.h>
+#include <db/record.h>
+#include <db/table.h>
+#include <db/key.h>
+
+namespace db {
+
+namespace {
+// 临时文件编号，同一张表可以同时有多个排序
+std::atomic<unsigned int> kSequence(0);
+
+// frame和run中的一项：2B记录长度，2B键长，编码后的键，记录，按8B对齐，
+// 记录长度为0表示本block结束
+const size_t ENTRY_HEADER = 2 * sizeof(unsigned short);
+
+inline size_t entrySize(unsigned short length, unsigned short keylen)
+{
+    return ALIGN_TO_SIZE(ENTRY_HEADER + keylen + length);
+}
+inline unsigned short entryLength(unsigned char *row)
+{
+    unsigned short length;
+    memcpy(&length, row, sizeof(unsigned short));
+    return length;
+}
+inline unsigned short entryKeyLength(unsigned char *row)
+{
+    unsigned short keylen;
+    memcpy(&keylen, row + sizeof(unsigned short), sizeof(unsigned short));
+    return keylen;
+}
+inline unsigned char *entryKey(unsigned char *row) { return row + ENTRY_HEADER; }
+inline unsigned char *entryRecord(unsigned char *row)
+{
+    return entryKey(row) + entryKeyLength(row);
+}
+inline size_t entryBytes(unsigned char *row)
+{
+    return ENTRY_HEADER + entryKeyLength(row) + entryLength(row);
+}
+} // namespace
+
+const size_t Sorter::DEFAULT_FRAMES;
+const size_t Sorter::MIN_FRAMES;
+
+Sorter::Sorter()
+    : table_(NULL)
+    , used_(0)
+    , offset_(0)
+    , length_(0)
+    , index_(0)
+    , merging_(false)
+    , pending_(false)
+    , error_(S_OK)
+{}
+
+int Sorter::open(Table *table, size_t frames)
+{
+    if (frames < MIN_FRAMES) return EINVAL;
+    close();
+    kBuffer.reserve(frames, frames_);
+    if (frames_.size() < MIN_FRAMES) {
+        kBuffer.unreserve(frames_);
+        return ENOMEM;
+    }
+    table_ = table;
+    return S_OK;
+}
+
+void Sorter::close()
+{
+    kBuffer.unreserve(frames_);
+    if (!path_.empty()) {
+        file_.close();
+        File::remove(path_.c_str());
+        path_.clear();
+    }
+    rows_.clear();
+    runs_.clear();
+    cursors_.clear();
+    tree_.clear();
+    used_ = offset_ = index_ = 0;
+    length_ = 0;
+    merging_ = pending_ = false;
+    error_ = S_OK;
+}
+
+int Sorter::add(std::vector<struct iovec> &iov)
+{
+    // 键先编码，之后的比较都是memcmp
+    size_t length = Record::size(iov);
+    key_.clear();
+    encodeKey(table_->info_, iov, key_);
+    if (ENTRY_HEADER + key_.size() + length > BLOCK_SIZE) return EINVAL;
+    size_t entry =
+        entrySize((unsigned short) length, (unsigned short) key_.size());
+
+    // 当前frame放不下换下一个，最后一个frame留作输出缓冲
+    if (offset_ + entry > BLOCK_SIZE) {
+        offset_ = 0;
+        if (++used_ == frames_.size() - 1) {
+            int ret = spill();
+            if (ret) return ret;
+        }
+    }
+
+    unsigned char *row = frames_[used_]->buffer + offset_;
+    unsigned short len = (unsigned short) length;
+    unsigned short keylen = (unsigned short) key_.size();
+    memcpy(row, &len, sizeof(unsigned short));
+    memcpy(row + sizeof(unsigned short), &keylen, sizeof(unsigned short));
+    memcpy(entryKey(row), key_.data(), keylen);
+    Record record;
+    record.attach(entryRecord(row), len);
+    unsigned char header = 0;
+    record.set(iov, &header);
+    rows_.push_back(row);
+    offset_ += entry;
+    return S_OK;
+}
+
+int Sorter::finish()
+{
+    // 全在内存中，不写临时文件
+    if (runs_.empty()) {
+        std::stable_sort(
+            rows_.begin(),
+            rows_.end(),
+            [this](unsigned char *x, unsigned char *y) { return less(x, y); });
+        index_ = 0;
+        return S_OK;
+    }
+
+    int ret;
+    if (!rows_.empty() && (ret = spill())) return ret;
+
+    // 每趟留一个frame作输出，合并成更长的run，直到frame够一趟合并
+    while (runs_.size() > frames_.size()) {
+        size_t fan = frames_.size() - 1;
+        std::vector<Run> merged;
+        for (size_t first = 0; first < runs_.size(); first += fan) {
+            size_t count = std::min(fan, runs_.size() - first);
+            if ((ret = start(first, count))) return ret;
+            Run run;
+            run.begin = length_;
+            size_t pos = 0;
+            while (cursors_[tree_[0]].row) {
+                if ((ret = emit(cursors_[tree_[0]].row, pos))) return ret;
+                if ((ret = advance())) return ret;
+            }
+            if (pos && (ret = flushOut(pos))) return ret;
+            run.end = length_;
+            merged.push_back(run);
+        }
+        runs_.swap(merged);
+    }
+
+    // 最后一趟边合并边输出
+    merging_ = true;
+    pending_ = false;
+    return start(0, runs_.size());
+}
+
+bool Sorter::next(std::vector<struct iovec> &iov)
+{
+    unsigned char *row;
+    if (error_) return false;
+    if (merging_) {
+        if (pending_ && (error_ = advance())) return false;
+        row = cursors_[tree_[0]].row;
+        pending_ = true;
+    } else
+        row = index_ < rows_.size() ? rows_[index_++] : NULL;
+    if (row == NULL) return false;
+
+    Record record;
+    record.attach(entryRecord(row), entryLength(row));
+    unsigned char header;
+    return record.ref(iov, &header);
+}
+
+int Sorter::source(std::vector<struct iovec> &iov, void *arg)
+{
+    Sorter *sorter = (Sorter *) arg;
+    if (sorter->next(iov)) return S_OK;
+    return sorter->error() ? sorter->error() : ENOENT;
+}
+
+bool Sorter::less(unsigned char *x, unsigned char *y)
+{
+    return compareKey(
+               entryKey(x), entryKeyLength(x), entryKey(y), entryKeyLength(y)) <
+           0;
+}
+
+int Sorter::spill()
+{
+    // 第一次写出时才建临时文件
+    if (path_.empty()) {
+        path_ = table_->name_ + "." + std::to_string(kSequence++) + ".sort";
+        int ret = file_.open(path_.c_str());
+        if (ret) {
+            path_.clear();
+            return ret;
+        }
+    }
+
+    std::stable_sort(
+        rows_.begin(),
+        rows_.end(),
+        [this](unsigned char *x, unsigned char *y) { return less(x, y); });
+    Run run;
+    run.begin = length_;
+    size_t pos = 0;
+    int ret;
+    for (size_t i = 0; i < rows_.size(); ++i)
+        if ((ret = emit(rows_[i], pos))) return ret;
+    if (pos && (ret = flushOut(pos))) return ret;
+    run.end = length_;
+    runs_.push_back(run);
+
+    rows_.clear();
+    used_ = offset_ = 0;
+    return S_OK;
+}
+
+int Sorter::emit(unsigned char *row, size_t &pos)
+{
+    size_t entry = entrySize(entryLength(row), entryKeyLength(row));
+    if (pos + entry > BLOCK_SIZE) {
+        int ret = flushOut(pos);
+        if (ret) return ret;
+    }
+    memcpy(frames_.back()->buffer + pos, row, entryBytes(row));
+    pos += entry;
+    return S_OK;
+}
+
+int Sorter::flushOut(size_t &pos)
+{
+    unsigned char *out = frames_.back()->buffer;
+    if (pos + sizeof(unsigned short) <= BLOCK_SIZE)
+        memset(out + pos, 0, sizeof(unsigned short));
+    int ret = file_.write(length_, (const char *) out, BLOCK_SIZE);
+    if (ret) return ret;
+    length_ += BLOCK_SIZE;
+    pos = 0;
+    return S_OK;
+}
+
+int Sorter::start(size_t first, size_t count)
+{
+    cursors_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        Cursor &cursor = cursors_[i];
+        cursor.offset = runs_[first + i].begin;
+        cursor.end = runs_[first + i].end;
+        cursor.buffer = frames_[i]->buffer;
+        cursor.pos = BLOCK_SIZE;
+        int ret = fetch(cursor);
+        if (ret) return ret;
+    }
+
+    // 内节点先放哨兵，各叶子依次比赛后哨兵全部被挤出
+    tree_.assign(count, -1);
+    for (size_t i = count; i > 0; --i)
+        adjust((int) i - 1);
+    return S_OK;
+}
+
+int Sorter::fetch(Cursor &cursor)
+{
+    for (;;) {
+        if (cursor.pos + sizeof(unsigned short) <= BLOCK_SIZE) {
+            unsigned char *row = cursor.buffer + cursor.pos;
+            unsigned short length = entryLength(row);
+            if (length) {
+                cursor.row = row;
+                cursor.pos += entrySize(length, entryKeyLength(row));
+                return S_OK;
+            }
+        }
+        cursor.row = NULL;
+        if (cursor.offset >= cursor.end) return S_OK; // run读完
+        int ret = file_.read(cursor.offset, (char *) cursor.buffer, BLOCK_SIZE);
+        if (ret) return ret;
+        cursor.offset += BLOCK_SIZE;
+        cursor.pos = 0;
+    }
+}
+
+int Sorter::advance()
+{
+    int s = tree_[0];
+    int ret = fetch(cursors_[s]);
+    adjust(s);
+    return ret;
+}
+
+void Sorter::adjust(int s)
+{
+    // 叶子i的父节点为(i+k)/2，每个内节点留下败者，胜者继续向上
+    size_t k = cursors_.size();
+    for (size_t t = (s + k) / 2; t > 0; t /= 2)
+        if (beats(tree_[t], s)) std::swap(s, tree_[t]);
+    tree_[0] = s;
+}
+
+bool Sorter::beats(int a, int b)
+{
+    if (a < 0) return true;
+    if (b < 0) return false;
+    unsigned char *x = cursors_[a].row;
+    unsigned char *y = cursors_[b].row;
+    if (x == NULL) return false;
+    if (y == NULL) return true;
+    // 键相等时编号小的run先出，保持加入的先后
+    if (less(x, y)) return true;
+    return !less(y, x) && a < b;
+}
+
+} // namespace db
@@ -1,20 +1,165 @@
 // 实现存储管理
+#include <algorithm>
 #include <db/table.h>
+#include <db/file.h>
+#include <db/key.h>
 
 namespace db {
 
+namespace {
+// 当前线程最外层的修改
+thread_local Table::WriteLatch *tWriting = NULL;
+
+// 顺序扫描预读窗口的上下限
+const unsigned int READAHEAD_MIN = 4;
+const unsigned int READAHEAD_MAX = 32;
+
+// 批量装载时每一层正在填充的节点
+// 节点填满后不立即新开，待上提的分隔键先记下，等下一个分隔键到来再开，
+// 这样不会留下只有最左指针的空索引节点
+struct LoadLevel
+{
+    BufDesp *desp;                  // 正在填充的节点，NULL表示有待上提的分隔键
+    DataBlock block;                // 映射desp
+    unsigned int prev;              // 上一个填满的节点
+    std::vector<unsigned char> key; // 待上提的分隔键
+    unsigned int child;             // 分隔键右侧的子节点，大端
+};
+
+// 分配一个节点并加排它闩
+void openLevel(Table *table, LoadLevel &level, unsigned short type)
+{
+    unsigned int blockid = table->allocate();
+    level.desp = kBuffer.borrow(table->id_, blockid);
+    Table::WriteLatch::hold(level.desp);
+    level.block.setTable(table);
+    level.block.attach(level.desp->buffer);
+    if (type == BLOCK_TYPE_INDEX) level.block.setIndexType(); // 数据块分配时已设好
+}
+
+// 节点填满，写回后放开
+void closeLevel(LoadLevel &level)
+{
+    kBuffer.writeBuf(level.desp);
+    kBuffer.releaseBuf(level.desp);
+    Table::WriteLatch::drop(level.desp);
+    level.block.detach();
+    level.desp = NULL;
+}
+
+// 向第index层追加分隔键rec，rec[1]为子节点id；left为下一层的第1个节点
+// 本层满时记下rec，下一个分隔键到来时以rec的子节点为最左指针新开节点，
+// 并把rec的键连同新节点上提
+void pushIndex(
+    Table *table,
+    std::vector<LoadLevel> &levels,
+    size_t index,
+    unsigned int left,
+    std::vector<struct iovec> &rec,
+    unsigned short limit)
+{
+    DataType *intType = findDataType("INT");
+    if (index == levels.size()) {
+        levels.push_back(LoadLevel());
+        openLevel(table, levels[index], BLOCK_TYPE_INDEX);
+        levels[index].block.setNext(left);
+        levels[index].block.appendRecord(rec, BLOCK_SIZE);
+        return;
+    }
+
+    if (levels[index].desp == NULL) {
+        std::vector<unsigned char> key;
+        key.swap(levels[index].key);
+        unsigned int child = levels[index].child;
+        intType->betoh(&child);
+        openLevel(table, levels[index], BLOCK_TYPE_INDEX);
+        levels[index].block.setNext(child);
+        levels[index].block.appendRecord(rec, BLOCK_SIZE);
+
+        unsigned int self = levels[index].block.getSelf();
+        intType->htobe(&self);
+        std::vector<struct iovec> up = {
+            {key.data(), key.size()}, {&self, sizeof(unsigned int)}};
+        pushIndex(table, levels, index + 1, levels[index].prev, up, limit);
+        return;
+    }
+
+    // 至少放2项，末尾补齐时才能向左兄弟借
+    unsigned short bound =
+        levels[index].block.getSlots() < 2 ? BLOCK_SIZE : limit;
+    if (levels[index].block.appendRecord(rec, bound)) return;
+
+    levels[index].prev = levels[index].block.getSelf();
+    closeLevel(levels[index]);
+    unsigned char *key = (unsigned char *) rec[0].iov_base;
+    levels[index].key.assign(key, key + rec[0].iov_len);
+    levels[index].child = *(unsigned int *) rec[1].iov_base;
+}
+
+// 装载结束，各层最后一个节点若尚未打开，从左兄弟借最后一项补齐
+void finishIndex(
+    Table *table,
+    std::vector<LoadLevel> &levels,
+    unsigned short limit)
+{
+    DataType *intType = findDataType("INT");
+    for (size_t i = 1; i < levels.size(); ++i) {
+        if (levels[i].desp) continue;
+
+        LoadLevel sibling;
+        sibling.desp = kBuffer.borrow(table->id_, levels[i].prev);
+        Table::WriteLatch::hold(sibling.desp);
+        sibling.block.setTable(table);
+        sibling.block.attach(sibling.desp->buffer);
+        DataType *type = keyType(table->info_);
+        std::vector<unsigned char> key(getKeyBytes(type));
+        unsigned int child;
+        std::vector<struct iovec> last = {
+            {key.data(), key.size()}, {&child, sizeof(unsigned int)}};
+        sibling.block.fetchRecord(sibling.block.getSlots() - 1, last);
+        sibling.block.removeRecord(last);
+        intType->betoh(&child);
+        closeLevel(sibling);
+
+        // 借来的子节点作最左指针，原待上提的分隔键放入，借来的键上提
+        std::vector<struct iovec> rec = {
+            {levels[i].key.data(), levels[i].key.size()},
+            {&levels[i].child, sizeof(unsigned int)}};
+        openLevel(table, levels[i], BLOCK_TYPE_INDEX);
+        levels[i].block.setNext(child);
+        levels[i].block.appendRecord(rec, BLOCK_SIZE);
+
+        unsigned int self = levels[i].block.getSelf();
+        intType->htobe(&self);
+        std::vector<struct iovec> up = {
+            {key.data(), last[0].iov_len}, {&self, sizeof(unsigned int)}};
+        pushIndex(table, levels, i + 1, levels[i].prev, up, limit);
+    }
+}
+} // namespace
+
 Table::BlockIterator::BlockIterator()
     : bufdesp(nullptr)
+    , intent(BORROW_NONE)
+    , from(0)
+    , to(0)
+    , window(0)
 {}
 Table::BlockIterator::~BlockIterator()
 {
-    if (bufdesp) kBuffer.releaseBuf(bufdesp);
+    if (bufdesp) kBuffer.releaseBuf(bufdesp, intent);
 }
 Table::BlockIterator::BlockIterator(const BlockIterator &other)
     : block(other.block)
     , bufdesp(other.bufdesp)
+    , intent(other.intent)
+    , from(other.from)
+    , to(other.to)
+    , window(other.window)
 {
-    if (bufdesp) bufdesp->addref();
+    if (bufdesp == nullptr) return;
+    bufdesp->addref();
+    if (intent == BORROW_READ) bufdesp->latch.lockShared();
 }
 
 // 前置操作
@@ -22,10 +167,20 @@ Table::BlockIterator &Table::BlockIterator::operator++()
 {
     if (block.buffer_ == nullptr) return *this;
     unsigned int blockid = block.getNext();
-    kBuffer.releaseBuf(bufdesp);
+    // 先放开当前block，持闩时不等待下一个block的闩
+    kBuffer.releaseBuf(bufdesp, intent);
+    bufdesp = nullptr;
     if (blockid) {
-        bufdesp = kBuffer.borrow(block.table_->name_.c_str(), blockid);
+        // 按消费速度调整窗口：追上了预读说明消费比读盘快
+        if (window) {
+            if (blockid < from || blockid > to)
+                window = READAHEAD_MIN;
+            else if (kBuffer.reading(block.table_->id_, blockid))
+                window = std::min(window * 2, READAHEAD_MAX);
+        }
+        bufdesp = kBuffer.borrow(block.table_->id_, blockid, intent);
         block.attach(bufdesp->buffer);
+        readahead();
     } else
         block.buffer_ = nullptr;
     return *this;
@@ -34,52 +189,194 @@ Table::BlockIterator &Table::BlockIterator::operator++()
 Table::BlockIterator Table::BlockIterator::operator++(int)
 {
     BlockIterator tmp(*this);
-    if (block.buffer_ == nullptr) return *this;
-    unsigned int blockid = block.getNext();
-    kBuffer.releaseBuf(bufdesp);
-    if (blockid) {
-        bufdesp = kBuffer.borrow(block.table_->name_.c_str(), blockid);
-        block.attach(bufdesp->buffer);
-    } else
-        block.buffer_ = nullptr;
+    ++*this;
     return tmp;
 }
 // 数据块指针
 DataBlock *Table::BlockIterator::operator->() { return &block; }
 void Table::BlockIterator::release()
 {
-    bufdesp->relref();
+    if (bufdesp) kBuffer.releaseBuf(bufdesp, intent);
+    bufdesp = nullptr;
     block.detach();
 }
 
+void Table::BlockIterator::readahead()
+{
+    if (window == 0) return;
+    unsigned int self = block.getSelf();
+    unsigned int next = block.getNext();
+    bool inside = next >= from && next <= to;
+    if (next == 0 || (inside && to - next >= window / 2))
+        return; // 窗口里还剩一半以上
+
+    Table *table = block.table_;
+    if (next != self + 1) {
+        // 链不连续，只预读下一个
+        if (inside) return;
+        kBuffer.prefetch(table->id_, next, true);
+        from = to = next;
+    } else {
+        // 链连续，预读一个窗口，接着已预读的部分往后读
+        unsigned int first = inside ? to + 1 : next;
+        unsigned int last = std::min(
+            next + window - 1, std::max(table->maxid_, next));
+        for (unsigned int id = first; id <= last; ++id)
+            if (kBuffer.prefetch(table->id_, id, true)) break;
+        from = next;
+        to = inside ? std::max(to, last) : last;
+    }
+    kBuffer.flush();
+}
+
+Table::ScanIterator::ScanIterator()
+    : index(0)
+    , bounded(false)
+    , prefix(false)
+{}
+
+Table::ScanIterator &Table::ScanIterator::operator++()
+{
+    if (end()) return *this;
+    ++index;
+    settle();
+    return *this;
+}
+
+void Table::ScanIterator::release()
+{
+    blocks.release();
+    record.detach();
+}
+
+void Table::ScanIterator::settle()
+{
+    // 当前叶节点取完，沿next链找下一个非空的叶节点
+    while (!blocks.block.refslots(index, record)) {
+        ++blocks;
+        index = 0;
+        if (end()) {
+            record.detach();
+            return;
+        }
+    }
+    if (!bounded) return;
+
+    RelationInfo *info = blocks.block.table_->info_;
+    DataType *type = keyType(info);
+    unsigned char *pkey;
+    unsigned int klen;
+    refKey(info, record, key, &pkey, &klen);
+    // 前缀扫描只比较与上界等长的前缀
+    if (prefix) klen = std::min(klen, (unsigned int) high.size());
+    if (type->less(&high[0], (unsigned int) high.size(), pkey, klen))
+        release(); // 越过上界
+}
+
+Table::WriteLatch::WriteLatch(Table *table)
+    : table_(NULL)
+{
+    if (tWriting) return; // 嵌套
+    table->info_->latch.lock();
+    table_ = table;
+    tWriting = this;
+}
+
+Table::WriteLatch::~WriteLatch()
+{
+    if (table_ == NULL) return;
+    for (size_t i = 0; i < held_.size(); ++i)
+        kBuffer.releaseBuf(held_[i], BORROW_WRITE);
+    tWriting = NULL;
+    table_->info_->latch.unlock();
+}
+
+bool Table::WriteLatch::active() { return tWriting != NULL; }
+
+bool Table::WriteLatch::hold(BufDesp *desp)
+{
+    if (tWriting == NULL) return false;
+    std::vector<BufDesp *> &held = tWriting->held_;
+    if (std::find(held.begin(), held.end(), desp) != held.end()) return false;
+    desp->latch.lock();
+    desp->addref(); // 闩释放前一直钉住
+    held.push_back(desp);
+    return true;
+}
+
+void Table::WriteLatch::drop(BufDesp *desp)
+{
+    if (tWriting == NULL) return;
+    std::vector<BufDesp *> &held = tWriting->held_;
+    std::vector<BufDesp *>::iterator it =
+        std::find(held.begin(), held.end(), desp);
+    if (it == held.end()) return;
+    held.erase(it);
+    kBuffer.releaseBuf(desp, BORROW_WRITE);
+}
+
+size_t Table::WriteLatch::mark()
+{
+    return tWriting ? tWriting->held_.size() : 0;
+}
+
+void Table::WriteLatch::dropTo(size_t mark)
+{
+    if (tWriting == NULL) return;
+    std::vector<BufDesp *> &held = tWriting->held_;
+    while (held.size() > mark) {
+        kBuffer.releaseBuf(held.back(), BORROW_WRITE);
+        held.pop_back();
+    }
+}
+
 int Table::open(const char *name)
 {
     // 查找table
     std::pair<Schema::TableSpace::iterator, bool> bret = kSchema.lookup(name);
     if (!bret.second) return EEXIST; // 表不存在
 
+    // 打开表文件
+    File *file = kFiles.open(name);
+    if (file == NULL) return EFAULT;
+
     // 填充结构
     name_ = name;
+    id_ = file->id_;
     info_ = &bret.first->second;
 
     // 加载超块
     SuperBlock super;
-    BufDesp *desp = kBuffer.borrow(name, 0);
+    int intent = WriteLatch::readIntent();
+    BufDesp *desp = kBuffer.borrow(id_, 0, intent);
     super.attach(desp->buffer);
 
     // 获取元数据
+    unsigned int version = super.getVersion();
     maxid_ = super.getMaxid();
     idle_ = super.getIdle();
     first_ = super.getFirst();
 
     // 释放超块
     super.detach();
-    desp->relref();
+    kBuffer.releaseBuf(desp, intent);
+    // 旧格式的整数键按无符号序排列，按现在的比较会查不到记录
+    if (version != FORMAT_VERSION) return ENOTSUP;
     return S_OK;
 }
 
+bool Table::mapped()
+{
+    File *file = kFiles.get(id_);
+    return file && file->mapped();
+}
+
 unsigned int Table::allocate()
 {
+    // 映射区只读，修改超块会写到映射区上
+    if (mapped()) return 0;
+    WriteLatch latch(this);
+
     // 空闲链上有block
     DataBlock data;
     SuperBlock super;
@@ -87,14 +384,16 @@ unsigned int Table::allocate()
 
     if (idle_) {
         // 读idle块，获得下一个空闲块
-        desp = kBuffer.borrow(name_.c_str(), idle_);
+        desp = kBuffer.borrow(id_, idle_);
+        WriteLatch::hold(desp);
         data.attach(desp->buffer);
         unsigned int next = data.getNext();
         data.detach();
         desp->relref();
 
-        // 读超块，设定空闲块
-        desp = kBuffer.borrow(name_.c_str(), 0);
+        // 读超块，设定空闲块，改完即放开
+        desp = kBuffer.borrow(id_, 0);
+        bool held = WriteLatch::hold(desp);
         super.attach(desp->buffer);
         super.setIdle(next);
         super.setIdleCounts(super.getIdleCounts() - 1);
@@ -103,13 +402,18 @@ unsigned int Table::allocate()
         super.detach();
         kBuffer.writeBuf(desp);
         desp->relref();
+        if (held) WriteLatch::drop(desp);
 
         unsigned int current = idle_;
         idle_ = next;
 
-        desp = kBuffer.borrow(name_.c_str(), current);
+        desp = kBuffer.borrow(id_, current);
+        WriteLatch::hold(desp);
         data.attach(desp->buffer);
         data.clear(1, current, BLOCK_TYPE_DATA);
+        data.setTable(this);
+        data.setDataType();
+        kBuffer.writeBuf(desp);
         desp->relref();
 
         return current;
@@ -117,8 +421,9 @@ unsigned int Table::allocate()
 
     // 没有空闲块
     ++maxid_;
-    // 读超块，设定空闲块
-    desp = kBuffer.borrow(name_.c_str(), 0);
+    // 读超块，设定空闲块，改完即放开
+    desp = kBuffer.borrow(id_, 0);
+    bool held = WriteLatch::hold(desp);
     super.attach(desp->buffer);
     super.setMaxid(maxid_);
     super.setDataCounts(super.getDataCounts() + 1);
@@ -126,10 +431,15 @@ unsigned int Table::allocate()
     super.detach();
     kBuffer.writeBuf(desp);
     desp->relref();
+    if (held) WriteLatch::drop(desp);
     // 初始化数据块
-    desp = kBuffer.borrow(name_.c_str(), maxid_);
+    desp = kBuffer.borrow(id_, maxid_);
+    WriteLatch::hold(desp);
     data.attach(desp->buffer);
     data.clear(1, maxid_, BLOCK_TYPE_DATA);
+    data.setTable(this);
+    data.setDataType();
+    kBuffer.writeBuf(desp);
     desp->relref();
 
     return maxid_;
@@ -137,9 +447,13 @@ unsigned int Table::allocate()
 
 void Table::deallocate(unsigned int blockid)
 {
+    if (mapped()) return;
+    WriteLatch latch(this);
+
     // 读idle块，获得下一个空闲块
     DataBlock data;
-    BufDesp *desp = kBuffer.borrow(name_.c_str(), blockid);
+    BufDesp *desp = kBuffer.borrow(id_, blockid);
+    WriteLatch::hold(desp);
     data.attach(desp->buffer);
     data.setNext(idle_);
     data.setChecksum();
@@ -147,9 +461,10 @@ void Table::deallocate(unsigned int blockid)
     kBuffer.writeBuf(desp);
     desp->relref();
 
-    // 读超块，设定空闲块
+    // 读超块，设定空闲块，改完即放开
     SuperBlock super;
-    desp = kBuffer.borrow(name_.c_str(), 0);
+    desp = kBuffer.borrow(id_, 0);
+    bool held = WriteLatch::hold(desp);
     super.attach(desp->buffer);
     super.setIdle(blockid);
     super.setIdleCounts(super.getIdleCounts() + 1);
@@ -158,6 +473,7 @@ void Table::deallocate(unsigned int blockid)
     super.detach();
     kBuffer.writeBuf(desp);
     desp->relref();
+    if (held) WriteLatch::drop(desp);
 
     // 设定自己
     idle_ = blockid;
@@ -167,143 +483,269 @@ Table::BlockIterator Table::beginblock()
 {
     // 通过超块找到第1个数据块的id
     BlockIterator bi;
-    bi.block.table_ = this;
+    bi.block.setTable(this);
 
     // 获取第1个blockid
-    BufDesp *bd = kBuffer.borrow(name_.c_str(), 0);
+    bi.intent = WriteLatch::readIntent();
+    BufDesp *bd = kBuffer.borrow(id_, 0, bi.intent);
     SuperBlock super;
     super.attach(bd->buffer);
     unsigned int blockid = super.getFirst();
-    kBuffer.releaseBuf(bd);
+    kBuffer.releaseBuf(bd, bi.intent);
 
-    bi.bufdesp = kBuffer.borrow(name_.c_str(), blockid);
+    // 只读映射时提示顺序扫描
+    File *file = kFiles.get(id_);
+    if (file) file->advise(File::ADVICE_SEQUENTIAL);
+
+    bi.bufdesp = kBuffer.borrow(id_, blockid, bi.intent);
     bi.block.attach(bi.bufdesp->buffer);
+    if (kBuffer.async()) {
+        bi.window = READAHEAD_MIN;
+        bi.readahead();
+    }
     return bi;
 }
 
 Table::BlockIterator Table::endblock()
 {
     BlockIterator bi;
-    bi.block.table_ = this;
+    bi.block.setTable(this);
     return bi;
 }
 
-unsigned int Table::locate(void *keybuf, unsigned int len)
+Table::ScanIterator Table::scan(
+    void *low,
+    unsigned int lowLen,
+    void *high,
+    unsigned int highLen)
 {
-    unsigned int key = info_->key;
-    DataType *type = info_->fields[key].type;
-
-    BlockIterator prev = beginblock();
-    for (BlockIterator bi = beginblock(); bi != endblock(); ++bi) {
-        // 获取第1个记录
-        Record record;
-        bi->refslots(0, record);
-
-        // 与参数比较
-        unsigned char *pkey;
-        unsigned int klen;
-        record.refByIndex(&pkey, &klen, key);
-        bool bret = type->less(pkey, klen, (unsigned char *) keybuf, len);
-        if (bret) {
-            prev = bi;
-            continue;
-        }
-        // 要排除相等的情况
-        bret = type->less((unsigned char *) keybuf, len, pkey, klen);
-        if (bret)
-            return prev->getSelf();
-        else
-            return bi->getSelf(); // 相等
+    ScanIterator si;
+    if (high) {
+        si.bounded = true;
+        si.high.assign((unsigned char *) high, (unsigned char *) high + highLen);
+    }
+
+    BlockIterator &bi = si.blocks;
+    bi.block.setTable(this);
+    bi.intent = WriteLatch::readIntent();
+    if (low) {
+        // 下降到low所在的叶节点，从下界处开始
+        DataBlock leaf;
+        leaf.setTable(this);
+        bi.bufdesp = leaf.descend(low, lowLen, bi.intent);
+        bi.block.attach(bi.bufdesp->buffer);
+        si.index = bi.block.searchRecord(low, lowLen);
+    } else {
+        BufDesp *bd = kBuffer.borrow(id_, 0, bi.intent);
+        SuperBlock super;
+        super.attach(bd->buffer);
+        unsigned int blockid = super.getFirst();
+        kBuffer.releaseBuf(bd, bi.intent);
+        bi.bufdesp = kBuffer.borrow(id_, blockid, bi.intent);
+        bi.block.attach(bi.bufdesp->buffer);
     }
-    return prev->getSelf();
+
+    // 之后沿next链顺序读
+    File *file = kFiles.get(id_);
+    if (file) file->advise(File::ADVICE_SEQUENTIAL);
+    if (kBuffer.async()) {
+        bi.window = READAHEAD_MIN;
+        bi.readahead();
+    }
+    si.settle();
+    return si;
+}
+
+Table::ScanIterator Table::scanPrefix(void *prefix, unsigned int len)
+{
+    // 从前缀处下降，键不再以前缀开头时结束；空前缀即全表
+    if (len == 0) return scan(NULL, 0);
+    // 只有按字节比较的键才有前缀，整数键的比较按键长读，短前缀会越界
+    DataType *type = keyType(info_);
+    if (!type->byteComparable && (ptrdiff_t) len != type->size)
+        return ScanIterator();
+    ScanIterator si = scan(prefix, len);
+    si.bounded = si.prefix = true;
+    si.high.assign((unsigned char *) prefix, (unsigned char *) prefix + len);
+    if (!si.end()) si.settle();
+    return si;
+}
+
+unsigned int Table::locate(void *keybuf, unsigned int len)
+{
+    int intent = WriteLatch::readIntent();
+
+    // 经由索引下降到叶节点，没有索引时即为第1个数据块
+    DataBlock data;
+    data.setTable(this);
+    BufDesp *bd = data.descend(keybuf, len, intent);
+    data.attach(bd->buffer);
+    unsigned int blockid = data.getSelf();
+    kBuffer.releaseBuf(bd, intent);
+    return blockid;
 }
 
 int Table::insert(unsigned int blkid, std::vector<struct iovec> &iov)
 {
+    if (mapped()) return EROFS;
+    WriteLatch latch(this);
     DataBlock data;
     SuperBlock super;
     data.setTable(this);
 
     // 从buffer中借用
-    BufDesp *bd = kBuffer.borrow(name_.c_str(), blkid);
+    BufDesp *bd = kBuffer.borrow(id_, blkid);
+    bool held = WriteLatch::hold(bd);
     data.attach(bd->buffer);
     // 尝试插入
     std::pair<bool, unsigned short> ret = data.insertRecord(iov);
-    if (ret.first) {
-        kBuffer.releaseBuf(bd); // 释放buffer
-        // 修改表头统计
-        bd = kBuffer.borrow(name_.c_str(), 0);
-        super.attach(bd->buffer);
-        super.setRecords(super.getRecords() + 1);
-        bd->relref();
-        return S_OK; // 插入成功
-    } else if (ret.second == (unsigned short) -1) {
-        kBuffer.releaseBuf(bd); // 释放buffer
-        return EEXIST;          // key已经存在
+    if (ret.first) kBuffer.writeBuf(bd);
+    kBuffer.releaseBuf(bd); // 释放buffer
+    if (!ret.first) {
+        if (held) WriteLatch::drop(bd); // 没有修改，不再持闩
+        if (ret.second == (unsigned short) -1) return EEXIST; // key已经存在
+
+        // 放不下，由DataBlock::insert分裂，分隔键上提到索引，locate只需下降
+        DataBlock tree;
+        tree.setTable(this);
+        int r = tree.insert(iov);
+        if (r == EFAULT) return EEXIST; // 键在别的block中已存在
+        if (r) return r;
     }
 
-    // 分裂block
-    unsigned short insert_position = ret.second;
-    std::pair<unsigned short, bool> split_position =
-        data.splitPosition(Record::size(iov), insert_position);
-    // 先分配一个block
-    DataBlock next;
-    next.setTable(this);
-    blkid = allocate();
-    BufDesp *bd2 = kBuffer.borrow(name_.c_str(), blkid);
-    next.attach(bd2->buffer);
-
-    // 移动记录到新的block上
-    while (data.getSlots() > split_position.first) {
-        Record record;
-        data.refslots(split_position.first, record);
-        next.copyRecord(record);
-        data.deallocate(split_position.first);
-    }
-    // 插入新记录，不需要再重排顺序
-    if (split_position.second)
-        data.insertRecord(iov);
-    else
-        next.insertRecord(iov);
-    // 维持数据链
-    next.setNext(data.getNext());
-    data.setNext(next.getSelf());
-    bd2->relref();
-
-    bd = kBuffer.borrow(name_.c_str(), 0);
+    // 修改表头统计
+    bd = kBuffer.borrow(id_, 0);
+    WriteLatch::hold(bd);
     super.attach(bd->buffer);
     super.setRecords(super.getRecords() + 1);
+    kBuffer.writeBuf(bd);
     bd->relref();
     return S_OK;
 }
 
+int Table::bulkLoad(RowSource source, void *arg, double fill)
+{
+    if (fill <= 0 || fill > 1) return EINVAL;
+    if (mapped()) return EROFS;
+    WriteLatch latch(this);
+
+    DataType *type = keyType(info_);
+    DataType *intType = findDataType("INT");
+    unsigned short limit = (unsigned short) (fill * (BLOCK_SIZE -
+                                                     sizeof(DataHeader) -
+                                                     sizeof(Trailer)));
+
+    SuperBlock super;
+    BufDesp *sd = kBuffer.borrow(id_, 0);
+    WriteLatch::hold(sd);
+    super.attach(sd->buffer);
+
+    // 表须为空：没有记录，数据链上只有第1个空块，也没有索引
+    std::vector<LoadLevel> levels(1);
+    levels[0].desp = kBuffer.borrow(id_, first_);
+    WriteLatch::hold(levels[0].desp);
+    levels[0].block.setTable(this);
+    levels[0].block.attach(levels[0].desp->buffer);
+    if (super.getRecords() || levels[0].block.getSlots() ||
+        levels[0].block.getNext() ||
+        (super.getRoot() && super.getRoot() != first_)) {
+        kBuffer.releaseBuf(levels[0].desp);
+        kBuffer.releaseBuf(sd);
+        return EEXIST;
+    }
+
+    std::vector<struct iovec> iov(info_->count);
+    std::vector<unsigned char> last; // 上一条记录的键
+    std::vector<unsigned char> buf;  // 组合键的编码
+    long long count = 0;
+    int ret;
+    while ((ret = source(iov, arg)) == S_OK) {
+        struct iovec key = keyOf(info_, iov, buf);
+        unsigned char *pkey = (unsigned char *) key.iov_base;
+        unsigned int klen = (unsigned int) key.iov_len;
+        if (!last.empty() &&
+            !type->less(&last[0], (unsigned int) last.size(), pkey, klen)) {
+            ret = EINVAL; // 键没有严格递增
+            break;
+        }
+
+        // 空叶节点总能放下第1条记录，不受填充率限制
+        unsigned short bound =
+            levels[0].block.getSlots() ? limit : BLOCK_SIZE;
+        if (!levels[0].block.appendRecord(iov, bound)) {
+            if (levels[0].block.getSlots() == 0) {
+                ret = EINVAL; // 整个block也放不下
+                break;
+            }
+            // 叶节点满，新叶节点接在数据链上
+            unsigned int old = levels[0].block.getSelf();
+            LoadLevel next;
+            openLevel(this, next, BLOCK_TYPE_DATA);
+            levels[0].block.setNext(next.block.getSelf());
+            closeLevel(levels[0]);
+            levels[0] = next;
+            if (!levels[0].block.appendRecord(iov, BLOCK_SIZE)) {
+                ret = EINVAL; // 整个block也放不下
+                break;
+            }
+
+            // 上一个键与新叶节点第1个键之间最短的键作为分隔键
+            unsigned int child = levels[0].block.getSelf();
+            intType->htobe(&child);
+            std::vector<struct iovec> rec = {
+                {pkey,
+                 type->shorten(&last[0], (unsigned int) last.size(), pkey, klen)},
+                {&child, sizeof(unsigned int)}};
+            pushIndex(this, levels, 1, old, rec, limit);
+        }
+        last.assign(pkey, pkey + klen);
+        ++count;
+    }
+    if (ret == ENOENT) ret = S_OK; // 取完
+
+    // 最上一层只有一个节点，即为根
+    finishIndex(this, levels, limit);
+    unsigned int root = levels.back().block.getSelf();
+    for (size_t i = 0; i < levels.size(); ++i)
+        closeLevel(levels[i]);
+
+    super.setRoot(root);
+    super.setRecords(count);
+    kBuffer.writeBuf(sd);
+    kBuffer.releaseBuf(sd);
+    return ret;
+}
+
 size_t Table::recordCount()
 {
-    BufDesp *bd = kBuffer.borrow(name_.c_str(), 0);
+    int intent = WriteLatch::readIntent();
+    BufDesp *bd = kBuffer.borrow(id_, 0, intent);
     SuperBlock super;
     super.attach(bd->buffer);
     size_t count = super.getRecords();
-    kBuffer.releaseBuf(bd);
+    kBuffer.releaseBuf(bd, intent);
     return count;
 }
 
 unsigned int Table::dataCount()
 {
-    BufDesp *bd = kBuffer.borrow(name_.c_str(), 0);
+    int intent = WriteLatch::readIntent();
+    BufDesp *bd = kBuffer.borrow(id_, 0, intent);
     SuperBlock super;
     super.attach(bd->buffer);
     unsigned int count = super.getDataCounts();
-    kBuffer.releaseBuf(bd);
+    kBuffer.releaseBuf(bd, intent);
     return count;
 }
 
 unsigned int Table::idleCount()
 {
-    BufDesp *bd = kBuffer.borrow(name_.c_str(), 0);
+    int intent = WriteLatch::readIntent();
+    BufDesp *bd = kBuffer.borrow(id_, 0, intent);
     SuperBlock super;
     super.attach(bd->buffer);
     unsigned int count = super.getIdleCounts();
-    kBuffer.releaseBuf(bd);
+    kBuffer.releaseBuf(bd, intent);
     return count;
 }
 
@@ -1,5 +1,6 @@
 // 实现时辍
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <string>
 #include <db/timestamp.h>
@@ -14,7 +15,11 @@ bool TimeStamp::toString(char *buffer, size_t size) const
     int ms = (int)
             (std::chrono::duration_cast<std::chrono::microseconds>(stamp_.time_since_epoch()).count() % 1000000);
     tmt = std::chrono::system_clock::to_time_t(stamp_);
+#if defined(WIN32)
     localtime_s(&tm, &tmt);
+#else
+    localtime_r(&tmt, &tm);
+#endif
     int ret = snprintf(
         buffer,
         size,
@@ -0,0 +1,100 @@
+// 测试异步io
+#include "../catch.hpp"
+#include <string.h>
+#include <db/aio.h>
+#include <db/file.h>
+using namespace db;
+
+namespace {
+// 写4个block，再异步读回比较
+void roundtrip(AsyncIO &aio, File &file)
+{
+    static char wbuf[4][4096];
+    static char rbuf[4][4096];
+    for (int i = 0; i < 4; ++i)
+        memset(wbuf[i], 'a' + i, sizeof(wbuf[i]));
+
+    for (long i = 0; i < 4; ++i) {
+        int ret = aio.submit(&file, i * 4096, wbuf[i], 4096, true, (void *) i);
+        REQUIRE(ret == S_OK);
+    }
+    REQUIRE(aio.flush() == S_OK);
+    int mask = 0;
+    void *tag;
+    int result;
+    while (aio.complete(&tag, &result, true)) {
+        REQUIRE(result == S_OK);
+        mask |= 1 << (long) tag;
+    }
+    REQUIRE(mask == 0xf);
+    REQUIRE(aio.inflight() == 0);
+
+    // 第5个block超出文件尾，应清零
+    memset(rbuf, 0xff, sizeof(rbuf));
+    for (long i = 0; i < 4; ++i)
+        aio.submit(&file, (i + 1) * 4096, rbuf[i], 4096, false, (void *) i);
+    aio.flush();
+    mask = 0;
+    while (aio.complete(&tag, &result, true)) {
+        REQUIRE(result == S_OK);
+        mask |= 1 << (long) tag;
+    }
+    REQUIRE(mask == 0xf);
+    for (int i = 0; i < 3; ++i)
+        REQUIRE(memcmp(rbuf[i], wbuf[i + 1], 4096) == 0);
+    for (int i = 0; i < 4096; ++i)
+        REQUIRE(rbuf[3][i] == 0);
+}
+} // namespace
+
+TEST_CASE("db/aio.h", "[p1][p2]")
+{
+    SECTION("aio")
+    {
+        File file;
+        REQUIRE(file.open("aio.db") == S_OK);
+        AsyncIO aio;
+        REQUIRE(aio.init(8) == S_OK);
+        roundtrip(aio, file);
+        file.close();
+        File::remove("aio.db");
+    }
+
+    SECTION("pool")
+    {
+        // 队列深度为0时io_uring初始化失败，退化为线程池
+        File file;
+        REQUIRE(file.open("aio.db") == S_OK);
+        AsyncIO aio;
+        REQUIRE(aio.init(0, 2) == S_OK);
+        REQUIRE(!aio.uring());
+        roundtrip(aio, file);
+        file.close();
+        File::remove("aio.db");
+    }
+
+    SECTION("file")
+    {
+        File file;
+        REQUIRE(file.open("aio.db") == S_OK);
+
+        const char *hello = "hello, world\n";
+        REQUIRE(file.submitWrite(0, hello, strlen(hello), &file) == S_OK);
+        void *tag = NULL;
+        int result = -1;
+        REQUIRE(File::complete(&tag, &result, true));
+        REQUIRE(tag == &file);
+        REQUIRE(result == S_OK);
+
+        char buffer[20];
+        REQUIRE(file.submitRead(0, buffer, sizeof(buffer), buffer) == S_OK);
+        REQUIRE(File::complete(&tag, &result, true));
+        REQUIRE(tag == buffer);
+        REQUIRE(result == S_OK);
+        REQUIRE(strncmp(buffer, hello, strlen(hello)) == 0);
+        REQUIRE(buffer[strlen(hello)] == 0);
+
+        file.close();
+        File::remove("aio.db");
+    }
+}
@@ -4,6 +4,9 @@
 #include <db/buffer.h>
 #include <db/file.h>
 #include <db/table.h>
+#include <db/key.h>
+#include <atomic>
+#include <thread>
 
 #define SHORT_ADDR "The Old Schools, Trinity Ln, Cambridge CB2 1TN, UK"
 #define LONG_ADDR "1234 Elm Street, Apartment 567, Willow Creek Meadows, Suite 890, Northwood Heights, Building 1011, Block A, Pineview Avenue, Tower 12, Oakwood Plaza, Unit 3456, Maple Ridge, Floor 7, Birchwood Lane, Lot 8910, Cedar Valley, Villa 12345, Redwood Grove, Estate 6789, Magnolia Court, Manor 2468, Sunflower Circle, Crescent 13579, Rosewood Lane, Garden 369, Lily Pond, Terrace 2468, Juniper Way, Cove 1011, Aspen Ridge, Chalet 7890, Birch Hill, Lodge 5678, Cedar Lane, Cabin 1234, Pinecrest, Retreat 5678, Willowbrook, Haven 9101, Oakdale, Sanctuary 2345, Maplewood, Oasis 6789, Birchwood, Paradise 1011, Cedarwood, Hideaway 1213, Pineview, Serenity 1415, Redwood, Tranquility 1617, Magnolia, Peaceful Place 1819, Sunflower, Blissful Haven 2021, Rosewood, Harmony House 2223, Lily, Calm Corner 2425, Juniper, Quiet Retreat 2627, Aspen, Zen Garden 2829, Birch, Solitude 3031, Cedar, Relaxation Retreat 3233, Pine, Serene Spot 3435."
@@ -52,6 +55,7 @@ TEST_CASE("db/block.h")
 
         unsigned int idle = super.getIdle();
         REQUIRE(idle == 0);
+        REQUIRE(super.getVersion() == FORMAT_VERSION);
 
         TimeStamp ts = super.getTimeStamp();
         char tb[64];
@@ -134,8 +138,8 @@ TEST_CASE("db/block.h")
         data.clear(1, 3, BLOCK_TYPE_DATA);
 
         // 分配8字节
-        std::pair<unsigned char *, bool> alloc_ret = data.allocate(8, 0);
-        REQUIRE(alloc_ret.first == buffer + sizeof(DataHeader));
+        unsigned char *alloc_ret = data.allocate(8, 0);
+        REQUIRE(alloc_ret == buffer + sizeof(DataHeader));
         REQUIRE(data.getFreeSpace() == sizeof(DataHeader) + 8);
         REQUIRE(
             data.getFreeSize() ==
@@ -161,7 +165,7 @@ TEST_CASE("db/block.h")
 
         // 分配5字节
         alloc_ret = data.allocate(5, 0);
-        REQUIRE(alloc_ret.first == buffer + sizeof(DataHeader) + 8);
+        REQUIRE(alloc_ret == buffer + sizeof(DataHeader) + 8);
         REQUIRE(data.getFreeSpace() == sizeof(DataHeader) + 2 * 8);
         REQUIRE(
             data.getFreeSize() ==
@@ -185,7 +189,7 @@ TEST_CASE("db/block.h")
 
         // 分配711字节
         alloc_ret = data.allocate(711, 0);
-        REQUIRE(alloc_ret.first == buffer + sizeof(DataHeader) + 8 * 2);
+        REQUIRE(alloc_ret == buffer + sizeof(DataHeader) + 8 * 2);
         REQUIRE(data.getFreeSpace() == sizeof(DataHeader) + 2 * 8 + 712);
         REQUIRE(
             data.getFreeSize() ==
@@ -237,10 +241,11 @@ TEST_CASE("db/block.h")
         REQUIRE(
             (unsigned char *) pslots ==
             buffer + BLOCK_SIZE - sizeof(int) - 2 * sizeof(Slot));
-        REQUIRE(be16toh(pslots[0].offset) == sizeof(DataHeader));
-        REQUIRE(be16toh(pslots[0].length) == 8);
-        REQUIRE(be16toh(pslots[1].offset) == sizeof(DataHeader) + 8);
-        REQUIRE(be16toh(pslots[1].length) == 712);
+        // 记录前移，slots[]的顺序不变
+        REQUIRE(be16toh(pslots[0].offset) == sizeof(DataHeader) + 8);
+        REQUIRE(be16toh(pslots[0].length) == 712);
+        REQUIRE(be16toh(pslots[1].offset) == sizeof(DataHeader));
+        REQUIRE(be16toh(pslots[1].length) == 8);
         REQUIRE(data.getTrailerSize() == 16);
 
         record.attach(buffer + sizeof(DataHeader) + 8, 8);
@@ -248,7 +253,7 @@ TEST_CASE("db/block.h")
 
         // 回收第3个空间
         size = data.getFreeSize();
-        data.deallocate(1);
+        data.deallocate(0);
         REQUIRE(data.getFreeSize() == size + 712 + 8);
         record.attach(buffer + sizeof(DataHeader) + 8, 8);
         REQUIRE(!record.isactive());
@@ -304,7 +309,7 @@ TEST_CASE("db/block.h")
         type->htobe(&id);
         iov[0].iov_base = &id;
         iov[0].iov_len = 8;
-        iov[1].iov_base = "John Carter ";
+        iov[1].iov_base = (void *) "John Carter ";
         iov[1].iov_len = 12;
         const char *addr = "(323) 238-0693"
                            "909 - 1/2 E 49th St"
@@ -314,10 +319,10 @@ TEST_CASE("db/block.h")
 
         // 分配空间
         unsigned short len = (unsigned short) Record::size(iov);
-        std::pair<unsigned char *, bool> alloc_ret = data.allocate(len, 0);
+        unsigned char *alloc_ret = data.allocate(len, 0);
         // 填充记录
         Record record;
-        record.attach(alloc_ret.first, len);
+        record.attach(alloc_ret, len);
         unsigned char header = 0;
         record.set(iov, &header);
         // 重新排序
@@ -335,7 +340,7 @@ TEST_CASE("db/block.h")
         type->htobe(&id);
         iov[0].iov_base = &id;
         iov[0].iov_len = 8;
-        iov[1].iov_base = "Joi Biden    ";
+        iov[1].iov_base = (void *) "Joi Biden    ";
         iov[1].iov_len = 12;
         const char *addr2 = "(323) 751-1875"
                             "7609 Mckinley Ave"
@@ -348,7 +353,7 @@ TEST_CASE("db/block.h")
         len = (unsigned short) Record::size(iov);
         alloc_ret = data.allocate(len, 0);
         // 填充记录
-        record.attach(alloc_ret.first, len);
+        record.attach(alloc_ret, len);
         record.set(iov, &header);
         REQUIRE(be16toh(slot->offset) == sizeof(DataHeader));
         REQUIRE(be16toh(slot->length) == len + 5);
@@ -417,7 +422,7 @@ TEST_CASE("db/block.h")
         type->htobe(&id);
         iov[0].iov_base = &id;
         iov[0].iov_len = 8;
-        iov[1].iov_base = "John Carter ";
+        iov[1].iov_base = (void *) "John Carter ";
         iov[1].iov_len = 12;
         const char *addr = "(323) 238-0693"
                            "909 - 1/2 E 49th St"
@@ -427,10 +432,10 @@ TEST_CASE("db/block.h")
 
         // 分配空间
         unsigned short len = (unsigned short) Record::size(iov);
-        std::pair<unsigned char *, bool> alloc_ret = data.allocate(len, 0);
+        unsigned char *alloc_ret = data.allocate(len, 0);
         // 填充记录
         Record record;
-        record.attach(alloc_ret.first, len);
+        record.attach(alloc_ret, len);
         unsigned char header = 0;
         record.set(iov, &header);
         // 重新排序
@@ -443,7 +448,7 @@ TEST_CASE("db/block.h")
         type->htobe(&id);
         iov[0].iov_base = &id;
         iov[0].iov_len = 8;
-        iov[1].iov_base = "Joi Biden    ";
+        iov[1].iov_base = (void *) "Joi Biden    ";
         iov[1].iov_len = 12;
         const char *addr2 = "(323) 751-1875"
                             "7609 Mckinley Ave"
@@ -456,7 +461,7 @@ TEST_CASE("db/block.h")
         len = (unsigned short) Record::size(iov);
         alloc_ret = data.allocate(len, 0);
         // 填充记录
-        record.attach(alloc_ret.first, len);
+        record.attach(alloc_ret, len);
         record.set(iov, &header);
         // 重新排序
         data.reorder(type, 0);
@@ -545,7 +550,7 @@ TEST_CASE("db/block.h")
         REQUIRE(record.length() == Record::size(iov));
         REQUIRE(record.fields() == 3);
         long long xid;
-        unsigned int len;
+        unsigned int len = sizeof(xid);
         record.getByIndex((char *) &xid, &len, 0);
         REQUIRE(len == 8);
         type->betoh(&xid);
@@ -791,11 +796,11 @@ TEST_CASE("BlockTest", "[p1]")
         std::vector<struct iovec> iov(3);
         long long nid;
         char phone[20];
-        char *addr = SHORT_ADDR;
+        char *addr = (char *) SHORT_ADDR;
         
         // 第1条记录
         nid = 1;
-        strcpy_s(phone, "11111111111");
+        strcpy(phone, "11111111111");
         htobeIov(bigint, char_type, varchar, &nid, phone, addr);
         setIov(iov, &nid, phone, (void *) addr);        
         unsigned short osize = data.getFreespaceSize();
@@ -815,7 +820,7 @@ TEST_CASE("BlockTest", "[p1]")
 
         // 测试 getByIndex
         long long xid;
-        unsigned int len;
+        unsigned int len = sizeof(xid);
         record.getByIndex((char *) &xid, &len, 0);
         REQUIRE(len == 8);
         bigint->betoh(&xid);
@@ -840,7 +845,7 @@ TEST_CASE("BlockTest", "[p1]")
 
         // 更新第1条记录
         nid = 1;
-        strcpy_s(phone, "222222222222");
+        strcpy(phone, "222222222222");
         htobeIov(bigint, char_type, varchar, &nid, phone, addr);
         setIov(iov, &nid, phone, (void *) addr);
         unsigned short freesize = data.getFreeSize();
@@ -877,7 +882,7 @@ TEST_CASE("BlockTest", "[p1]")
         }
 
         bigint->betoh(&nid);
-        REQUIRE(nid == 178); // 共能插入 177 条记录
+        REQUIRE(nid == 164); // 共能插入 163 条记录，每条另占 8B 键目录
 
         // 测试记录不存在时 update
         htobeIov(bigint, char_type, varchar, &nid, phone, addr);
@@ -885,7 +890,7 @@ TEST_CASE("BlockTest", "[p1]")
         REQUIRE(!data.updateRecord(iov));
        
         // 使更新后的记录更长
-        addr = LONG_ADDR;
+        addr = (char *) LONG_ADDR;
         bigint->betoh(&nid);
         nid -= 1;
         htobeIov(bigint, char_type, varchar, &nid, phone, addr);
@@ -935,7 +940,7 @@ TEST_CASE("BlockTest", "[p1]")
         std::vector<struct iovec> iov(3);
         long long nid;
         char phone[20];
-        char *addr = SHORT_ADDR;
+        char *addr = (char *) SHORT_ADDR;
 
         // 测试记录不存在
         nid = 1;
@@ -978,6 +983,69 @@ TEST_CASE("BlockTest", "[p1]")
 
         kBuffer.releaseBuf(bd);
     }
+
+    SECTION("shrink")
+    {
+        Table table;
+        REQUIRE(table.open("table") == S_OK);
+
+        DataBlock data;
+        data.setTable(&table);
+        BufDesp *bd = kBuffer.borrow("table", 1);
+        REQUIRE(bd);
+        data.attach(bd->buffer);
+        data.clear(1, 1, BLOCK_TYPE_DATA);
+
+        DataType *bigint = findDataType("BIGINT");
+        std::vector<struct iovec> iov(3);
+        long long nid;
+        char phone[20] = {};
+        char *addr = (char *) SHORT_ADDR;
+
+        // 乱序插入后删掉一半，留下空洞
+        for (long long i = 0; i < 150; ++i) {
+            nid = i * 37 % 150;
+            htobeIov(bigint, nullptr, nullptr, &nid, phone, addr);
+            setIov(iov, &nid, phone, (void *) addr);
+            REQUIRE(data.insertRecord(iov).first);
+        }
+        for (long long i = 1; i < 150; i += 2) {
+            nid = i;
+            htobeIov(bigint, nullptr, nullptr, &nid, phone, addr);
+            setIov(iov, &nid, phone, (void *) addr);
+            REQUIRE(data.removeRecord(iov));
+        }
+
+        // 尾部放不下时回收空洞，slots[]仍按键有序
+        bool shrunk = false;
+        for (long long i = 0; i < 60; ++i) {
+            nid = 150 + i * 7 % 60;
+            htobeIov(bigint, nullptr, nullptr, &nid, phone, addr);
+            setIov(iov, &nid, phone, (void *) addr);
+            unsigned short freespace = data.getFreeSpace();
+            REQUIRE(data.insertRecord(iov).first);
+            if (data.getFreeSpace() < freespace) shrunk = true;
+        }
+        REQUIRE(shrunk);
+
+        long long last = -1;
+        for (DataBlock::RecordIterator ri = data.beginrecord();
+             ri != data.endrecord();
+             ++ri) {
+            unsigned char *pkey;
+            unsigned int len;
+            ri->refByIndex(&pkey, &len, 0);
+            memcpy(&nid, pkey, len);
+            bigint->betoh(&nid);
+            REQUIRE(nid > last);
+            last = nid;
+        }
+        REQUIRE(last == 209);
+        REQUIRE(data.getSlots() == 75 + 60);
+
+        data.clear(1, 1, BLOCK_TYPE_DATA);
+        kBuffer.releaseBuf(bd);
+    }
 }
 
 // 在函数内先调用 htobe
@@ -1020,7 +1088,7 @@ bool createBlock(
     data.setType(type);
     data.setNext(next);
 
-    for (int i = 0; i < iovs.size(); i++) {
+    for (size_t i = 0; i < iovs.size(); i++) {
         auto ret = data.insertRecord(iovs[i]);
         if (!ret.first) return false;
     }
@@ -1028,6 +1096,34 @@ bool createBlock(
     return true;
 }
 
+// 批量装载的输入：键为0, 2, 4...，最后一条与前一条重复
+struct Rows
+{
+    int next;
+    int count;
+    long long key;
+    unsigned int val;
+};
+
+int failRow(std::vector<struct iovec> &, void *) { return EIO; }
+
+int nextRow(std::vector<struct iovec> &iov, void *arg)
+{
+    Rows *rows = (Rows *) arg;
+    if (rows->next > rows->count) return ENOENT;
+    int i = rows->next < rows->count ? rows->next : rows->count - 1;
+    ++rows->next;
+    setIdxIov(
+        findDataType("BIGINT"),
+        findDataType("INT"),
+        i * 2,
+        &rows->key,
+        i,
+        &rows->val,
+        iov);
+    return S_OK;
+}
+
 TEST_CASE("IndexTest", "[p2]") 
 {
     SECTION("search")
@@ -1127,7 +1223,7 @@ TEST_CASE("IndexTest", "[p2]")
         iovs.push_back(iov);
         setIdxIov(bigint, int_type, 47, &keys[19], 470, &blockids[19], iov);
         iovs.push_back(iov);
-        REQUIRE(createBlock(&table, 9, NULL, BLOCK_TYPE_DATA, iovs));
+        REQUIRE(createBlock(&table, 9, 0, BLOCK_TYPE_DATA, iovs));
         iovs.clear();
 
         DataBlock data;
@@ -1238,14 +1334,14 @@ TEST_CASE("IndexTest", "[p2]")
             vals.push_back(i * 10);
         }
 
-        for (int i = 0; i < keys.size(); ++i) {
+        for (size_t i = 0; i < keys.size(); ++i) {
             setIdxIov(
                 bigint, int_type, keys[i], &keys[i], vals[i], &vals[i], iov);
             REQUIRE(data.insert(iov) == S_OK);
         }
         
         // 检查插入
-        for (int i = 0; i < keys.size(); ++i) {
+        for (size_t i = 0; i < keys.size(); ++i) {
             REQUIRE(data.search(&keys[i], sizeof(long long), iov) == S_OK);
             REQUIRE(*(unsigned int *) iov[1].iov_base == vals[i]);
         }       
@@ -1286,13 +1382,13 @@ TEST_CASE("IndexTest", "[p2]")
             preKeys.push_back(i);
 
         // 检查现有B+树
-        for (int i = 0; i < preKeys.size(); ++i) {
+        for (size_t i = 0; i < preKeys.size(); ++i) {
             bigint->htobe(&preKeys[i]);
             REQUIRE(data.search(&preKeys[i], sizeof(long long), iov) == S_OK);
         }
 
         // 检查删除
-        for (int i = 0; i < preKeys.size(); ++i) {
+        for (size_t i = 0; i < preKeys.size(); ++i) {
             tmpKey = preKeys[i];
             tmpVal = (unsigned int) preKeys[i] * 10;
             REQUIRE(data.remove(iov) == S_OK);
@@ -1342,7 +1438,7 @@ TEST_CASE("IndexTest", "[p2]")
             REQUIRE(data.insert(iov) == S_OK);
         }
 
-        for (int i = 0; i < preKeys.size(); ++i) {           
+        for (size_t i = 0; i < preKeys.size(); ++i) {           
             bigint->htobe(&preKeys[i]); // 先确认键存在
             REQUIRE(
                 data.search(&preKeys[i], (unsigned int) sizeof(long long), iov) ==
@@ -1355,7 +1451,7 @@ TEST_CASE("IndexTest", "[p2]")
         }
 
         // 检查更新
-        for (int i = 0; i < preKeys.size(); ++i) {
+        for (size_t i = 0; i < preKeys.size(); ++i) {
             REQUIRE(
                 data.search(&preKeys[i], (unsigned int) sizeof(long long), iov) ==
                 S_OK);
@@ -1364,4 +1460,1159 @@ TEST_CASE("IndexTest", "[p2]")
         }      
         kBuffer.releaseBuf(bd);
     }
-}
\ No newline at end of file
+
+    SECTION("concurrent")
+    {
+        Table table;
+        REQUIRE(table.open("table") == S_OK);
+        DataType *bigint = findDataType("BIGINT");
+        DataType *intType = findDataType("INT");
+
+        // 读者反复查上一 SECTION 中的键，同时写者在右侧追加再删除，引起分裂与合并
+        std::atomic<bool> done(false);
+        std::atomic<int> errors(0);
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 3; ++t)
+            readers.push_back(std::thread([&, t] {
+                DataBlock data;
+                data.setTable(&table);
+                long long key;
+                unsigned int val;
+                std::vector<struct iovec> iov(2);
+                setIdxIov(bigint, intType, -1, &key, -1, &val, iov);
+                for (int i = t; !done.load(); i += 3) {
+                    long long k = 50 + (i % 751) * 2;
+                    bigint->htobe(&k);
+                    if (data.search(&k, sizeof(long long), iov) != S_OK)
+                        ++errors;
+                }
+            }));
+
+        DataBlock data;
+        data.setTable(&table);
+        long long key;
+        unsigned int val;
+        std::vector<struct iovec> iov(2);
+        for (int i = 1552; i < 3553; i += 2) {
+            setIdxIov(bigint, intType, i, &key, i * 10, &val, iov);
+            REQUIRE(data.insert(iov) == S_OK);
+        }
+        for (int i = 1552; i < 3553; i += 2) {
+            setIdxIov(bigint, intType, i, &key, i * 10, &val, iov);
+            REQUIRE(data.remove(iov) == S_OK);
+        }
+        done = true;
+        for (size_t i = 0; i < readers.size(); ++i)
+            readers[i].join();
+        REQUIRE(errors.load() == 0);
+    }
+    SECTION("bulkload")
+    {
+        // 新建一张两个字段的表
+        if (!kSchema.lookup("bulk").second) {
+            RelationInfo relation;
+            FieldInfo field;
+            field.name = "id";
+            field.index = 0;
+            field.length = 8;
+            field.type = findDataType("BIGINT");
+            relation.fields.push_back(field);
+            field.name = "val";
+            field.index = 1;
+            field.length = 4;
+            field.type = findDataType("INT");
+            relation.fields.push_back(field);
+            relation.count = 2;
+            relation.key = 0;
+            REQUIRE(kSchema.create("bulk", relation) == S_OK);
+        }
+        Table table;
+        REQUIRE(table.open("bulk") == S_OK);
+        DataType *bigint = findDataType("BIGINT");
+        DataType *intType = findDataType("INT");
+
+        // 填充率5%，得到三层的树；重复键之前的记录都已装载
+        Rows rows = {0, 20000, 0, 0};
+        REQUIRE(table.bulkLoad(nextRow, &rows, 0) == EINVAL);
+        REQUIRE(table.bulkLoad(failRow, NULL) == EIO); // 来源出错不当作取完
+        REQUIRE(table.recordCount() == 0);
+        REQUIRE(table.bulkLoad(nextRow, &rows, 0.05) == EINVAL);
+        REQUIRE(table.recordCount() == 20000);
+
+        // 从根沿最左指针下到叶节点
+        BufDesp *bd = kBuffer.borrow(table.id_, 0);
+        SuperBlock super;
+        super.attach(bd->buffer);
+        unsigned int blockid = super.getRoot();
+        kBuffer.releaseBuf(bd);
+        int height = 1;
+        for (;;) {
+            DataBlock node;
+            bd = kBuffer.borrow(table.id_, blockid);
+            node.attach(bd->buffer);
+            unsigned short type = node.getType();
+            unsigned int next = node.getNext();
+            kBuffer.releaseBuf(bd);
+            if (type == BLOCK_TYPE_DATA) break;
+            blockid = next;
+            ++height;
+        }
+        REQUIRE(height == 3);
+        REQUIRE(blockid == table.first_);
+
+        // 数据链上的键连续递增
+        long long expect = 0;
+        for (Table::BlockIterator bi = table.beginblock();
+             bi != table.endblock();
+             ++bi) {
+            for (DataBlock::RecordIterator ri = bi->beginrecord();
+                 ri != bi->endrecord();
+                 ++ri) {
+                unsigned char *pkey;
+                unsigned int len;
+                long long key;
+                ri->refByIndex(&pkey, &len, 0);
+                memcpy(&key, pkey, len);
+                REQUIRE(be64toh(key) == expect);
+                expect += 2;
+            }
+        }
+        REQUIRE(expect == 40000);
+
+        // 经由索引查找
+        DataBlock data;
+        data.setTable(&table);
+        long long key;
+        unsigned int val;
+        std::vector<struct iovec> iov(2);
+        setIdxIov(bigint, intType, -1, &key, -1, &val, iov);
+        for (long long i = 0; i < 40000; ++i) {
+            long long k = i;
+            bigint->htobe(&k);
+            int ret = data.search(&k, sizeof(long long), iov);
+            if (i % 2) {
+                REQUIRE(ret != S_OK);
+            } else {
+                REQUIRE(ret == S_OK);
+                intType->betoh(&val);
+                REQUIRE(val == i / 2);
+            }
+        }
+
+        // 装载后的树可以继续插入，非空的表不能再装载
+        setIdxIov(bigint, intType, 40000, &key, 20000, &val, iov);
+        REQUIRE(data.insert(iov) == S_OK);
+        rows.next = 0;
+        REQUIRE(table.bulkLoad(nextRow, &rows) == EEXIST);
+
+        // 填充率小到放不下一条记录时，每个叶节点仍放一条
+        if (!kSchema.lookup("sparse").second) {
+            RelationInfo relation;
+            relation.fields = table.info_->fields;
+            relation.count = 2;
+            relation.key = 0;
+            REQUIRE(kSchema.create("sparse", relation) == S_OK);
+        }
+        Table sparse;
+        REQUIRE(sparse.open("sparse") == S_OK);
+        Rows few = {0, 100, 0, 0};
+        REQUIRE(sparse.bulkLoad(nextRow, &few, 0.001) == EINVAL);
+        REQUIRE(sparse.recordCount() == 100);
+        size_t leaves = 0;
+        for (Table::BlockIterator bi = sparse.beginblock();
+             bi != sparse.endblock();
+             ++bi, ++leaves)
+            REQUIRE(bi->getSlots() == 1);
+        REQUIRE(leaves == 100);
+        data.setTable(&sparse);
+        long long k = 198;
+        bigint->htobe(&k);
+        REQUIRE(data.search(&k, sizeof(long long), iov) == S_OK);
+        intType->betoh(&val);
+        REQUIRE(val == 99);
+
+        // Table::insert 分裂时分隔键进入索引，locate 下降即到键所在的 block
+        for (long long i = 199; i < 2000; ++i) {
+            setIdxIov(bigint, intType, i, &key, (unsigned int) i, &val, iov);
+            unsigned int blockid = sparse.locate(&key, sizeof(long long));
+            REQUIRE(sparse.insert(blockid, iov) == S_OK);
+        }
+        REQUIRE(
+            sparse.insert(sparse.locate(&key, sizeof(long long)), iov) ==
+            EEXIST);
+        REQUIRE(sparse.recordCount() == 1901);
+        for (long long i = 199; i < 2000; i += 7) {
+            k = i;
+            bigint->htobe(&k);
+            DataBlock leaf;
+            leaf.setTable(&sparse);
+            BufDesp *bd = kBuffer.borrow(
+                sparse.id_, sparse.locate(&k, sizeof(long long)));
+            leaf.attach(bd->buffer);
+            unsigned short index = leaf.searchRecord(&k, sizeof(long long));
+            bool found = index < leaf.getSlots();
+            kBuffer.releaseBuf(bd);
+            REQUIRE(found);
+            REQUIRE(data.search(&k, sizeof(long long), iov) == S_OK);
+        }
+    }
+
+    SECTION("scan")
+    {
+        // bulk 表中的键为 0, 2, ..., 40000
+        Table table;
+        REQUIRE(table.open("bulk") == S_OK);
+        DataType *bigint = findDataType("BIGINT");
+        auto count = [bigint](Table::ScanIterator si, long long first) {
+            long long n = 0;
+            for (; !si.end(); ++si, ++n) {
+                unsigned char *pkey;
+                unsigned int len;
+                long long key;
+                si->refByIndex(&pkey, &len, 0);
+                memcpy(&key, pkey, len);
+                bigint->betoh(&key);
+                REQUIRE(key == first + n * 2);
+            }
+            return n;
+        };
+
+        // 上下界都不在表中
+        long long low = 101, high = 201;
+        bigint->htobe(&low);
+        bigint->htobe(&high);
+        REQUIRE(
+            count(
+                table.scan(&low, sizeof(low), &high, sizeof(high)), 102) ==
+            50);
+
+        // 上下界在表中，跨越叶节点
+        low = 1000;
+        high = 30000;
+        bigint->htobe(&low);
+        bigint->htobe(&high);
+        REQUIRE(
+            count(
+                table.scan(&low, sizeof(low), &high, sizeof(high)), 1000) ==
+            14501);
+
+        // 没有上界时扫到表尾
+        low = 39990;
+        bigint->htobe(&low);
+        REQUIRE(count(table.scan(&low, sizeof(low)), 39990) == 6);
+
+        // 没有下界时从头开始
+        high = 10;
+        bigint->htobe(&high);
+        REQUIRE(count(table.scan(NULL, 0, &high, sizeof(high)), 0) == 6);
+
+        // 空范围
+        low = 50000;
+        bigint->htobe(&low);
+        REQUIRE(table.scan(&low, sizeof(low)).end());
+        low = 11;
+        high = 11;
+        bigint->htobe(&low);
+        bigint->htobe(&high);
+        REQUIRE(table.scan(&low, sizeof(low), &high, sizeof(high)).end());
+
+        // 整数键没有前缀，短前缀给出空游标，整个键即单点
+        low = 1000;
+        bigint->htobe(&low);
+        REQUIRE(table.scanPrefix(&low, 2).end());
+        REQUIRE(table.scanPrefix(&low, sizeof(low) - 1).end());
+        REQUIRE(count(table.scanPrefix(&low, sizeof(low)), 1000) == 1);
+        low = 1001;
+        bigint->htobe(&low);
+        REQUIRE(table.scanPrefix(&low, sizeof(low)).end());
+
+        // locate 经由索引下降，所在 block 的键范围覆盖 key
+        long long probes[] = {0, 1, 1001, 30000, 39999, 40000, 50000};
+        for (long long probe : probes) {
+            long long k = probe;
+            bigint->htobe(&k);
+            unsigned int blockid = table.locate(&k, sizeof(k));
+            DataBlock data;
+            data.setTable(&table);
+            BufDesp *bd = kBuffer.borrow(table.id_, blockid);
+            data.attach(bd->buffer);
+            unsigned short index = data.searchRecord(&k, sizeof(k));
+            unsigned short slots = data.getSlots();
+            unsigned int next = data.getNext();
+            Record record;
+            unsigned char *pkey;
+            unsigned int len;
+            REQUIRE(data.refslots(0, record));
+            record.refByIndex(&pkey, &len, 0);
+            bool covered =
+                !bigint->less((unsigned char *) &k, sizeof(k), pkey, len);
+            kBuffer.releaseBuf(bd);
+            REQUIRE((covered || blockid == table.first_));
+            if (index < slots) continue;
+
+            // 大于本 block 所有键时，下一个 block 的键都比它大
+            if (next == 0) continue;
+            bd = kBuffer.borrow(table.id_, next);
+            data.attach(bd->buffer);
+            REQUIRE(data.searchRecord(&k, sizeof(k)) == 0);
+            kBuffer.releaseBuf(bd);
+        }
+
+        // 旧格式的表文件不能打开
+        BufDesp *sd = kBuffer.borrow(table.id_, 0);
+        SuperBlock super;
+        super.attach(sd->buffer);
+        super.setVersion(0);
+        Table old;
+        REQUIRE(old.open("bulk") == ENOTSUP);
+        super.setVersion(FORMAT_VERSION);
+        REQUIRE(old.open("bulk") == S_OK);
+        kBuffer.releaseBuf(sd);
+    }
+
+    SECTION("mapped")
+    {
+        // 只读映射的 bulk 表拒绝修改，修改不会写到映射区上
+        Table table;
+        REQUIRE(table.open("bulk") == S_OK);
+        REQUIRE(kBuffer.flushAll() == S_OK);
+        File *file = kFiles.get(table.id_);
+        REQUIRE(file->map() == S_OK);
+        REQUIRE(table.mapped());
+        size_t records = table.recordCount();
+
+        DataType *bigint = findDataType("BIGINT");
+        DataType *intType = findDataType("INT");
+        DataBlock data;
+        data.setTable(&table);
+        long long key;
+        unsigned int val;
+        std::vector<struct iovec> iov(2);
+        setIdxIov(bigint, intType, 40002, &key, 20001, &val, iov);
+        REQUIRE(data.insert(iov) == EROFS);
+        REQUIRE(table.insert(table.first_, iov) == EROFS);
+        setIdxIov(bigint, intType, 0, &key, 0, &val, iov);
+        REQUIRE(data.update(iov) == EROFS);
+        REQUIRE(data.remove(iov) == EROFS);
+        REQUIRE(table.allocate() == 0);
+        Rows rows = {0, 1, 0, 0};
+        REQUIRE(table.bulkLoad(nextRow, &rows) == EROFS);
+        REQUIRE(table.recordCount() == records);
+
+        file->unmap();
+        REQUIRE(!table.mapped());
+    }
+
+    SECTION("multisearch")
+    {
+        // bulk 表中的键为 0, 2, ..., 40000，乱序查一半存在一半不存在的键
+        Table table;
+        REQUIRE(table.open("bulk") == S_OK);
+        DataType *bigint = findDataType("BIGINT");
+        DataType *intType = findDataType("INT");
+        const size_t count = 5000;
+        std::vector<long long> keys(count);
+        std::vector<struct iovec> probes(count);
+        std::vector<long long> outKeys(count);
+        std::vector<unsigned int> outVals(count);
+        std::vector<std::vector<struct iovec>> iovs(count);
+        for (size_t i = 0; i < count; ++i) {
+            keys[i] = (long long) (i * 7919 % 40010);
+            bigint->htobe(&keys[i]);
+            probes[i].iov_base = &keys[i];
+            probes[i].iov_len = sizeof(long long);
+            iovs[i].resize(2);
+            setIdxIov(
+                bigint, intType, -1, &outKeys[i], -1, &outVals[i], iovs[i]);
+        }
+        // 重复的键
+        keys[count - 1] = keys[0];
+
+        DataBlock data;
+        data.setTable(&table);
+        std::vector<int> rets;
+        size_t found = data.multiSearch(probes, iovs, rets);
+        REQUIRE(rets.size() == count);
+        size_t expect = 0;
+        for (size_t i = 0; i < count; ++i) {
+            long long key = keys[i];
+            bigint->betoh(&key);
+            if (key % 2 || key > 40000) {
+                REQUIRE(rets[i] == EFAULT);
+                continue;
+            }
+            REQUIRE(rets[i] == S_OK);
+            ++expect;
+            unsigned int val;
+            memcpy(&val, iovs[i][1].iov_base, sizeof(val));
+            intType->betoh(&val);
+            REQUIRE(val == key / 2);
+        }
+        REQUIRE(found == expect);
+
+        // 空批
+        std::vector<struct iovec> none;
+        std::vector<std::vector<struct iovec>> noIovs;
+        REQUIRE(data.multiSearch(none, noIovs, rets) == 0);
+        REQUIRE(rets.empty());
+    }
+
+    SECTION("cache")
+    {
+        // 查找后根被缓存，根的frame版本变了就重建
+        Table table;
+        REQUIRE(table.open("bulk") == S_OK);
+        DataType *bigint = findDataType("BIGINT");
+        DataType *intType = findDataType("INT");
+        long long key, outKey;
+        unsigned int outVal;
+        std::vector<struct iovec> iov(2);
+        setIdxIov(bigint, intType, -1, &outKey, -1, &outVal, iov);
+        DataBlock data;
+        data.setTable(&table);
+
+        key = 2468;
+        bigint->htobe(&key);
+        REQUIRE(data.search(&key, sizeof(key), iov) == S_OK);
+        std::shared_ptr<IndexCache> cache = table.info_->cache;
+        REQUIRE(cache);
+        REQUIRE(cache->root->valid());
+
+        BufDesp *bd = kBuffer.borrow(table.id_, 0);
+        SuperBlock super;
+        super.attach(bd->buffer);
+        REQUIRE(cache->root->blockid == super.getRoot());
+        kBuffer.releaseBuf(bd);
+        REQUIRE(!cache->root->leaf);
+        REQUIRE(cache->below.size() == cache->root->children.size() + 1);
+        size_t pos = cache->root->route(bigint, &key, sizeof(key));
+        REQUIRE(cache->below[pos]);
+
+        // 模拟frame被淘汰
+        cache->root->desp->latch.invalidate();
+        REQUIRE(!cache->root->valid());
+        for (long long i = 0; i <= 40000; i += 1000) {
+            key = i;
+            bigint->htobe(&key);
+            REQUIRE(data.search(&key, sizeof(key), iov) == S_OK);
+            intType->betoh(&outVal);
+            REQUIRE(outVal == i / 2);
+        }
+        REQUIRE(table.info_->cache != cache);
+        REQUIRE(table.info_->cache->root->valid());
+        // 下一层的节点没变，重建根时留用
+        REQUIRE(!cache->below[pos]->leaf);
+        REQUIRE(table.info_->cache->below[pos] == cache->below[pos]);
+    }
+
+    SECTION("compact")
+    {
+        // BIGINT 键的内节点为紧凑格式，键只存公共前缀之后的部分
+        Table table;
+        REQUIRE(table.open("bulk") == S_OK);
+        DataType *bigint = findDataType("BIGINT");
+        DataType *intType = findDataType("INT");
+        long long key, outKey;
+        unsigned int child, outChild;
+        std::vector<struct iovec> iov(2), out(2);
+        setIdxIov(bigint, intType, -1, &outKey, -1, &outChild, out);
+
+        unsigned int blockid = table.allocate();
+        DataBlock data;
+        data.setTable(&table);
+        BufDesp *bd = kBuffer.borrow(table.id_, blockid);
+        data.attach(bd->buffer);
+        // 格式看块上的标志，不看键类型
+        data.setType(BLOCK_TYPE_INDEX);
+        REQUIRE(!data.isCompact());
+        data.setIndexType();
+        REQUIRE(data.isCompact());
+        REQUIRE(data.getType() == BLOCK_TYPE_INDEX);
+
+        // 键小于2^16，前6个字节相同，每项6字节，远多于Record格式能放下的项数
+        std::pair<bool, unsigned short> pret;
+        long long count = 0;
+        for (;; ++count) {
+            setIdxIov(
+                bigint, intType, count * 2, &key, (unsigned int) count, &child, iov);
+            pret = data.insertRecord(iov);
+            if (!pret.first) break;
+        }
+        REQUIRE(pret.second == count);
+        REQUIRE(count > 2000);
+        REQUIRE(data.getSlots() == count);
+        setIdxIov(bigint, intType, 6, &key, 3, &child, iov);
+        REQUIRE(data.insertRecord(iov).second == (unsigned short) -1);
+
+        // 分裂后两半各自有序，新键插入应在的一半
+        setIdxIov(bigint, intType, 7, &key, 100000, &child, iov);
+        pret = data.insertRecord(iov);
+        REQUIRE(!pret.first);
+        std::pair<unsigned int, bool> split = data.split(pret.second, iov);
+        REQUIRE(split.second);
+        REQUIRE(data.insertRecord(iov).first);
+        DataBlock next;
+        next.setTable(&table);
+        BufDesp *bd2 = kBuffer.borrow(table.id_, split.first);
+        next.attach(bd2->buffer);
+        REQUIRE(next.isCompact());
+        REQUIRE(data.getSlots() + next.getSlots() == count + 1);
+
+        // 查找与删除
+        key = 7;
+        bigint->htobe(&key);
+        unsigned short index = data.searchRecord(&key, sizeof(key));
+        data.fetchRecord(index, out);
+        intType->betoh(&outChild);
+        REQUIRE(outChild == 100000);
+        setIdxIov(bigint, intType, 7, &key, 0, &child, iov);
+        REQUIRE(data.removeRecord(iov));
+        REQUIRE(!data.removeRecord(iov));
+        REQUIRE(data.searchRecord(&key, sizeof(key)) == index);
+
+        // 前缀变短时所有项变宽，分裂出的一半按不压缩的项长也放得下
+        const long long far = 1LL << 56; // 与其余键没有公共前缀
+        setIdxIov(bigint, intType, far, &key, 7, &child, iov);
+        REQUIRE(data.insertRecord(iov).first);
+        REQUIRE(data.getFreeSize() < 16);
+        long long expect = 0;
+        for (unsigned short i = 0; i < data.getSlots(); ++i) {
+            data.fetchRecord(i, out);
+            bigint->betoh(&outKey);
+            intType->betoh(&outChild);
+            if (i + 1 == data.getSlots()) {
+                REQUIRE(outKey == far);
+                REQUIRE(outChild == 7);
+                break;
+            }
+            REQUIRE(outKey == expect);
+            REQUIRE(outChild == expect / 2);
+            expect += 2;
+        }
+        for (unsigned short i = 0; i < next.getSlots(); ++i) {
+            next.fetchRecord(i, out);
+            bigint->betoh(&outKey);
+            REQUIRE(outKey == expect);
+            expect += 2;
+        }
+        REQUIRE(expect == count * 2);
+
+        kBuffer.releaseBuf(bd2);
+        kBuffer.releaseBuf(bd);
+        table.deallocate(split.first);
+        table.deallocate(blockid);
+
+        // 两个内节点都在半满附近时，合并连同下拉的一项放不下，不作改动
+        {
+            Table::WriteLatch latch(&table);
+            unsigned int leafId = table.allocate();
+            unsigned int ids[3]; // 左、右子节点和父节点
+            DataBlock nodes[3];
+            BufDesp *bds[4];
+            bds[3] = kBuffer.borrow(table.id_, leafId);
+            DataBlock leaf;
+            leaf.setTable(&table);
+            leaf.attach(bds[3]->buffer);
+            setIdxIov(bigint, intType, 50000, &key, 0, &child, iov);
+            REQUIRE(leaf.insertRecord(iov).first);
+            for (int i = 0; i < 3; ++i) {
+                ids[i] = table.allocate();
+                bds[i] = kBuffer.borrow(table.id_, ids[i]);
+                nodes[i].setTable(&table);
+                nodes[i].attach(bds[i]->buffer);
+                nodes[i].setIndexType();
+            }
+            // 每项12字节，1361项就满；680项的左节点放不下681项和下拉的一项
+            for (int i = 0; i < 681; ++i) {
+                if (i < 680) {
+                    setIdxIov(bigint, intType, i * 2, &key, leafId, &child, iov);
+                    REQUIRE(nodes[0].insertRecord(iov).first);
+                }
+                setIdxIov(
+                    bigint, intType, 60000 + i * 2, &key, leafId, &child, iov);
+                REQUIRE(nodes[1].insertRecord(iov).first);
+            }
+            nodes[0].setNext(leafId);
+            nodes[1].setNext(leafId);
+            nodes[2].setNext(ids[0]);
+            setIdxIov(bigint, intType, 50000, &key, ids[1], &child, iov);
+            REQUIRE(nodes[2].insertRecord(iov).first);
+            for (int i = 0; i < 4; ++i)
+                kBuffer.writeBuf(bds[i]);
+
+            std::vector<struct iovec> dataIov(2);
+            setIdxIov(bigint, intType, -1, &outKey, -1, &outChild, dataIov);
+            REQUIRE(nodes[2].merge(0, ids[1], dataIov) == ENOSPC);
+            REQUIRE(nodes[0].getSlots() == 680);
+            REQUIRE(nodes[1].getSlots() == 681);
+            REQUIRE(nodes[2].getSlots() == 1);
+
+            // 不管兄弟是否下溢，强行借一项
+            REQUIRE(nodes[2].borrow(0, ids[1], dataIov, true));
+            REQUIRE(nodes[0].getSlots() == 679);
+            REQUIRE(nodes[1].getSlots() == 682);
+            REQUIRE(nodes[2].merge(0, ids[1], dataIov) == ENOSPC);
+
+            // 右节点少两项后放得下，合并进左节点
+            for (int i = 679; i < 681; ++i) {
+                setIdxIov(
+                    bigint, intType, 60000 + i * 2, &key, leafId, &child, iov);
+                REQUIRE(nodes[1].removeRecord(iov));
+            }
+            REQUIRE(nodes[2].merge(0, ids[1], dataIov) == S_OK);
+            REQUIRE(nodes[0].getSlots() == 679 + 680 + 1);
+            REQUIRE(nodes[1].getSlots() == 0);
+            REQUIRE(nodes[2].getSlots() == 0);
+
+            for (int i = 0; i < 4; ++i)
+                kBuffer.releaseBuf(bds[i]);
+            for (int i = 0; i < 3; ++i)
+                table.deallocate(ids[i]);
+            table.deallocate(leafId);
+        }
+    }
+
+    SECTION("separator")
+    {
+        // VARCHAR 键的表，键前缀相同且较长
+        if (!kSchema.lookup("names").second) {
+            RelationInfo relation;
+            FieldInfo field;
+            field.name = "name";
+            field.index = 0;
+            field.length = -64;
+            field.type = findDataType("VARCHAR");
+            relation.fields.push_back(field);
+            field.name = "val";
+            field.index = 1;
+            field.length = 4;
+            field.type = findDataType("INT");
+            relation.fields.push_back(field);
+            relation.count = 2;
+            relation.key = 0;
+            REQUIRE(kSchema.create("names", relation) == S_OK);
+        }
+        Table table;
+        REQUIRE(table.open("names") == S_OK);
+        DataType *intType = findDataType("INT");
+
+        const int COUNT = 3000;
+        char name[64];
+        unsigned int val;
+        std::vector<struct iovec> iov(2);
+        auto setName = [&](int i, const char *tail) {
+            snprintf(name, sizeof(name), "user%05d%s", i, tail);
+            iov[0].iov_base = name;
+            iov[0].iov_len = strlen(name);
+            val = (unsigned int) i;
+            intType->htobe(&val);
+            iov[1].iov_base = &val;
+            iov[1].iov_len = sizeof(unsigned int);
+        };
+        const char *tail = "@example.com/profile";
+
+        DataBlock data;
+        data.setTable(&table);
+        for (int i = 0; i < COUNT; ++i) {
+            setName(i, tail);
+            REQUIRE(data.insert(iov) == S_OK);
+        }
+        setName(7, tail);
+        REQUIRE(data.insert(iov) == EFAULT);
+
+        // 根中的分隔键被截短，只到与左侧最大键不同的那个字符
+        BufDesp *bd = kBuffer.borrow(table.id_, 0);
+        SuperBlock super;
+        super.attach(bd->buffer);
+        unsigned int root = super.getRoot();
+        kBuffer.releaseBuf(bd);
+        DataBlock node;
+        node.setTable(&table);
+        bd = kBuffer.borrow(table.id_, root);
+        node.attach(bd->buffer);
+        REQUIRE(node.getType() == BLOCK_TYPE_INDEX);
+        REQUIRE(node.getSlots() > 1);
+        std::vector<char> sep(getKeyBytes(findDataType("VARCHAR")));
+        unsigned int child;
+        std::vector<struct iovec> rec = {
+            {&sep[0], sep.size()}, {&child, sizeof(unsigned int)}};
+        for (unsigned short i = 0; i < node.getSlots(); ++i) {
+            node.fetchRecord(i, rec);
+            REQUIRE(rec[0].iov_len <= strlen("user00000"));
+        }
+        kBuffer.releaseBuf(bd);
+
+        // 等于分隔键、夹在两键之间的键都不存在
+        char out[64];
+        auto search = [&](int i, const char *tail) {
+            setName(i, tail);
+            std::vector<struct iovec> got = {
+                {out, sizeof(out)}, {&val, sizeof(unsigned int)}};
+            int ret = data.search(name, (unsigned int) strlen(name), got);
+            if (ret == S_OK) {
+                REQUIRE(got[0].iov_len == strlen(name));
+                intType->betoh(&val);
+                REQUIRE(val == (unsigned int) i);
+            }
+            return ret;
+        };
+        for (int i = 0; i < COUNT; ++i) {
+            REQUIRE(search(i, tail) == S_OK);
+            REQUIRE(search(i, "") != S_OK);
+            REQUIRE(search(i, "@example.com/profilf") != S_OK);
+        }
+
+        // 删掉前一半，借键与合并时换上的分隔键仍能定位
+        for (int i = 0; i < COUNT / 2; ++i) {
+            setName(i, tail);
+            REQUIRE(data.remove(iov) == S_OK);
+        }
+        for (int i = 0; i < COUNT; ++i)
+            REQUIRE((search(i, tail) == S_OK) == (i >= COUNT / 2));
+    }
+
+    SECTION("directory")
+    {
+        // SMALLINT 键的表，叶节点带键目录
+        if (!kSchema.lookup("shorts").second) {
+            RelationInfo relation;
+            FieldInfo field;
+            field.name = "id";
+            field.index = 0;
+            field.length = 2;
+            field.type = findDataType("SMALLINT");
+            relation.fields.push_back(field);
+            field.name = "val";
+            field.index = 1;
+            field.length = 4;
+            field.type = findDataType("INT");
+            relation.fields.push_back(field);
+            relation.count = 2;
+            relation.key = 0;
+            REQUIRE(kSchema.create("shorts", relation) == S_OK);
+        }
+        Table table;
+        REQUIRE(table.open("shorts") == S_OK);
+        DataType *smallint = findDataType("SMALLINT");
+        DataType *intType = findDataType("INT");
+
+        // 乱序且有正有负，检查有符号的比较
+        const int COUNT = 4000;
+        auto keyOf = [](int i) { return (unsigned short) (i * 7919); };
+        unsigned short key;
+        unsigned int val;
+        std::vector<struct iovec> iov = {
+            {&key, sizeof(unsigned short)}, {&val, sizeof(unsigned int)}};
+        auto setRow = [&](unsigned short k) {
+            key = k;
+            val = k;
+            smallint->htobe(&key);
+            intType->htobe(&val);
+        };
+
+        DataBlock data;
+        data.setTable(&table);
+        for (int i = 0; i < COUNT; ++i) {
+            setRow(keyOf(i));
+            REQUIRE(data.insert(iov) == S_OK);
+        }
+
+        // 每个叶节点的键目录与记录一一对应且递增
+        auto check = [&]() {
+            size_t rows = 0;
+            for (Table::BlockIterator bi = table.beginblock();
+                 bi != table.endblock();
+                 ++bi) {
+                REQUIRE(bi->getDirectoryWidth() == sizeof(unsigned short));
+                unsigned char *directory = bi->getDirectoryPointer();
+                short last = 0;
+                for (unsigned short i = 0; i < bi->getSlots(); ++i) {
+                    // 目录项翻转了符号位
+                    unsigned short entry;
+                    memcpy(&entry, directory + i * sizeof(entry), sizeof(entry));
+                    bi->fetchKey(i, iov[0]);
+                    smallint->betoh(&key);
+                    REQUIRE(entry == (unsigned short) (key ^ 0x8000));
+                    if (i) REQUIRE(last < (short) key);
+                    last = (short) key;
+                    ++rows;
+                }
+            }
+            return rows;
+        };
+        REQUIRE(check() == (size_t) COUNT);
+
+        auto search = [&](unsigned short k) {
+            unsigned short target = k;
+            smallint->htobe(&target);
+            return data.search(&target, sizeof(unsigned short), iov);
+        };
+        for (int i = 0; i < COUNT; ++i) {
+            REQUIRE(search(keyOf(i)) == S_OK);
+            intType->betoh(&val);
+            REQUIRE(val == keyOf(i));
+            REQUIRE(search(keyOf(i + COUNT)) == EFAULT);
+        }
+
+        // 删掉一半后目录随slots[]挤压
+        for (int i = 0; i < COUNT; i += 2) {
+            setRow(keyOf(i));
+            REQUIRE(data.remove(iov) == S_OK);
+        }
+        REQUIRE(check() == (size_t) COUNT / 2);
+        for (int i = 0; i < COUNT; ++i)
+            REQUIRE((search(keyOf(i)) == S_OK) == (i % 2 == 1));
+
+        // 有没有键目录看块上记的项宽，不看表的键类型
+        unsigned int blockid = table.allocate();
+        BufDesp *bd = kBuffer.borrow(table.id_, blockid);
+        DataBlock leaf;
+        leaf.setTable(&table);
+        leaf.attach(bd->buffer);
+        REQUIRE(leaf.getDirectoryWidth() == sizeof(unsigned short));
+        leaf.setType(BLOCK_TYPE_DATA);
+        REQUIRE(leaf.getDirectoryWidth() == 0);
+        for (int i = 0; i < 100; ++i) {
+            setRow((unsigned short) (i * 3));
+            REQUIRE(leaf.insertRecord(iov).first);
+        }
+        for (int i = 0; i < 100; ++i) {
+            unsigned short target = (unsigned short) (i * 3);
+            smallint->htobe(&target);
+            REQUIRE(leaf.searchRecord(&target, sizeof(target)) == i);
+        }
+        kBuffer.releaseBuf(bd);
+        table.deallocate(blockid);
+    }
+
+    SECTION("composite")
+    {
+        // 组合键(tenant, ts, id)，键列不在第0个域，ts有正有负
+        if (!kSchema.lookup("tenants").second) {
+            RelationInfo relation;
+            FieldInfo field;
+            field.name = "note";
+            field.index = 0;
+            field.length = -16;
+            field.type = findDataType("VARCHAR");
+            relation.fields.push_back(field);
+            field.name = "tenant";
+            field.index = 1;
+            field.length = 4;
+            field.type = findDataType("INT");
+            relation.fields.push_back(field);
+            field.name = "ts";
+            field.index = 2;
+            field.length = 8;
+            field.type = findDataType("BIGINT");
+            relation.fields.push_back(field);
+            field.name = "id";
+            field.index = 3;
+            field.length = 4;
+            field.type = findDataType("INT");
+            relation.fields.push_back(field);
+            relation.count = 4;
+            relation.keys = {1, 2, 3};
+            REQUIRE(kSchema.create("tenants", relation) == S_OK);
+        }
+        Table table;
+        REQUIRE(table.open("tenants") == S_OK);
+        REQUIRE(table.info_->composite());
+        REQUIRE(table.info_->key == 1);
+        DataType *intType = findDataType("INT");
+        DataType *bigint = findDataType("BIGINT");
+
+        const int COUNT = 6000;
+        const int TENANTS = 10;
+        struct Row
+        {
+            int tenant;
+            long long ts;
+            int id;
+        };
+        auto rowOf = [&](int r) {
+            return Row{r % TENANTS - TENANTS / 2, (r * 31) % 1000 - 500LL, r};
+        };
+        auto before = [](const Row &x, const Row &y) {
+            if (x.tenant != y.tenant) return x.tenant < y.tenant;
+            if (x.ts != y.ts) return x.ts < y.ts;
+            return x.id < y.id;
+        };
+
+        char note[16];
+        int tenant, id;
+        long long ts;
+        std::vector<struct iovec> iov(4);
+        auto setRow = [&](const Row &row) {
+            int len = snprintf(note, sizeof(note), "n%d", row.id % 100);
+            tenant = row.tenant;
+            ts = row.ts;
+            id = row.id;
+            intType->htobe(&tenant);
+            bigint->htobe(&ts);
+            intType->htobe(&id);
+            iov = {
+                {note, (size_t) len},
+                {&tenant, sizeof(int)},
+                {&ts, sizeof(long long)},
+                {&id, sizeof(int)}};
+        };
+        auto getRow = [&](Record &record) {
+            Row row;
+            unsigned char *p;
+            unsigned int len;
+            record.refByIndex(&p, &len, 1);
+            memcpy(&row.tenant, p, sizeof(int));
+            intType->betoh(&row.tenant);
+            record.refByIndex(&p, &len, 2);
+            memcpy(&row.ts, p, sizeof(long long));
+            bigint->betoh(&row.ts);
+            record.refByIndex(&p, &len, 3);
+            memcpy(&row.id, p, sizeof(int));
+            intType->betoh(&row.id);
+            return row;
+        };
+
+        DataBlock data;
+        data.setTable(&table);
+        for (int i = 0; i < COUNT; ++i) {
+            setRow(rowOf(i * 7919 % COUNT));
+            REQUIRE(data.insert(iov) == S_OK);
+        }
+        setRow(rowOf(0));
+        REQUIRE(data.insert(iov) == EFAULT); // 键已存在
+
+        // 全表扫描按组合键递增，内节点存的是编码后的分隔键
+        auto check = [&]() {
+            size_t rows = 0;
+            Row last = {0, 0, 0};
+            for (Table::ScanIterator si = table.scan(NULL, 0); !si.end(); ++si) {
+                Row row = getRow(*si);
+                if (rows) REQUIRE(before(last, row));
+                last = row;
+                ++rows;
+            }
+            return rows;
+        };
+        REQUIRE(check() == (size_t) COUNT);
+
+        // 按编码后的键查找
+        std::vector<unsigned char> key;
+        char onote[16];
+        int otenant, oid;
+        long long ots;
+        std::vector<struct iovec> out = {
+            {onote, sizeof(onote)},
+            {&otenant, sizeof(int)},
+            {&ots, sizeof(long long)},
+            {&oid, sizeof(int)}};
+        auto search = [&](const Row &row) {
+            setRow(row);
+            key.clear();
+            encodeKey(table.info_, iov, key);
+            out[0].iov_len = sizeof(onote);
+            return data.search(key.data(), (unsigned int) key.size(), out);
+        };
+        for (int i = 0; i < COUNT; i += 7) {
+            REQUIRE(search(rowOf(i)) == S_OK);
+            intType->betoh(&oid);
+            REQUIRE(oid == i);
+        }
+        Row missing = rowOf(1);
+        missing.id = COUNT + 1;
+        REQUIRE(search(missing) == EFAULT);
+
+        // 前导列的前缀查找是范围扫描
+        auto prefixCount = [&](int columns, const Row &row) {
+            setRow(row);
+            std::vector<struct iovec> values(
+                iov.begin() + 1, iov.begin() + 1 + columns);
+            key.clear();
+            encodePrefix(table.info_, values, key);
+            size_t rows = 0;
+            for (Table::ScanIterator si =
+                     table.scanPrefix(key.data(), (unsigned int) key.size());
+                 !si.end();
+                 ++si) {
+                Row found = getRow(*si);
+                REQUIRE(found.tenant == row.tenant);
+                if (columns > 1) REQUIRE(found.ts == row.ts);
+                ++rows;
+            }
+            return rows;
+        };
+        auto expectCount = [&](int columns, const Row &row) {
+            size_t rows = 0;
+            for (int i = 0; i < COUNT; ++i) {
+                Row r = rowOf(i);
+                if (r.tenant == row.tenant && (columns < 2 || r.ts == row.ts))
+                    ++rows;
+            }
+            return rows;
+        };
+        for (int t = 0; t < TENANTS; ++t) {
+            REQUIRE(prefixCount(1, rowOf(t)) == expectCount(1, rowOf(t)));
+            REQUIRE(prefixCount(2, rowOf(t)) == expectCount(2, rowOf(t)));
+        }
+
+        // 删掉一半后仍有序，前缀扫描随之变化
+        for (int i = 0; i < COUNT; i += 2) {
+            setRow(rowOf(i));
+            REQUIRE(data.remove(iov) == S_OK);
+        }
+        REQUIRE(check() == (size_t) COUNT / 2);
+        // 租户号与行号同奇偶，偶数租户的行全被删掉
+        for (int t = 0; t < TENANTS; ++t)
+            REQUIRE(
+                prefixCount(1, rowOf(t)) ==
+                (t % 2 ? expectCount(1, rowOf(t)) : 0));
+        REQUIRE(search(rowOf(2)) == EFAULT);
+        REQUIRE(search(rowOf(3)) == S_OK);
+    }
+
+    SECTION("blink")
+    {
+        if (!kSchema.lookup("blink").second) {
+            RelationInfo relation;
+            FieldInfo field;
+            field.name = "id";
+            field.index = 0;
+            field.length = 8;
+            field.type = findDataType("BIGINT");
+            relation.fields.push_back(field);
+            field.name = "val";
+            field.index = 1;
+            field.length = 4;
+            field.type = findDataType("INT");
+            relation.fields.push_back(field);
+            relation.count = 2;
+            relation.key = 0;
+            REQUIRE(kSchema.create("blink", relation) == S_OK);
+        }
+        Table table;
+        REQUIRE(table.open("blink") == S_OK);
+        DataType *bigint = findDataType("BIGINT");
+        DataType *intType = findDataType("INT");
+        DataBlock data;
+        data.setTable(&table);
+        long long key;
+        unsigned int val;
+        std::vector<struct iovec> iov(2);
+        for (int i = 0; i < 3000; i += 2) {
+            setIdxIov(bigint, intType, i, &key, i, &val, iov);
+            REQUIRE(data.insert(iov) == S_OK);
+        }
+        auto found = [&](long long k) {
+            DataBlock reader;
+            reader.setTable(&table);
+            long long kb = k;
+            bigint->htobe(&kb);
+            long long rk;
+            unsigned int rv;
+            std::vector<struct iovec> out(2);
+            setIdxIov(bigint, intType, -1, &rk, -1, &rv, out);
+            return reader.search(&kb, sizeof(long long), out) == S_OK;
+        };
+
+        // 修改未结束时，只有改过的节点加过闩且已放开，其它线程的读者不等待
+        REQUIRE(found(1000));
+        std::shared_ptr<IndexCache> cache = table.info_->cache;
+        REQUIRE(cache);
+        {
+            Table::WriteLatch latch(&table);
+            setIdxIov(bigint, intType, 1001, &key, 1001, &val, iov);
+            REQUIRE(data.insert(iov) == S_OK);
+            bool hit = false, miss = true;
+            std::thread reader([&] {
+                hit = found(1001) && found(2000);
+                miss = found(1003);
+            });
+            reader.join();
+            REQUIRE(hit);
+            REQUIRE(!miss);
+        }
+        // 插入没有改到根，缓存仍然有效
+        REQUIRE(table.info_->cache == cache);
+        REQUIRE(cache->root->valid());
+
+        // 叶节点已分裂、父节点还没有分隔键时，读者沿next右移
+        long long k = 1000;
+        bigint->htobe(&k);
+        unsigned int blockid = table.locate(&k, sizeof(long long));
+        unsigned int rightId;
+        long long first, last;
+        {
+            Table::WriteLatch latch(&table);
+            DataBlock leaf, right;
+            leaf.setTable(&table);
+            right.setTable(&table);
+            BufDesp *bd = kBuffer.borrow(table.id_, blockid);
+            Table::WriteLatch::hold(bd);
+            leaf.attach(bd->buffer);
+            setIdxIov(bigint, intType, 0, &key, 0, &val, iov);
+            rightId = leaf.split(leaf.getSlots() - 1, iov).first;
+            BufDesp *rd = kBuffer.borrow(table.id_, rightId);
+            right.attach(rd->buffer);
+            right.setNext(leaf.getNext());
+            leaf.setNext(rightId);
+            std::vector<struct iovec> rec(2);
+            setIdxIov(bigint, intType, -1, &first, -1, &val, rec);
+            right.fetchRecord(0, rec);
+            setIdxIov(bigint, intType, -1, &last, -1, &val, rec);
+            right.fetchRecord(right.getSlots() - 1, rec);
+            kBuffer.writeBuf(rd);
+            kBuffer.releaseBuf(rd);
+            kBuffer.writeBuf(bd);
+            kBuffer.releaseBuf(bd);
+        }
+        REQUIRE(table.locate(&first, sizeof(long long)) == rightId);
+        bigint->betoh(&first);
+        bigint->betoh(&last);
+        REQUIRE(found(first));
+        REQUIRE(found(last));
+        REQUIRE(!found(last + 1));
+
+        std::vector<struct iovec> keys(2);
+        long long kbs[2] = {first, last};
+        for (int i = 0; i < 2; ++i) {
+            bigint->htobe(&kbs[i]);
+            keys[i].iov_base = &kbs[i];
+            keys[i].iov_len = sizeof(long long);
+        }
+        std::vector<long long> rks(2);
+        std::vector<unsigned int> rvs(2);
+        std::vector<std::vector<struct iovec>> iovs(2);
+        for (int i = 0; i < 2; ++i) {
+            iovs[i].resize(2);
+            setIdxIov(bigint, intType, -1, &rks[i], -1, &rvs[i], iovs[i]);
+        }
+        std::vector<int> rets;
+        REQUIRE(data.multiSearch(keys, iovs, rets) == 2);
+
+        // 填满最后一个叶节点，重复的键不能插入，也不引起分裂
+        long long tail = 3001;
+        bigint->htobe(&tail);
+        blockid = table.locate(&tail, sizeof(long long));
+        {
+            Table::WriteLatch latch(&table);
+            DataBlock leaf;
+            leaf.setTable(&table);
+            BufDesp *bd = kBuffer.borrow(table.id_, blockid);
+            Table::WriteLatch::hold(bd);
+            leaf.attach(bd->buffer);
+            for (long long i = 3001;; i += 2) {
+                setIdxIov(bigint, intType, i, &key, (unsigned int) i, &val, iov);
+                if (!leaf.insertRecord(iov).first) break;
+                tail = i;
+            }
+            kBuffer.writeBuf(bd);
+            kBuffer.releaseBuf(bd);
+        }
+        unsigned int maxid = table.maxid_;
+        setIdxIov(bigint, intType, tail, &key, 0, &val, iov);
+        REQUIRE(data.insert(iov) == EFAULT);
+        REQUIRE(table.maxid_ == maxid);
+        REQUIRE(table.locate(&key, sizeof(long long)) == blockid);
+        REQUIRE(found(tail));
+    }
+}
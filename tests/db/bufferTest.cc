@@ -3,14 +3,74 @@
 #include <db/buffer.h>
 #include <db/file.h>
 #include <db/block.h>
+#include <vector>
+#include <thread>
+#include <chrono>
 using namespace db;
 
+namespace {
+// 依次借还[first, first+count)的block
+void touch(Buffer &buffer, unsigned int first, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i) {
+        BufDesp *bd = buffer.borrow(Schema::META_FILE, first + i);
+        REQUIRE(bd);
+        buffer.releaseBuf(bd);
+    }
+}
+
+// 热点block经过两次全表扫描后的命中次数
+size_t scan(const char *policy)
+{
+    Buffer buffer;
+    buffer.init(&kFiles, 1, policy); // 64个frame
+    REQUIRE(strcmp(buffer.policy(), policy) == 0);
+
+    // 8个热点block，扫描80个block后再访问，然后再扫描200个
+    for (int i = 0; i < 4; ++i)
+        touch(buffer, 5000, 8);
+    touch(buffer, 6000, 80);
+    touch(buffer, 5000, 8);
+    touch(buffer, 7000, 200);
+
+    buffer.resetStats();
+    touch(buffer, 5000, 8);
+    REQUIRE(buffer.hits() + buffer.misses() == 8);
+    return buffer.hits();
+}
+
+// 热点block经过一轮低优先级预读后的命中次数
+size_t readahead(const char *policy)
+{
+    Buffer buffer;
+    buffer.init(&kFiles, 1, policy); // 64个frame
+    unsigned int table = kFiles.open(Schema::META_FILE)->id_;
+
+    // 32个热点block，预读200个不访问
+    touch(buffer, 5000, 32);
+    touch(buffer, 5000, 32);
+    for (unsigned int i = 0; i < 200; ++i)
+        REQUIRE(buffer.prefetch(table, 8000 + i, true) == S_OK);
+
+    buffer.resetStats();
+    touch(buffer, 5000, 32);
+    return buffer.hits();
+}
+} // namespace
+
 TEST_CASE("db/buffer.h", "[p1][p2]")
 {
     SECTION("init")
     {
+        // 缺省256MB，按每个分区1024个frame分成16个分区
+        Buffer buffer;
+        buffer.init(&kFiles);
+        REQUIRE(buffer.idles() == 256 * 1024 * 1024 / BLOCK_SIZE);
+        REQUIRE(buffer.shards() == 16);
+
+        // kBuffer已由dbInit初始化，再次init不起作用
         kBuffer.init(&kFiles);
-        REQUIRE(kBuffer.idles() == 256 * 1024 * 1024 / BLOCK_SIZE);
+        REQUIRE(kBuffer.idles() <= 256 * 1024 * 1024 / BLOCK_SIZE);
 
         BufDesp *bd = kBuffer.borrow(Schema::META_FILE, 0);
         REQUIRE(bd);
@@ -19,4 +79,379 @@ TEST_CASE("db/buffer.h", "[p1][p2]")
         kBuffer.releaseBuf(bd);
         REQUIRE(bd->ref.load() == 0);
     }
-}
\ No newline at end of file
+
+    SECTION("map")
+    {
+        BlockMap map;
+        BufDesp desp[64];
+        // 同一张表的连续block，以及不同表的同一block
+        for (unsigned int i = 0; i < 32; ++i) {
+            map.insert(1, i, &desp[i]);
+            map.insert(i + 2, 7, &desp[32 + i]);
+        }
+        REQUIRE(map.size() == 64);
+        for (unsigned int i = 0; i < 32; ++i) {
+            REQUIRE(map.find(1, i) == &desp[i]);
+            REQUIRE(map.find(i + 2, 7) == &desp[32 + i]);
+        }
+        REQUIRE(map.find(0, 0) == NULL);
+        REQUIRE(map.find(1, 32) == NULL);
+
+        // 覆盖
+        map.insert(1, 0, &desp[63]);
+        REQUIRE(map.size() == 64);
+        REQUIRE(map.find(1, 0) == &desp[63]);
+
+        // 删除一半，其余仍可找到
+        for (unsigned int i = 0; i < 32; i += 2) {
+            REQUIRE(map.erase(1, i));
+            REQUIRE(map.erase(i + 2, 7));
+        }
+        REQUIRE(!map.erase(1, 0));
+        REQUIRE(map.size() == 32);
+        for (unsigned int i = 1; i < 32; i += 2) {
+            REQUIRE(map.find(1, i) == &desp[i]);
+            REQUIRE(map.find(i + 2, 7) == &desp[32 + i]);
+            REQUIRE(map.find(1, i - 1) == NULL);
+        }
+    }
+
+    SECTION("async")
+    {
+        // 打开异步模式后，缺页读批量提交
+        bool async = kBuffer.async();
+        REQUIRE(kBuffer.enableAsync() == S_OK);
+        unsigned int ids[] = {0, 1};
+        BufDesp *bd[2];
+        int ret = kBuffer.borrowBatch(Schema::META_FILE, ids, 2, bd);
+        REQUIRE(ret == S_OK);
+        for (int i = 0; i < 2; ++i) {
+            REQUIRE(bd[i]->blockid == ids[i]);
+            REQUIRE(!(bd[i]->type & kBuffer.BUFFER_IO));
+            REQUIRE(bd[i]->ref.load() == 1);
+            kBuffer.releaseBuf(bd[i]);
+        }
+
+        // 恢复原来的模式，后面的用例不受执行顺序影响
+        if (!async) kBuffer.disableAsync();
+        REQUIRE(kBuffer.async() == async);
+    }
+
+    SECTION("evict")
+    {
+        // 1MB只有64个frame，借还超过64个block时从lru尾部淘汰
+        Buffer buffer;
+        buffer.init(&kFiles, 1);
+        size_t frames = buffer.idles();
+        REQUIRE(frames == 1024 * 1024 / BLOCK_SIZE);
+
+        // 写一个脏块后归还
+        BufDesp *bd = buffer.borrow(Schema::META_FILE, 2000);
+        REQUIRE(bd);
+        memset(bd->buffer, 'e', BLOCK_SIZE);
+        buffer.writeBuf(bd);
+        buffer.releaseBuf(bd);
+
+        // 借用的block不会被淘汰
+        BufDesp *pinned = buffer.borrow(Schema::META_FILE, 2001);
+        REQUIRE(pinned);
+        for (unsigned int i = 0; i < frames * 2; ++i) {
+            bd = buffer.borrow(Schema::META_FILE, 3000 + i);
+            REQUIRE(bd);
+            buffer.releaseBuf(bd);
+        }
+        REQUIRE(buffer.idles() == 0);
+        REQUIRE(pinned->blockid == 2001);
+        buffer.releaseBuf(pinned);
+
+        // 脏块淘汰时已写回，重新读入内容不变
+        bd = buffer.borrow(Schema::META_FILE, 2000);
+        REQUIRE(bd);
+        REQUIRE(!(bd->type & buffer.BUFFER_DIRTY));
+        REQUIRE(bd->buffer[0] == 'e');
+        REQUIRE(bd->buffer[BLOCK_SIZE - 1] == 'e');
+        buffer.releaseBuf(bd);
+
+        // 全部借出时无法淘汰
+        std::vector<BufDesp *> all;
+        for (unsigned int i = 0; i < frames; ++i) {
+            bd = buffer.borrow(Schema::META_FILE, 3000 + i);
+            REQUIRE(bd);
+            all.push_back(bd);
+        }
+        REQUIRE(buffer.borrow(Schema::META_FILE, 4000) == NULL);
+        for (size_t i = 0; i < all.size(); ++i)
+            buffer.releaseBuf(all[i]);
+    }
+
+    SECTION("policy")
+    {
+        Buffer buffer;
+        buffer.init(&kFiles, 1, "NONE"); // 不支持的策略退回LRU
+        REQUIRE(strcmp(buffer.policy(), "LRU") == 0);
+        REQUIRE(buffer.setPolicy("NONE") == EINVAL);
+
+        // 命中计数
+        touch(buffer, 5000, 4);
+        touch(buffer, 5000, 4);
+        REQUIRE(buffer.misses() == 4);
+        REQUIRE(buffer.hits() == 4);
+        REQUIRE(buffer.hitRate() == 0.5);
+
+        // 切换策略后已缓存的block仍可命中
+        REQUIRE(buffer.setPolicy("CLOCKPRO") == S_OK);
+        touch(buffer, 5000, 4);
+        REQUIRE(buffer.hits() == 8);
+
+        // 扫描冲掉LRU中的热点，2Q和CLOCK-Pro保留热点
+        REQUIRE(scan("LRU") == 0);
+        REQUIRE(scan("2Q") == 8);
+        REQUIRE(scan("CLOCKPRO") == 8);
+    }
+
+    SECTION("readahead")
+    {
+        // 预读的block先于热点淘汰
+        REQUIRE(readahead("LRU") == 32);
+        REQUIRE(readahead("2Q") == 32);
+        REQUIRE(readahead("CLOCKPRO") == 32);
+
+        // 预读的block被借用后正常命中
+        Buffer buffer;
+        buffer.init(&kFiles, 1);
+        unsigned int table = kFiles.open(Schema::META_FILE)->id_;
+        REQUIRE(buffer.prefetch(table, 8000, true) == S_OK);
+        REQUIRE(!buffer.reading(table, 8000));
+        touch(buffer, 8000, 1);
+        REQUIRE(buffer.hits() == 1);
+        REQUIRE(buffer.misses() == 0);
+    }
+
+    SECTION("flush")
+    {
+        Buffer buffer;
+        buffer.init(&kFiles, 1); // 64个frame
+        File *meta = kFiles.open(Schema::META_FILE);
+
+        // 10个相邻的脏块，其中一个仍被借用
+        BufDesp *pinned = NULL;
+        for (unsigned int i = 0; i < 10; ++i) {
+            BufDesp *bd = buffer.borrow(Schema::META_FILE, 2100 + i);
+            REQUIRE(bd);
+            memset(bd->buffer, 'a' + i, BLOCK_SIZE);
+            buffer.writeBuf(bd);
+            if (i == 5)
+                pinned = bd;
+            else
+                buffer.releaseBuf(bd);
+        }
+        REQUIRE(buffer.dirties() == 10);
+
+        // 全部写回，包括借用的block
+        REQUIRE(buffer.flushAll() == S_OK);
+        REQUIRE(buffer.dirties() == 0);
+        REQUIRE(!(pinned->type & buffer.BUFFER_DIRTY));
+        buffer.releaseBuf(pinned);
+        static char data[BLOCK_SIZE];
+        for (unsigned int i = 0; i < 10; ++i) {
+            REQUIRE(
+                meta->read(
+                    (unsigned long long) (2100 + i) * BLOCK_SIZE + SUPER_SIZE,
+                    data,
+                    BLOCK_SIZE) == S_OK);
+            REQUIRE(data[0] == 'a' + (char) i);
+            REQUIRE(data[BLOCK_SIZE - 1] == 'a' + (char) i);
+        }
+
+        // 写回借用的block时又被修改，修改不能丢，写回后仍为dirty
+        BufDesp *hot = buffer.borrow(Schema::META_FILE, 2150);
+        REQUIRE(hot);
+        for (unsigned int i = 1; i <= 200; ++i) {
+            *(unsigned int *) hot->buffer = i * 2 - 1;
+            buffer.writeBuf(hot);
+            std::atomic<bool> ready(false), flushed(false);
+            std::thread writer([&buffer, &ready, &flushed, hot, i] {
+                // 等到开始写回再改，flushAll已结束时也改
+                ready = true;
+                while (!(hot->type & buffer.BUFFER_FLUSHING) && !flushed.load())
+                    std::this_thread::yield();
+                *(unsigned int *) hot->buffer = i * 2;
+                buffer.writeBuf(hot);
+            });
+            while (!ready.load())
+                std::this_thread::yield();
+            REQUIRE(buffer.flushAll() == S_OK);
+            flushed = true;
+            writer.join();
+            REQUIRE((hot->type & buffer.BUFFER_DIRTY));
+            REQUIRE(buffer.dirties() == 1);
+        }
+        buffer.releaseBuf(hot);
+        REQUIRE(buffer.flushAll() == S_OK);
+        REQUIRE(buffer.dirties() == 0);
+        REQUIRE(
+            meta->read(
+                (unsigned long long) 2150 * BLOCK_SIZE + SUPER_SIZE,
+                data,
+                BLOCK_SIZE) == S_OK);
+        REQUIRE(*(unsigned int *) data == 400);
+
+        // 超过高水位(16块)后台写回到低水位(6块)，之后再写的不超过高水位
+        REQUIRE(buffer.startFlusher(0.25, 0.1) == S_OK);
+        for (unsigned int i = 0; i < 20; ++i) {
+            BufDesp *bd = buffer.borrow(Schema::META_FILE, 2200 + i);
+            REQUIRE(bd);
+            memset(bd->buffer, 'x', BLOCK_SIZE);
+            buffer.writeBuf(bd);
+            buffer.releaseBuf(bd);
+        }
+        for (int i = 0; i < 1000 && buffer.dirties() > 16; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        REQUIRE(buffer.dirties() <= 16);
+        buffer.stopFlusher();
+
+        REQUIRE(buffer.checkpoint() == S_OK);
+        REQUIRE(buffer.dirties() == 0);
+        REQUIRE(buffer.startFlusher(0.1, 0.2) == EINVAL);
+    }
+
+    SECTION("mapped")
+    {
+        // flush之后_meta.db至少有2220个block，映射后借用不占frame
+        Buffer buffer;
+        buffer.init(&kFiles, 1); // 64个frame
+        File *meta = kFiles.open(Schema::META_FILE);
+        REQUIRE(meta->map() == S_OK);
+
+        // 借用中的描述符不回收
+        BufDesp *pinned = buffer.borrow(Schema::META_FILE, 1000);
+        REQUIRE(pinned);
+        REQUIRE((pinned->type & buffer.BUFFER_MAPPED));
+
+        // 映射区描述符与frame一样至多64个，之后回收未被借用的
+        touch(buffer, 1001, 300);
+        REQUIRE(buffer.mappings() == 64);
+        REQUIRE(buffer.idles() == 64);
+        REQUIRE(pinned->blockid == 1000);
+        REQUIRE(
+            pinned->buffer ==
+            (unsigned char *) meta->mapping(
+                (unsigned long long) 1000 * BLOCK_SIZE + SUPER_SIZE,
+                BLOCK_SIZE));
+
+        // 回收后的描述符指向新的block
+        for (unsigned int i = 0; i < 300; i += 37) {
+            BufDesp *bd = buffer.borrow(Schema::META_FILE, 1001 + i);
+            REQUIRE(bd);
+            REQUIRE(bd->blockid == 1001 + i);
+            REQUIRE(
+                bd->buffer ==
+                (unsigned char *) meta->mapping(
+                    (unsigned long long) (1001 + i) * BLOCK_SIZE + SUPER_SIZE,
+                    BLOCK_SIZE));
+            buffer.releaseBuf(bd);
+        }
+        REQUIRE(buffer.mappings() == 64);
+        buffer.releaseBuf(pinned);
+        meta->unmap();
+    }
+
+    SECTION("shard")
+    {
+        // 4MB分4个分区，每个64个frame，8个线程借还512个block
+        Buffer buffer;
+        buffer.init(&kFiles, 4, "CLOCKPRO", 4);
+        REQUIRE(buffer.shards() == 4);
+        kFiles.open(Schema::META_FILE); // 先打开，线程中只查找
+
+        std::atomic<int> errors(0);
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < 8; ++t)
+            threads.push_back(std::thread([&buffer, &errors, t] {
+                unsigned int seed = t;
+                for (int i = 0; i < 2000; ++i) {
+                    seed = seed * 1103515245 + 12345;
+                    // 一半访问热点，一半随机
+                    unsigned int blockid = 9000 + (i % 2 ? (seed >> 16) % 512
+                                                         : (seed >> 16) % 16);
+                    BufDesp *bd = buffer.borrow(Schema::META_FILE, blockid);
+                    if (bd == NULL || bd->blockid != blockid) ++errors;
+                    if (bd) buffer.releaseBuf(bd);
+                }
+            }));
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        REQUIRE(errors.load() == 0);
+        REQUIRE(buffer.hits() + buffer.misses() == 8 * 2000);
+        REQUIRE(buffer.hits() > 0);
+
+        // 全部归还，都可以淘汰
+        for (unsigned int i = 0; i < 512; ++i) {
+            BufDesp *bd = buffer.borrow(Schema::META_FILE, 10000 + i);
+            REQUIRE(bd);
+            buffer.releaseBuf(bd);
+        }
+    }
+
+    SECTION("latch")
+    {
+        Buffer buffer;
+        buffer.init(&kFiles, 1);
+
+        // 共享闩可以叠加，排它闩与之互斥
+        BufDesp *r1 = buffer.borrow(Schema::META_FILE, 11000, BORROW_READ);
+        BufDesp *r2 = buffer.borrow(Schema::META_FILE, 11000, BORROW_READ);
+        REQUIRE(r1 == r2);
+        REQUIRE(r1->latch.readers() == 2);
+        REQUIRE(!r1->latch.tryLock());
+        buffer.releaseBuf(r1, BORROW_READ);
+        buffer.releaseBuf(r2, BORROW_READ);
+        REQUIRE(r1->latch.readers() == 0);
+
+        // 乐观读：共享闩不影响版本，写者持闩或释放后校验失败
+        unsigned int version;
+        REQUIRE(r1->latch.readBegin(version));
+        BufDesp *w = buffer.borrow(Schema::META_FILE, 11000, BORROW_WRITE);
+        REQUIRE(w->latch.locked());
+        REQUIRE(!w->latch.tryLockShared());
+        REQUIRE(!w->latch.readBegin(version));
+        REQUIRE(!w->latch.readValidate(version));
+        buffer.releaseBuf(w, BORROW_WRITE);
+        REQUIRE(!w->latch.locked());
+        REQUIRE(!w->latch.readValidate(version));
+        REQUIRE(w->latch.readBegin(version));
+        REQUIRE(w->latch.readValidate(version));
+
+        // 写者把两个计数同时加1，读者看到的两个计数总是相等
+        std::atomic<int> errors(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.push_back(std::thread([&buffer, &errors, t] {
+                for (int i = 0; i < 2000; ++i) {
+                    bool write = (i + t) % 4 == 0;
+                    BufDesp *bd = buffer.borrow(
+                        Schema::META_FILE,
+                        11000,
+                        write ? BORROW_WRITE : BORROW_READ);
+                    unsigned int *counter = (unsigned int *) bd->buffer;
+                    if (write) {
+                        ++counter[0];
+                        std::this_thread::yield();
+                        ++counter[1];
+                    } else if (counter[0] != counter[1])
+                        ++errors;
+                    buffer.releaseBuf(bd, write ? BORROW_WRITE : BORROW_READ);
+                }
+            }));
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        REQUIRE(errors.load() == 0);
+
+        BufDesp *bd = buffer.borrow(Schema::META_FILE, 11000);
+        unsigned int *counter = (unsigned int *) bd->buffer;
+        REQUIRE(counter[0] == counter[1]);
+        REQUIRE(counter[0] >= 4 * 500);
+        REQUIRE(bd->ref == 1);
+        buffer.releaseBuf(bd);
+    }
+}
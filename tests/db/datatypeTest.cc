@@ -2,13 +2,19 @@
 #include <db/datatype.h>
 using namespace db;
 
-TEST_CASE("db/datatype.h")
+TEST_CASE("db/datatype.h", "[p1]")
 {
     SECTION("find")
     {
         DataType *dt = findDataType("CHAR");
         REQUIRE(dt);
         REQUIRE(dt->size == 65535);
+
+        // 字符串按字节比较，整数不是
+        REQUIRE(dt->byteComparable);
+        REQUIRE(findDataType("VARCHAR")->byteComparable);
+        REQUIRE(!findDataType("TINYINT")->byteComparable);
+        REQUIRE(!findDataType("BIGINT")->byteComparable);
 #if 0
         const char *hello = "hello";
         const char *hello2 = "hello2";
@@ -19,4 +25,24 @@ TEST_CASE("db/datatype.h")
         REQUIRE(strncmp(hello, buffer, strlen(hello)) == 0);
 #endif
     }
+
+    SECTION("shorten")
+    {
+        // 分隔键取y的最短前缀，仍大于x
+        DataType *dt = findDataType("VARCHAR");
+        unsigned char x[] = "apple", y[] = "apricot", z[] = "applesauce";
+        REQUIRE(dt->shorten(x, 5, y, 7) == 3);
+        REQUIRE(dt->less(x, 5, y, 3));
+        REQUIRE(dt->shorten(x, 5, z, 10) == 6);
+        REQUIRE(dt->less(x, 5, z, 6));
+        REQUIRE(findDataType("CHAR")->shorten(x, 5, y, 7) == 3);
+
+        // 定长类型不截断
+        long long a = htobe64(1), b = htobe64(2);
+        dt = findDataType("BIGINT");
+        REQUIRE(
+            dt->shorten(
+                (unsigned char *) &a, sizeof(a), (unsigned char *) &b, sizeof(b)) ==
+            sizeof(b));
+    }
 }
\ No newline at end of file
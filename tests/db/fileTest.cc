@@ -2,6 +2,8 @@
 #include <db/file.h>
 #include <db/buffer.h>
 #include <db/schema.h>
+#include <db/record.h>
+#include <thread>
 using namespace db;
 
 TEST_CASE("db/file.h", "[p1][p2]")
@@ -65,6 +67,95 @@ TEST_CASE("db/file.h", "[p1][p2]")
         file.close();
     }
 
+    SECTION("eof")
+    {
+        File file;
+        file.open("table.db");
+
+        // 超出文件尾的部分清零
+        char buffer[20];
+        memset(buffer, 0xff, sizeof(buffer));
+        int ret = file.read(0, buffer, sizeof(buffer));
+        REQUIRE(ret == S_OK);
+        REQUIRE(strncmp(buffer, hello, strlen(hello)) == 0);
+        for (size_t i = strlen(hello); i < sizeof(buffer); ++i)
+            REQUIRE(buffer[i] == 0);
+
+        file.close();
+    }
+
+    SECTION("direct")
+    {
+        File file;
+        REQUIRE(file.open("direct.db", true) == S_OK);
+
+        // 直接io需要对齐的buffer
+        alignas(File::DIRECT_ALIGN) static char buffer[8192];
+        memset(buffer, 'x', 4096);
+        REQUIRE(file.write(4096, buffer, 4096) == S_OK);
+        memset(buffer, 0xff, 8192);
+        REQUIRE(file.read(4096, buffer, 8192) == S_OK);
+        REQUIRE(buffer[0] == 'x');
+        REQUIRE(buffer[4095] == 'x');
+        REQUIRE(buffer[4096] == 0); // 文件尾之后清零
+
+        // 未对齐的请求被拒绝，不支持O_DIRECT的文件系统上退回普通模式
+        int ret = file.read(1, buffer, 13);
+        REQUIRE(ret == (file.direct() ? EINVAL : S_OK));
+
+        file.close();
+        File::remove("direct.db");
+    }
+
+    SECTION("mmap")
+    {
+        File file;
+        file.open("mmap.db");
+        // 空文件不能映射
+        REQUIRE(file.map() != S_OK);
+        REQUIRE(file.mapping(0, 1) == NULL);
+
+        static char buffer[8192];
+        memset(buffer, 'm', sizeof(buffer));
+        file.write(0, buffer, sizeof(buffer));
+        REQUIRE(file.map() == S_OK);
+        const char *addr = file.mapping(4096, 4096);
+        REQUIRE(addr);
+        REQUIRE(memcmp(addr, buffer, 4096) == 0);
+        REQUIRE(file.mapping(4096, 8192) == NULL); // 超出文件尾
+
+        file.advise(File::ADVICE_SEQUENTIAL);
+        REQUIRE(file.advice_ == File::ADVICE_SEQUENTIAL);
+        file.advise(File::ADVICE_RANDOM);
+        REQUIRE(file.advice_ == File::ADVICE_RANDOM);
+
+        file.close();
+        REQUIRE(file.map_ == NULL);
+        File::remove("mmap.db");
+    }
+
+    SECTION("writev")
+    {
+        File file;
+        file.open("writev.db");
+
+        // 一次写入3段，再整体读回
+        char a[3] = {'a', 'a', 'a'};
+        char b[5] = {'b', 'b', 'b', 'b', 'b'};
+        char c[2] = {'c', 'c'};
+        struct iovec iov[3] = {{a, sizeof(a)}, {b, sizeof(b)}, {c, sizeof(c)}};
+        REQUIRE(file.writev(4, iov, 3) == S_OK);
+        REQUIRE(file.sync() == S_OK);
+
+        char buffer[14];
+        REQUIRE(file.read(0, buffer, sizeof(buffer)) == S_OK);
+        REQUIRE(memcmp(buffer + 4, "aaabbbbbcc", 10) == 0);
+        REQUIRE(buffer[0] == 0);
+
+        file.close();
+        File::remove("writev.db");
+    }
+
     SECTION("remove")
     {
         int ret = File::remove("table.db");
@@ -75,5 +166,22 @@ TEST_CASE("db/file.h", "[p1][p2]")
     {
         File *meta = kFiles.open(Schema::META_FILE);
         REQUIRE(meta);
+        REQUIRE(kFiles.get(meta->id_) == meta);
+
+        // 多个线程同时打开同一表，得到同一描述符
+        std::vector<File *> opened(8);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < opened.size(); ++t)
+            threads.push_back(std::thread([&opened, t] {
+                for (int i = 0; i < 1000; ++i) {
+                    File *file = kFiles.open(Schema::META_FILE);
+                    if (kFiles.get(file->id_) != file) file = NULL;
+                    opened[t] = file;
+                }
+            }));
+        for (size_t t = 0; t < threads.size(); ++t)
+            threads[t].join();
+        for (size_t t = 0; t < opened.size(); ++t)
+            REQUIRE(opened[t] == meta);
     }
 }
\ No newline at end of file
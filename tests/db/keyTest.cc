@@ -0,0 +1,145 @@
+// 测试保序的键编码
+#include "../catch.hpp"
+#include <db/key.h>
+#include <db/datatype.h>
+#include <db/schema.h>
+using namespace db;
+
+namespace {
+// 编码一列，返回编码后的字节
+std::vector<unsigned char>
+encode(DataType *type, const void *val, size_t len, bool last)
+{
+    std::vector<unsigned char> out(encodedSize(type, len, last));
+    out.resize(encodeField(type, val, len, last, out.data()));
+    return out;
+}
+
+int compare(
+    const std::vector<unsigned char> &x,
+    const std::vector<unsigned char> &y)
+{
+    return compareKey(x.data(), x.size(), y.data(), y.size());
+}
+} // namespace
+
+TEST_CASE("db/key.h", "[p2]")
+{
+    SECTION("integer")
+    {
+        // 符号位翻转后负数在前
+        DataType *type = findDataType("INT");
+        int values[] = {-2147483647 - 1, -65536, -1, 0, 1, 255, 2147483647};
+        std::vector<unsigned char> last;
+        for (size_t i = 0; i < sizeof(values) / sizeof(int); ++i) {
+            unsigned int v = (unsigned int) values[i];
+            type->htobe(&v);
+            std::vector<unsigned char> key = encode(type, &v, sizeof(v), true);
+            REQUIRE(key.size() == sizeof(v));
+            if (i) {
+                REQUIRE(compare(last, key) < 0);
+                // 记录中的大序值直接用less比较，与编码后的顺序一致
+                unsigned int u = (unsigned int) values[i - 1];
+                type->htobe(&u);
+                REQUIRE(type->less(
+                    (unsigned char *) &u,
+                    sizeof(u),
+                    (unsigned char *) &v,
+                    sizeof(v)));
+                REQUIRE(!type->less(
+                    (unsigned char *) &v,
+                    sizeof(v),
+                    (unsigned char *) &u,
+                    sizeof(u)));
+            }
+            last = key;
+        }
+
+        long long x = htobe64((unsigned long long) -1LL);
+        long long y = htobe64(1);
+        type = findDataType("BIGINT");
+        REQUIRE(type->less(
+            (unsigned char *) &x, sizeof(x), (unsigned char *) &y, sizeof(y)));
+        REQUIRE(
+            compare(
+                encode(type, &x, sizeof(x), true),
+                encode(type, &y, sizeof(y), true)) < 0);
+
+        // 长度不符时只比较两者都有的字节，相同时短的在前
+        unsigned char *px = (unsigned char *) &x;
+        unsigned char *py = (unsigned char *) &y;
+        REQUIRE(type->less(px, 0, py, sizeof(y)));
+        REQUIRE(!type->less(px, 0, py, 0));
+        REQUIRE(!type->less(px, sizeof(x), py, 0));
+        REQUIRE(type->less(px, 2, px, sizeof(x)));
+        REQUIRE(!type->less(px, sizeof(x), px, 2));
+        REQUIRE(type->less(px, sizeof(x), py, 1));
+    }
+
+    SECTION("string")
+    {
+        // 最后一列原样存放，前缀在前
+        DataType *type = findDataType("VARCHAR");
+        std::vector<unsigned char> ab = encode(type, "ab", 2, true);
+        std::vector<unsigned char> abc = encode(type, "abc", 3, true);
+        REQUIRE(ab.size() == 2);
+        REQUIRE(compare(ab, abc) < 0);
+        REQUIRE(compare(abc, ab) > 0);
+        REQUIRE(compare(ab, ab) == 0);
+
+        // 不是最后一列时0x00转义，以0x00 0x00结尾
+        const unsigned char zero[] = {'a', 0, 'b'};
+        std::vector<unsigned char> key = encode(type, zero, 3, false);
+        const unsigned char expect[] = {'a', 0, 0xff, 'b', 0, 0};
+        REQUIRE(key.size() == sizeof(expect));
+        REQUIRE(memcmp(key.data(), expect, sizeof(expect)) == 0);
+        REQUIRE(key.size() <= encodedSize(type, 3, false));
+    }
+
+    SECTION("composite")
+    {
+        // 拼接后先按前一列排列，前一列是后者的前缀时也不被后一列打乱
+        DataType *varchar = findDataType("VARCHAR");
+        DataType *intType = findDataType("INT");
+        auto composite = [&](const char *s, int n) {
+            std::vector<unsigned char> key =
+                encode(varchar, s, strlen(s), false);
+            unsigned int v = (unsigned int) n;
+            intType->htobe(&v);
+            std::vector<unsigned char> tail = encode(intType, &v, sizeof(v), true);
+            key.insert(key.end(), tail.begin(), tail.end());
+            return key;
+        };
+        REQUIRE(compare(composite("a", 2147483647), composite("ab", -1)) < 0);
+        REQUIRE(compare(composite("ab", -1), composite("ab", 0)) < 0);
+        REQUIRE(compare(composite("ab", 5), composite("b", -5)) < 0);
+    }
+
+    SECTION("record")
+    {
+        // 按表的键字段编码
+        RelationInfo info;
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.type = findDataType("BIGINT");
+        info.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -255;
+        field.type = findDataType("VARCHAR");
+        info.fields.push_back(field);
+        info.count = 2;
+        info.key = 1;
+
+        long long id = htobe64(7);
+        char name[] = "key";
+        std::vector<struct iovec> iov = {{&id, sizeof(id)}, {name, 3}};
+        std::vector<unsigned char> key = {0x42};
+        encodeKey(&info, iov, key);
+        REQUIRE(key.size() == 4);
+        REQUIRE(key[0] == 0x42);
+        REQUIRE(memcmp(&key[1], name, 3) == 0);
+    }
+}
@@ -2,7 +2,7 @@
 #include <db/record.h>
 using namespace db;
 
-TEST_CASE("db/record.h")
+TEST_CASE("db/record.h", "[p1]")
 {
     SECTION("size")
     {
@@ -127,5 +127,6 @@ TEST_CASE("db/record.h")
         REQUIRE(bret);
         REQUIRE(memcmp(pb, &length, sizeof(length)) == 0);
         REQUIRE(l == 8);
+        REQUIRE(!record.refByIndex(&pb, &l, 4));
     }
 }
\ No newline at end of file
@@ -34,7 +34,7 @@ TEST_CASE("db/schema.h", "[p1][p2]")
         relation.key = 0;
 
         int total = relation.iovSize();
-        REQUIRE(total == 3 * 4 + 7);
+        REQUIRE(total == 3 * 4 + 7 + 1);
 
         Schema schema;
         std::vector<struct iovec> iov(total);
@@ -62,6 +62,24 @@ TEST_CASE("db/schema.h", "[p1][p2]")
         REQUIRE(iov[4].iov_len == 4);
         unsigned int key = *((unsigned int *) iov[4].iov_base);
         REQUIRE(key == 0);
+
+        // 单列键没有组合键的域
+        REQUIRE(iov[total - 1].iov_len == 0);
+
+        // 组合键随元数据存取
+        relation.keys = {2, 0};
+        schema.initIov("table", relation, iov);
+        REQUIRE(iov[total - 1].iov_len == 2 * sizeof(unsigned int));
+        schema.htobe(iov);
+        RelationInfo info;
+        std::string name;
+        schema.retrieveInfo(name, info, iov);
+        schema.betoh(iov);
+        REQUIRE(name == "table");
+        REQUIRE(info.composite());
+        REQUIRE(info.keys == relation.keys);
+        REQUIRE(info.compound.size == -(2 * 255 + 2 + 8));
+        REQUIRE(info.compound.byteComparable);
     }
 
     SECTION("create")
@@ -91,6 +109,16 @@ TEST_CASE("db/schema.h", "[p1][p2]")
         relation.fields.push_back(field);
 
         relation.count = 3;
+
+        // 键的域越界
+        relation.key = 3;
+        REQUIRE(kSchema.create("table", relation) == EINVAL);
+        relation.keys = {3};
+        REQUIRE(kSchema.create("table", relation) == EINVAL);
+        relation.keys = {1, 3};
+        REQUIRE(kSchema.create("table", relation) == EINVAL);
+        REQUIRE(!kSchema.lookup("table").second);
+        relation.keys.clear();
         relation.key = 0;
 
         int ret = kSchema.create("table", relation);
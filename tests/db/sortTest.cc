@@ -0,0 +1,166 @@
+// 测试外排序
+#include "../catch.hpp"
+#include <db/sort.h>
+#include <db/block.h>
+#include <db/buffer.h>
+#include <db/table.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+using namespace db;
+
+namespace {
+// 与表的列对应：id BIGINT, val INT，键为乱序的i
+const long long ROWS = 30000;
+
+inline long long shuffled(long long i) { return i * 7919 % ROWS; }
+
+void setRow(long long key, unsigned int val, std::vector<struct iovec> &iov)
+{
+    static long long k;
+    static unsigned int v;
+    k = key;
+    v = val;
+    findDataType("BIGINT")->htobe(&k);
+    findDataType("INT")->htobe(&v);
+    iov[0].iov_base = &k;
+    iov[0].iov_len = sizeof(long long);
+    iov[1].iov_base = &v;
+    iov[1].iov_len = sizeof(unsigned int);
+}
+
+long long getKey(std::vector<struct iovec> &iov)
+{
+    long long key;
+    memcpy(&key, iov[0].iov_base, sizeof(long long));
+    return be64toh(key);
+}
+} // namespace
+
+TEST_CASE("db/sort.h", "[p2]")
+{
+    if (!kSchema.lookup("sorted").second) {
+        RelationInfo relation;
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.type = findDataType("BIGINT");
+        relation.fields.push_back(field);
+        field.name = "val";
+        field.index = 1;
+        field.length = 4;
+        field.type = findDataType("INT");
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+        REQUIRE(kSchema.create("sorted", relation) == S_OK);
+    }
+    Table table;
+    REQUIRE(table.open("sorted") == S_OK);
+    std::vector<struct iovec> iov(2);
+
+    SECTION("memory")
+    {
+        // 放得下时不写临时文件
+        Sorter sorter;
+        REQUIRE(sorter.open(&table, 2) == EINVAL);
+        REQUIRE(sorter.open(&table) == S_OK);
+        for (long long i = 0; i < 1000; ++i) {
+            setRow(1000 - i, (unsigned int) i, iov);
+            REQUIRE(sorter.add(iov) == S_OK);
+        }
+        REQUIRE(sorter.finish() == S_OK);
+        REQUIRE(sorter.runs() == 0);
+        for (long long i = 1; i <= 1000; ++i) {
+            REQUIRE(sorter.next(iov));
+            REQUIRE(getKey(iov) == i);
+        }
+        REQUIRE(!sorter.next(iov));
+    }
+
+    SECTION("external")
+    {
+        // 只借3个frame，run多于frame，需要多趟合并
+        Sorter sorter;
+        REQUIRE(sorter.open(&table, Sorter::MIN_FRAMES) == S_OK);
+        REQUIRE(sorter.frames() == Sorter::MIN_FRAMES);
+        for (long long i = 0; i < ROWS; ++i) {
+            setRow(shuffled(i), (unsigned int) shuffled(i), iov);
+            REQUIRE(sorter.add(iov) == S_OK);
+        }
+        REQUIRE(sorter.finish() == S_OK);
+        REQUIRE(sorter.runs() > 1);
+        REQUIRE(sorter.runs() <= sorter.frames());
+
+        // 排好序后直接装载
+        REQUIRE(table.bulkLoad(Sorter::source, &sorter) == S_OK);
+        REQUIRE(table.recordCount() == ROWS);
+        long long expect = 0;
+        for (Table::BlockIterator bi = table.beginblock();
+             bi != table.endblock();
+             ++bi) {
+            for (DataBlock::RecordIterator ri = bi->beginrecord();
+                 ri != bi->endrecord();
+                 ++ri) {
+                unsigned char *pkey;
+                unsigned int len;
+                long long key;
+                ri->refByIndex(&pkey, &len, 0);
+                memcpy(&key, pkey, len);
+                REQUIRE(be64toh(key) == expect);
+                ++expect;
+            }
+        }
+        REQUIRE(expect == ROWS);
+
+        // frame归还给buffer
+        size_t idles = kBuffer.idles();
+        sorter.close();
+        REQUIRE(kBuffer.idles() == idles + Sorter::MIN_FRAMES);
+    }
+
+#ifdef __linux__
+    SECTION("error")
+    {
+        // 合并中读临时文件出错，不当作取完
+        Sorter sorter;
+        REQUIRE(sorter.open(&table, Sorter::MIN_FRAMES) == S_OK);
+        for (long long i = 0; i < ROWS; ++i) {
+            setRow(shuffled(i), (unsigned int) shuffled(i), iov);
+            REQUIRE(sorter.add(iov) == S_OK);
+        }
+        REQUIRE(sorter.finish() == S_OK);
+        REQUIRE(sorter.runs() > 1);
+
+        // 临时文件的描述符换成只写的，之后pread失败
+        int broken = 0;
+        DIR *dir = opendir("/proc/self/fd");
+        REQUIRE(dir);
+        while (struct dirent *entry = readdir(dir)) {
+            std::string link = std::string("/proc/self/fd/") + entry->d_name;
+            char target[4096];
+            ssize_t len = readlink(link.c_str(), target, sizeof(target) - 1);
+            if (len <= 0) continue;
+            target[len] = 0;
+            if (!strstr(target, "/sorted.") || !strstr(target, ".sort"))
+                continue;
+            int fd = ::open("/dev/null", O_WRONLY);
+            REQUIRE(dup2(fd, atoi(entry->d_name)) >= 0);
+            ::close(fd);
+            ++broken;
+        }
+        closedir(dir);
+        REQUIRE(broken == 1);
+
+        long long rows = 0;
+        while (sorter.next(iov))
+            ++rows;
+        REQUIRE(rows < ROWS);
+        REQUIRE(sorter.error() == EBADF);
+        REQUIRE(Sorter::source(iov, &sorter) == EBADF);
+    }
+#endif
+}
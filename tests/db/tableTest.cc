@@ -3,6 +3,7 @@
 #include <db/table.h>
 #include <db/block.h>
 #include <db/buffer.h>
+#include <db/file.h>
 using namespace db;
 
 namespace {
@@ -68,15 +69,13 @@ TEST_CASE("db/table.h")
 {
     SECTION("less")
     {
-        Buffer::BlockMap::key_compare compare;
-        const char *table = "hello";
-        std::pair<const char *, unsigned int> key1(table, 1);
-        const char *table2 = "hello";
-        std::pair<const char *, unsigned int> key2(table2, 1);
-        bool ret = !compare(key1, key2);
-        REQUIRE(ret);
-        ret = !compare(key2, key1);
-        REQUIRE(ret);
+        // 表名相同而指针不同，得到同一个文件编号
+        std::string table = "table";
+        std::string table2 = "table";
+        File *file = kFiles.open(table.c_str());
+        REQUIRE(file);
+        REQUIRE(kFiles.open(table2.c_str()) == file);
+        REQUIRE(kFiles.get(file->id_) == file);
     }
 
     SECTION("open")
@@ -181,7 +180,7 @@ TEST_CASE("db/table.h")
                 table.locate(iov[0].iov_base, (unsigned int) iov[0].iov_len);
             // 插入记录
             ret = table.insert(blkid, iov);
-            if (ret == EEXIST) { printf("id=%lld exist\n", be64toh(nid)); }
+            if (ret == EEXIST) { printf("id=%lld exist\n", (long long) be64toh(nid)); }
             if (ret == EFAULT) break;
         }
         // 这里测试表明再插入到91条记录后出现分裂
@@ -193,7 +192,6 @@ TEST_CASE("db/table.h")
     {
         Table table;
         table.open("table");
-        DataType *type = table.info_->fields[table.info_->key].type;
 
         Table::BlockIterator bi = table.beginblock();
 
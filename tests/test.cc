@@ -1,5 +1,6 @@
 // 采用catch2作为单元测试方案，需要一个main函数，这里定义
 #define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_NO_POSIX_SIGNALS // 新版glibc的SIGSTKSZ不是常量
 #include "catch.hpp"
 
 int main(int argc, char *argv[])